@@ -1,5 +1,6 @@
 # pragma once
 # include "HTTPClient.hpp"
+# include "HTTPEngine.hpp"
 
 namespace s3d {
 	class AsyncHTTPTask::AsyncHTTPTaskImpl
@@ -7,23 +8,28 @@ namespace s3d {
 
 	private:
 
-		HTTPProgress m_progressValue;
+		// getProgress() ŁAHTTPEngine 񂾒lǂݍރRs[
+		mutable HTTPProgress m_progressValue;
 
 		HTTPResponse m_response;
 
-		BinaryWriter m_writer;
+		std::shared_ptr<detail::HTTPEngineTransfer> m_transfer;
 
-		ConcurrentTask<HTTPResponse> m_task;
+		bool m_delivered = false;
 
-		bool m_autoFollowLocation = true;
+		HTTPExecutor m_executor = HTTPExecutor::MainThread;
 
-		HTTPResponse innerDownloadTask();
+		bool m_hasThen = false;
 
 	public:
 
 		AsyncHTTPTaskImpl() = default;
 
-		AsyncHTTPTaskImpl(URLView url, FilePathView path, bool autoFollowLocation = true);
+		AsyncHTTPTaskImpl(URLView url, const HTTPHeader& header, FilePathView path, const HTTPRequestOptions& options);
+
+		AsyncHTTPTaskImpl(const Array<URL>& urls, FilePathView path, const HTTPRequestOptions& options);
+
+		explicit AsyncHTTPTaskImpl(const std::shared_ptr<detail::HTTPEngineTransfer>& transfer);
 
 		~AsyncHTTPTaskImpl();
 
@@ -36,6 +42,18 @@ namespace s3d {
 
 		void cancelTask();
 
+		void setBandwidthLimit(int64 maxRecvBytesPerSec, int64 maxSendBytesPerSec);
+
+		void resumeOn(HTTPExecutor executor);
+
+		void then(std::function<void(const HTTPResponse&)> callback, HTTPExecutor executor);
+
+		bool setContinuation(void (*callback)(void*), void* context);
+
+		bool isFinished() const;
+
+		const HTTPResponse& getFinishedResponse() const;
+
 		//stask.get()
 		bool isDone();
 	};
@@ -0,0 +1,149 @@
+﻿# pragma once
+# include <atomic>
+# include <cstdlib>
+# include <cstring>
+# include <new>
+# include <curl/curl.h>
+# include "../HTTPClient.hpp"
+
+//
+// ベンチマーク用のヒープ確保回数のカウンタ
+//
+// operator new の置き換えはプログラム全体で 1 つしか定義できないため、
+// 1 つの翻訳単位でだけ SIV3D_HTTPCLIENT_DEFINE_ALLOCATION_COUNTER を定義してからインクルードしてください。
+// libcurl 内部の malloc は、InitCURLWithAllocationCounter() で初期化した場合に数えられます。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		namespace detail
+		{
+			inline std::atomic<uint64> AllocationCount = 0;
+
+			inline std::atomic<bool> AllocationCounterEnabled = false;
+
+			inline void* CountingMalloc(const size_t size)
+			{
+				AllocationCount.fetch_add(1, std::memory_order_relaxed);
+				return std::malloc(size);
+			}
+
+			inline void CountingFree(void* p)
+			{
+				std::free(p);
+			}
+
+			inline void* CountingRealloc(void* p, const size_t size)
+			{
+				AllocationCount.fetch_add(1, std::memory_order_relaxed);
+				return std::realloc(p, size);
+			}
+
+			inline char* CountingStrdup(const char* s)
+			{
+				const size_t size = (std::strlen(s) + 1);
+
+				if (void* p = CountingMalloc(size))
+				{
+					return static_cast<char*>(std::memcpy(p, s, size));
+				}
+
+				return nullptr;
+			}
+
+			inline void* CountingCalloc(const size_t count, const size_t size)
+			{
+				AllocationCount.fetch_add(1, std::memory_order_relaxed);
+				return std::calloc(count, size);
+			}
+		}
+
+		/// <summary>
+		/// libcurl の初期化をやり直し、libcurl 内部のヒープ確保も数えるようにします。
+		/// 他の通信が行われていない状態で呼んでください。
+		/// </summary>
+		inline bool InitCURLWithAllocationCounter()
+		{
+			SimpleHTTP::CleanupCURL();
+
+			if (::curl_global_init_mem(CURL_GLOBAL_ALL, detail::CountingMalloc, detail::CountingFree,
+				detail::CountingRealloc, detail::CountingStrdup, detail::CountingCalloc) != ::CURLE_OK)
+			{
+				return false;
+			}
+
+			detail::AllocationCounterEnabled = true;
+
+			return true;
+		}
+
+		/// <summary>
+		/// これまでのヒープ確保の回数を返します。カウンタが有効でない場合は none
+		/// </summary>
+		[[nodiscard]] inline Optional<uint64> GetAllocationCount()
+		{
+			if (!detail::AllocationCounterEnabled)
+			{
+				return none;
+			}
+
+			return detail::AllocationCount.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+# ifdef SIV3D_HTTPCLIENT_DEFINE_ALLOCATION_COUNTER
+
+namespace s3d::Benchmark::detail
+{
+	inline const bool AllocationCounterDefined = (AllocationCounterEnabled = true);
+}
+
+void* operator new(const std::size_t size)
+{
+	if (void* p = s3d::Benchmark::detail::CountingMalloc(size ? size : 1))
+	{
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](const std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(const std::size_t size, const std::nothrow_t&) noexcept
+{
+	return s3d::Benchmark::detail::CountingMalloc(size ? size : 1);
+}
+
+void* operator new[](const std::size_t size, const std::nothrow_t&) noexcept
+{
+	return s3d::Benchmark::detail::CountingMalloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+# endif
@@ -0,0 +1,104 @@
+﻿# pragma once
+# include <chrono>
+# include <thread>
+# include "../HTTPClient.hpp"
+# include "LoopbackHTTPServer.hpp"
+
+//
+// LoopbackHTTPServer の Server-Sent Events を受信し、接続を切られても順番どおりに届くことを確かめます。
+// サーバーは batch 個ごとに接続を切り、各イベントの 2 行目の data: で受け取った Last-Event-ID を返すため、
+// 再接続のリクエストが直前のイベントの id を Last-Event-ID として送っていることも確かめられます。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		struct EventStreamBenchmarkResult
+		{
+			size_t events = 0;
+
+			size_t received = 0;
+
+			/// <summary>
+			/// id が直前のイベントの次ではなかったイベントの数
+			/// </summary>
+			size_t outOfOrder = 0;
+
+			/// <summary>
+			/// サーバーが受け取った Last-Event-ID が、その接続の直前のイベントの id と一致しなかったイベントの数
+			/// </summary>
+			size_t lastEventIDMismatches = 0;
+
+			uint32 reconnects = 0;
+
+			/// <summary>
+			/// すべて受信した後、サーバーが 204 を返すと Succeeded になる
+			/// </summary>
+			HTTPAsyncStatus status = HTTPAsyncStatus::None;
+
+			double wallSec = 0.0;
+		};
+
+		/// <summary>
+		/// events 個のイベントを、batch 個ごとに再接続しながら受信します。
+		/// </summary>
+		/// <param name="retryMs">
+		/// サーバーが retry: で指定する再接続までの時間
+		/// </param>
+		inline EventStreamBenchmarkResult RunEventStreamBenchmark(const size_t events = 1000, const size_t batch = 10,
+			const int32 retryMs = 1, const Milliseconds timeout = Milliseconds{ 30000 })
+		{
+			EventStreamBenchmarkResult result;
+			result.events = events;
+
+			LoopbackHTTPServer server;
+
+			if (!server.start())
+			{
+				return result;
+			}
+
+			const auto begin = std::chrono::steady_clock::now();
+			HTTPEventStream stream = SimpleHTTP::OpenEventStream(server.eventStreamURL(static_cast<int64>(events), static_cast<int64>(batch), retryMs));
+
+			HTTPEvent event;
+
+			for (;;)
+			{
+				// 終了後に残っているイベントも取り出してから抜ける
+				const bool working = (stream.currentStatus() == HTTPAsyncStatus::Working);
+
+				while (stream.tryPop(event))
+				{
+					const size_t id = (result.received + 1);
+					const size_t lastEventID = (((id - 1) / batch) * batch);
+					++result.received;
+
+					if (event.id != U"{}"_fmt(id))
+					{
+						++result.outOfOrder;
+					}
+					else if (event.data != U"event {}\nlast-event-id {}"_fmt(id, lastEventID))
+					{
+						++result.lastEventIDMismatches;
+					}
+				}
+
+				if (!working || (timeout < (std::chrono::steady_clock::now() - begin)))
+				{
+					break;
+				}
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+
+			result.wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+			result.reconnects = stream.reconnectCount();
+			result.status = stream.currentStatus();
+			stream.close();
+
+			return result;
+		}
+	}
+}
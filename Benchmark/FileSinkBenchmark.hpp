@@ -0,0 +1,158 @@
+﻿# pragma once
+# include <ctime>
+# include "../HTTPFileSink.hpp"
+
+//
+// 多数の通信が同時にファイルへ書き込む状況を再現し、書き込み方式ごとの時間と CPU 時間を比べます。
+// ネットワークは使わず、HTTPEngine と同じく 1 つのスレッドが、すべての書き込み先に CallbackWrite と同じ 16 KB 単位で順番にデータを渡します。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		struct FileSinkBenchmarkResult
+		{
+			HTTPFileWriteMode mode = HTTPFileWriteMode::Direct;
+
+			/// <summary>
+			/// 実際に使われた書き込み方式。io_uring を使えない環境で IoUring を指定した場合などは Direct になります。
+			/// </summary>
+			HTTPFileWriteMode actualMode = HTTPFileWriteMode::Direct;
+
+			double wallSec = 0.0;
+
+			double cpuSec = 0.0;
+
+			double bytesPerSec = 0.0;
+
+			size_t failedTransfers = 0;
+		};
+
+		/// <summary>
+		/// CreateFileSink() が作成した書き込み先の方式を返します。
+		/// </summary>
+		[[nodiscard]] inline HTTPFileWriteMode GetFileSinkMode(const detail::IHTTPFileSink& sink)
+		{
+			if (dynamic_cast<const detail::WriteBehindFileSink*>(&sink))
+			{
+				return HTTPFileWriteMode::WriteBehind;
+			}
+
+			if (dynamic_cast<const detail::MemoryMappedFileSink*>(&sink))
+			{
+				return HTTPFileWriteMode::MemoryMapped;
+			}
+
+		# if SIV3D_HTTPCLIENT_IO_URING
+
+			if (dynamic_cast<const detail::IoUringFileSink*>(&sink))
+			{
+				return HTTPFileWriteMode::IoUring;
+			}
+
+		# endif
+
+			return HTTPFileWriteMode::Direct;
+		}
+
+		inline FileSinkBenchmarkResult RunFileSinkBenchmark(const HTTPFileWriteMode mode, const size_t transfers, const int64 bytesPerTransfer, const FilePathView directory)
+		{
+			constexpr size_t ChunkSize = (16 * 1024);
+
+			const Array<uint8> chunk(ChunkSize, uint8{ 0x5A });
+
+			FileSystem::CreateDirectories(directory);
+
+			HTTPRequestOptions options;
+			options.writeMode = mode;
+
+			FileSinkBenchmarkResult result;
+			result.mode = mode;
+			result.actualMode = mode;
+
+			size_t failed = 0;
+
+			// 失敗した通信の書き込み先は nullptr にする
+			Array<std::unique_ptr<detail::IHTTPFileSink>> sinks;
+
+			const std::clock_t cpuBegin = std::clock();
+			const auto wallBegin = std::chrono::steady_clock::now();
+
+			for (size_t i = 0; i < transfers; ++i)
+			{
+				auto sink = detail::CreateFileSink(U"{}/sink_{}.bin"_fmt(directory, i), options);
+
+				if (i == 0)
+				{
+					result.actualMode = GetFileSinkMode(*sink);
+				}
+
+				if (!sink->isOpen())
+				{
+					++failed;
+					sink.reset();
+				}
+				else
+				{
+					sink->preallocate(bytesPerTransfer);
+				}
+
+				sinks.push_back(std::move(sink));
+			}
+
+			// curl_multi が複数の通信を進めるように、すべての書き込み先に 1 チャンクずつ順番に書き込む
+			for (int64 written = 0; written < bytesPerTransfer; written += ChunkSize)
+			{
+				const int64 size = Min<int64>(ChunkSize, (bytesPerTransfer - written));
+
+				for (auto& sink : sinks)
+				{
+					if (sink && (sink->write(chunk.data(), size) != size))
+					{
+						sink->discard();
+						sink.reset();
+						++failed;
+					}
+				}
+			}
+
+			for (auto& sink : sinks)
+			{
+				if (sink && !sink->commit())
+				{
+					++failed;
+				}
+			}
+
+			sinks.clear();
+
+			const auto wallEnd = std::chrono::steady_clock::now();
+			const std::clock_t cpuEnd = std::clock();
+
+			result.wallSec = std::chrono::duration<double>(wallEnd - wallBegin).count();
+			result.cpuSec = (static_cast<double>(cpuEnd - cpuBegin) / CLOCKS_PER_SEC);
+			result.bytesPerSec = (static_cast<double>(transfers * bytesPerTransfer) / result.wallSec);
+			result.failedTransfers = failed;
+
+			FileSystem::Remove(directory);
+
+			return result;
+		}
+
+		/// <summary>
+		/// Direct（BinaryWriter）と各書き込み方式を比較します。
+		/// </summary>
+		inline Array<FileSinkBenchmarkResult> RunFileSinkBenchmarks(const size_t transfers = 256, const int64 bytesPerTransfer = (4 << 20), const FilePathView directory = U"sink_benchmark")
+		{
+			Array<FileSinkBenchmarkResult> results;
+
+			for (const auto mode : { HTTPFileWriteMode::Direct, HTTPFileWriteMode::WriteBehind, HTTPFileWriteMode::MemoryMapped, HTTPFileWriteMode::IoUring })
+			{
+				results.push_back(RunFileSinkBenchmark(mode, transfers, bytesPerTransfer, directory));
+			}
+
+			return results;
+		}
+	}
+}
@@ -0,0 +1,328 @@
+﻿# pragma once
+# include <algorithm>
+# include <atomic>
+# include <chrono>
+# include <thread>
+# include "../HTTPClient.hpp"
+# include "AllocationCounter.hpp"
+# include "LoopbackHTTPServer.hpp"
+
+//
+// LoopbackHTTPServer に対して SimpleHTTP の各 API を同時に実行し、スループットとレイテンシを測ります。
+// 同期 API は同時実行数と同じ数のスレッドから、非同期 API は同時実行数と同じ数の AsyncHTTPTask を保ったまま呼び出します。
+// サーバが Unix ドメインソケットで待ち受けている場合は、HTTPRequestOptions::unixSocketPath で接続します。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		enum class HTTPBenchmarkAPI
+		{
+			Get,
+
+			Post,
+
+			DownloadFile,
+
+			DownloadFileAsync,
+		};
+
+		enum class HTTPBenchmarkTransport
+		{
+			TCPLoopback,
+
+			UnixSocket,
+		};
+
+		struct HTTPBenchmarkConfig
+		{
+			/// <summary>
+			/// レスポンスの本文のバイト数
+			/// </summary>
+			int64 bodySize = (16 * 1024);
+
+			/// <summary>
+			/// サーバが応答するまでの待ち時間（ミリ秒）
+			/// </summary>
+			int32 latencyMs = 0;
+
+			/// <summary>
+			/// Transfer-Encoding: chunked で応答する場合 true
+			/// </summary>
+			bool chunked = false;
+
+			size_t chunkSize = (16 * 1024);
+
+			/// <summary>
+			/// Post で送る本文のバイト数
+			/// </summary>
+			size_t postSize = (4 * 1024);
+
+			/// <summary>
+			/// 1 回の計測で行う通信の数。同時実行数の 2 倍に満たない場合は 2 倍にします。
+			/// </summary>
+			size_t requests = 2048;
+
+			/// <summary>
+			/// 受信したデータの保存先のディレクトリ
+			/// </summary>
+			FilePath directory = U"http_benchmark";
+		};
+
+		struct HTTPBenchmarkResult
+		{
+			HTTPBenchmarkAPI api = HTTPBenchmarkAPI::Get;
+
+			HTTPBenchmarkTransport transport = HTTPBenchmarkTransport::TCPLoopback;
+
+			size_t concurrency = 0;
+
+			size_t requests = 0;
+
+			size_t failedRequests = 0;
+
+			double wallSec = 0.0;
+
+			double requestsPerSec = 0.0;
+
+			double p50LatencyMs = 0.0;
+
+			double p99LatencyMs = 0.0;
+
+			double bytesPerSec = 0.0;
+
+			/// <summary>
+			/// 1 回の通信あたりのヒープ確保の回数。カウンタが有効でない場合は none
+			/// </summary>
+			Optional<double> allocationsPerRequest;
+		};
+
+		namespace detail
+		{
+			using BenchmarkClock = std::chrono::steady_clock;
+
+			inline bool IsSucceeded(const HTTPResponse& response)
+			{
+				return (response.getStatusCode() == HTTPResponseStatusCode::OK);
+			}
+
+			inline double Percentile(Array<double>& values, const double p)
+			{
+				if (values.isEmpty())
+				{
+					return 0.0;
+				}
+
+				const size_t index = Min(static_cast<size_t>(p * values.size()), (values.size() - 1));
+
+				std::nth_element(values.begin(), (values.begin() + index), values.end());
+
+				return values[index];
+			}
+
+			inline double ElapsedMs(const BenchmarkClock::time_point& begin)
+			{
+				return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - begin).count();
+			}
+
+			inline void RunSynchronous(const HTTPBenchmarkAPI api, const URL& url, const HTTPRequestOptions& options, const size_t concurrency, const size_t requests,
+				const HTTPBenchmarkConfig& config, Array<double>& latencies, std::atomic<size_t>& failed)
+			{
+				const Array<uint8> postData(config.postSize, uint8{ 0x5A });
+				const HTTPHeader header;
+				std::atomic<size_t> nextRequest = 0;
+				Array<std::thread> threads;
+
+				for (size_t i = 0; i < concurrency; ++i)
+				{
+					const FilePath path = U"{}/response_{}.bin"_fmt(config.directory, i);
+
+					threads.emplace_back([&, path]()
+					{
+						for (size_t request = nextRequest++; request < requests; request = nextRequest++)
+						{
+							const auto begin = BenchmarkClock::now();
+
+							HTTPResponse response;
+
+							switch (api)
+							{
+							case HTTPBenchmarkAPI::Get:
+								response = SimpleHTTP::Get(url, header, path, options);
+								break;
+							case HTTPBenchmarkAPI::Post:
+								response = SimpleHTTP::Post(url, header, postData.data(), postData.size(), path, options);
+								break;
+							default:
+								response = SimpleHTTP::DownloadFile(url, path, options);
+								break;
+							}
+
+							latencies[request] = ElapsedMs(begin);
+
+							if (!IsSucceeded(response))
+							{
+								++failed;
+							}
+						}
+					});
+				}
+
+				for (auto& thread : threads)
+				{
+					thread.join();
+				}
+			}
+
+			inline void RunAsynchronous(const URL& url, const HTTPRequestOptions& options, const size_t concurrency, const size_t requests,
+				const HTTPBenchmarkConfig& config, Array<double>& latencies, std::atomic<size_t>& failed)
+			{
+				Array<AsyncHTTPTask> tasks(concurrency);
+				Array<Optional<size_t>> taskRequests(concurrency);
+				Array<BenchmarkClock::time_point> beginTimes(concurrency);
+				size_t nextRequest = 0;
+				size_t finished = 0;
+
+				while (finished < requests)
+				{
+					for (size_t i = 0; i < concurrency; ++i)
+					{
+						if (taskRequests[i] && tasks[i].isDone())
+						{
+							latencies[*taskRequests[i]] = ElapsedMs(beginTimes[i]);
+
+							if ((tasks[i].currentStatus() != HTTPAsyncStatus::Succeeded)
+								|| !IsSucceeded(tasks[i].getResponse()))
+							{
+								++failed;
+							}
+
+							taskRequests[i].reset();
+							++finished;
+						}
+
+						if (!taskRequests[i] && (nextRequest < requests))
+						{
+							beginTimes[i] = BenchmarkClock::now();
+							tasks[i] = SimpleHTTP::DownloadFileAsync(url, U"{}/response_{}.bin"_fmt(config.directory, i), options);
+							taskRequests[i] = nextRequest++;
+						}
+					}
+
+					std::this_thread::sleep_for(std::chrono::microseconds(100));
+				}
+			}
+		}
+
+		/// <summary>
+		/// 指定した API を指定した同時実行数で呼び出し、計測結果を返します。
+		/// </summary>
+		inline HTTPBenchmarkResult RunHTTPBenchmark(const LoopbackHTTPServer& server, const HTTPBenchmarkAPI api, const size_t concurrency, const HTTPBenchmarkConfig& config = {})
+		{
+			const size_t requests = Max(config.requests, (concurrency * 2));
+			const URL url = server.url(config.bodySize, config.latencyMs, config.chunked, config.chunkSize);
+
+			HTTPRequestOptions options;
+			options.unixSocketPath = server.unixSocketPath();
+
+			FileSystem::CreateDirectories(config.directory);
+
+			Array<double> latencies(requests);
+			std::atomic<size_t> failed = 0;
+
+			const Optional<uint64> allocationsBegin = GetAllocationCount();
+			const auto wallBegin = detail::BenchmarkClock::now();
+
+			if (api == HTTPBenchmarkAPI::DownloadFileAsync)
+			{
+				detail::RunAsynchronous(url, options, concurrency, requests, config, latencies, failed);
+			}
+			else
+			{
+				detail::RunSynchronous(api, url, options, concurrency, requests, config, latencies, failed);
+			}
+
+			const double wallMs = detail::ElapsedMs(wallBegin);
+			const Optional<uint64> allocationsEnd = GetAllocationCount();
+
+			HTTPBenchmarkResult result;
+			result.api = api;
+			result.transport = (options.unixSocketPath.isEmpty() ? HTTPBenchmarkTransport::TCPLoopback : HTTPBenchmarkTransport::UnixSocket);
+			result.concurrency = concurrency;
+			result.requests = requests;
+			result.failedRequests = failed;
+			result.wallSec = (wallMs / 1000.0);
+			result.requestsPerSec = (requests / result.wallSec);
+			result.p50LatencyMs = detail::Percentile(latencies, 0.50);
+			result.p99LatencyMs = detail::Percentile(latencies, 0.99);
+			result.bytesPerSec = (static_cast<double>(config.bodySize) * (requests - result.failedRequests) / result.wallSec);
+
+			if (allocationsBegin && allocationsEnd)
+			{
+				result.allocationsPerRequest = (static_cast<double>(*allocationsEnd - *allocationsBegin) / requests);
+			}
+
+			FileSystem::Remove(config.directory);
+
+			return result;
+		}
+
+		/// <summary>
+		/// ローカルのサーバを起動し、各 API を同時実行数 1 ～ 1024 で計測します。
+		/// </summary>
+		inline Array<HTTPBenchmarkResult> RunHTTPBenchmarks(const HTTPBenchmarkConfig& config = {},
+			const Array<size_t>& concurrencies = { 1, 4, 16, 64, 256, 1024 })
+		{
+			LoopbackHTTPServer server;
+
+			if (!server.start())
+			{
+				return{};
+			}
+
+			Array<HTTPBenchmarkResult> results;
+
+			for (const auto api : { HTTPBenchmarkAPI::Get, HTTPBenchmarkAPI::Post, HTTPBenchmarkAPI::DownloadFile, HTTPBenchmarkAPI::DownloadFileAsync })
+			{
+				for (const auto concurrency : concurrencies)
+				{
+					results.push_back(RunHTTPBenchmark(server, api, concurrency, config));
+				}
+			}
+
+			return results;
+		}
+
+		/// <summary>
+		/// 同じサーバを 127.0.0.1 と Unix ドメインソケットで起動し、Get と DownloadFileAsync を両方の経路で計測します。
+		/// ローカルのサイドカーとの通信のように、小さなレスポンスで差が出やすくなります。
+		/// Unix ドメインソケットに対応した libcurl（Linux のシステムの libcurl 7.88.1 などで計測）が必要です。
+		/// 同梱の Windows 版 libcurl 7.65.1 では、Unix ドメインソケットの経路の通信はすべて失敗します。
+		/// </summary>
+		inline Array<HTTPBenchmarkResult> RunTransportBenchmarks(const HTTPBenchmarkConfig& config = { 256 },
+			const Array<size_t>& concurrencies = { 1, 16, 64 },
+			const FilePath& unixSocketPath = (FileSystem::TemporaryDirectoryPath() + U"siv3d_http_benchmark.sock"))
+		{
+			LoopbackHTTPServer tcpServer, unixServer;
+
+			if (!tcpServer.start() || !unixServer.startUnixSocket(unixSocketPath))
+			{
+				return{};
+			}
+
+			Array<HTTPBenchmarkResult> results;
+
+			for (const auto api : { HTTPBenchmarkAPI::Get, HTTPBenchmarkAPI::DownloadFileAsync })
+			{
+				for (const auto concurrency : concurrencies)
+				{
+					results.push_back(RunHTTPBenchmark(tcpServer, api, concurrency, config));
+					results.push_back(RunHTTPBenchmark(unixServer, api, concurrency, config));
+				}
+			}
+
+			return results;
+		}
+	}
+}
@@ -0,0 +1,294 @@
+﻿# pragma once
+# include <chrono>
+# include <string>
+# include "../HTTPRequest.hpp"
+# include "AllocationCounter.hpp"
+
+//
+// レスポンスヘッダーの処理（detail::HeaderCallback と HTTPResponse のコンストラクタ）のマイクロベンチマーク
+// 記録したレスポンスヘッダーを libcurl と同じく 1 行ずつ HeaderCallback に渡し、HTTPResponse を作成するまでを 1 回として測ります。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		struct HeaderCorpus
+		{
+			String name;
+
+			/// <summary>
+			/// HeaderCallback に渡す行（末尾の CRLF を含む）
+			/// </summary>
+			Array<std::string> lines;
+
+			/// <summary>
+			/// 最後のレスポンスのステータスコード
+			/// </summary>
+			HTTPResponseStatusCode expectedStatusCode = HTTPResponseStatusCode::OK;
+		};
+
+		struct HeaderParsingBenchmarkResult
+		{
+			String corpus;
+
+			size_t responses = 0;
+
+			/// <summary>
+			/// HeaderCallback にすべての行を渡すのにかかった、1 レスポンスあたりの時間（ナノ秒）
+			/// </summary>
+			double callbackNsPerResponse = 0.0;
+
+			/// <summary>
+			/// HTTPResponse の作成にかかった、1 レスポンスあたりの時間（ナノ秒）
+			/// </summary>
+			double constructorNsPerResponse = 0.0;
+
+			double nsPerResponse = 0.0;
+
+			/// <summary>
+			/// 1 レスポンスあたりのヒープ確保の回数。カウンタが有効でない場合は none
+			/// </summary>
+			Optional<double> allocationsPerResponse;
+
+			/// <summary>
+			/// ステータスコードを正しく読み取れなかった回数
+			/// </summary>
+			size_t mismatches = 0;
+		};
+
+		namespace detail
+		{
+			/// <summary>
+			/// 改行で区切られた記録を、CRLF で終わる行の配列にします。
+			/// </summary>
+			inline Array<std::string> SplitHeaderLines(const char* recorded)
+			{
+				Array<std::string> lines;
+				std::string line;
+
+				for (const char* p = recorded; *p; ++p)
+				{
+					if (*p == '\n')
+					{
+						lines.push_back(line + "\r\n");
+						line.clear();
+					}
+					else
+					{
+						line.push_back(*p);
+					}
+				}
+
+				return lines;
+			}
+
+			// httpbin.org の GET /get
+			inline constexpr char ShortHeaderRecord[] =
+R"(HTTP/1.1 200 OK
+Date: Sat, 17 Oct 2026 09:12:44 GMT
+Content-Type: application/json
+Content-Length: 429
+Connection: keep-alive
+Server: gunicorn/19.9.0
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Credentials: true
+
+)";
+
+			// CDN 経由の静的ファイル（64 フィールド）
+			inline constexpr char CDNHeaderRecord[] =
+R"(HTTP/1.1 200 OK
+Date: Sat, 17 Oct 2026 09:14:02 GMT
+Content-Type: application/octet-stream
+Content-Length: 52428800
+Connection: keep-alive
+Accept-Ranges: bytes
+Age: 48213
+Cache-Control: public, max-age=31536000, immutable
+ETag: "5f3c2a7b-3200000"
+Last-Modified: Mon, 02 Mar 2026 11:40:27 GMT
+Expires: Sun, 17 Oct 2027 09:14:02 GMT
+Vary: Accept-Encoding, Origin
+Via: 1.1 varnish, 1.1 varnish
+X-Served-By: cache-nrt-rjtf7700041-NRT, cache-tyo11932-TYO
+X-Cache: HIT, HIT
+X-Cache-Hits: 12, 371
+X-Timer: S1792228442.117221,VS0,VE1
+X-Request-Id: 7c1e0b2a-4f6d-4b39-9f0e-2d9a8c51e3b7
+X-Amz-Cf-Pop: NRT57-C3
+X-Amz-Cf-Id: oQ4r0R1kVbM2h7N3xG6Q0cJ8yLw2pZs5tD9uE1fA4iK7mB3nC6vX0g==
+X-Amz-Server-Side-Encryption: AES256
+X-Amz-Version-Id: 3HL4kqtJlcpXroDTDmJ+rmSpXd3dIbrHY
+X-Amz-Replication-Status: COMPLETED
+X-Amz-Storage-Class: INTELLIGENT_TIERING
+X-Content-Type-Options: nosniff
+X-Frame-Options: SAMEORIGIN
+X-XSS-Protection: 1; mode=block
+X-Download-Options: noopen
+X-Permitted-Cross-Domain-Policies: none
+X-DNS-Prefetch-Control: off
+X-Robots-Tag: noindex
+Strict-Transport-Security: max-age=63072000; includeSubDomains; preload
+Content-Security-Policy: default-src 'none'; frame-ancestors 'none'
+Referrer-Policy: strict-origin-when-cross-origin
+Permissions-Policy: interest-cohort=()
+Cross-Origin-Resource-Policy: cross-origin
+Cross-Origin-Opener-Policy: same-origin
+Cross-Origin-Embedder-Policy: require-corp
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Methods: GET, HEAD, OPTIONS
+Access-Control-Allow-Headers: Range, If-None-Match, If-Modified-Since
+Access-Control-Expose-Headers: Content-Length, Content-Range, ETag
+Access-Control-Max-Age: 86400
+Timing-Allow-Origin: *
+Server: AmazonS3
+Server-Timing: cdn-cache; desc=HIT, edge; dur=1, origin; dur=0
+Alt-Svc: h3=":443"; ma=86400, h3-29=":443"; ma=86400
+NEL: {"success_fraction":0,"report_to":"cf-nel","max_age":604800}
+Report-To: {"endpoints":[{"url":"https:\/\/a.nel.example.net\/report\/v3"}],"group":"cf-nel","max_age":604800}
+CF-Cache-Status: HIT
+CF-Ray: 8d1f3a9b7c6e4f21-NRT
+CDN-Cache-Control: max-age=604800
+Surrogate-Key: assets release-2026-03 build-4812
+Surrogate-Control: max-age=2592000
+Fastly-Debug-Digest: 9a1c4f7e2b3d5a6c8e0f1a2b3c4d5e6f7a8b9c0d1e2f3a4b5c6d7e8f9a0b1c2d
+X-Origin-Cache: MISS
+X-Edge-Location: tyo
+X-Edge-Response-Time: 0.001
+X-Backend: assets-origin-pool-2
+X-Proxy-Cache: HIT
+X-Akamai-Transformed: 9 - 0 pmb=mRUM,1
+X-Check-Cacheable: YES
+X-Varnish: 412886734 398271162
+X-Content-Digest: sha-256=:q2v1O0cY6x7k0hJ3t0x9sZ8n1m2b3v4c5x6z7a8s9d0=:
+X-Trace-Id: 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01
+
+)";
+
+			// http://httpbin.org/redirect/3 を自動でリダイレクトした場合
+			inline constexpr char RedirectChainRecord[] =
+R"(HTTP/1.1 302 FOUND
+Date: Sat, 17 Oct 2026 09:15:31 GMT
+Content-Type: text/html; charset=utf-8
+Content-Length: 247
+Connection: keep-alive
+Server: gunicorn/19.9.0
+Location: /relative-redirect/2
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Credentials: true
+
+HTTP/1.1 302 FOUND
+Date: Sat, 17 Oct 2026 09:15:31 GMT
+Content-Type: text/html; charset=utf-8
+Content-Length: 0
+Connection: keep-alive
+Server: gunicorn/19.9.0
+Location: /relative-redirect/1
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Credentials: true
+
+HTTP/1.1 302 FOUND
+Date: Sat, 17 Oct 2026 09:15:31 GMT
+Content-Type: text/html; charset=utf-8
+Content-Length: 0
+Connection: keep-alive
+Server: gunicorn/19.9.0
+Location: /get
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Credentials: true
+
+HTTP/1.1 200 OK
+Date: Sat, 17 Oct 2026 09:15:32 GMT
+Content-Type: application/json
+Content-Length: 254
+Connection: keep-alive
+Server: gunicorn/19.9.0
+Access-Control-Allow-Origin: *
+Access-Control-Allow-Credentials: true
+
+)";
+		}
+
+		/// <summary>
+		/// 短いヘッダー、64 フィールドの CDN のヘッダー、リダイレクトの連鎖の 3 つの記録を返します。
+		/// </summary>
+		inline Array<HeaderCorpus> GetHeaderCorpora()
+		{
+			return{
+				{ U"Short", detail::SplitHeaderLines(detail::ShortHeaderRecord) },
+				{ U"CDN (64 headers)", detail::SplitHeaderLines(detail::CDNHeaderRecord) },
+				{ U"Redirect chain (3 hops)", detail::SplitHeaderLines(detail::RedirectChainRecord) },
+			};
+		}
+
+		inline HeaderParsingBenchmarkResult RunHeaderParsingBenchmark(const HeaderCorpus& corpus, const size_t responses = 100000)
+		{
+			using Clock = std::chrono::steady_clock;
+
+			// HeaderCallback は char* を受け取るため、書き込み可能なコピーを渡す
+			Array<std::string> lines = corpus.lines;
+
+			Clock::duration callbackTime{};
+			Clock::duration constructorTime{};
+			size_t mismatches = 0;
+
+			const Optional<uint64> allocationsBegin = GetAllocationCount();
+
+			for (size_t i = 0; i < responses; ++i)
+			{
+				const auto callbackBegin = Clock::now();
+
+				String header;
+
+				for (auto& line : lines)
+				{
+					s3d::detail::HeaderCallback(line.data(), 1, line.size(), &header);
+				}
+
+				const auto constructorBegin = Clock::now();
+
+				const HTTPResponse response(header);
+
+				const auto end = Clock::now();
+
+				callbackTime += (constructorBegin - callbackBegin);
+				constructorTime += (end - constructorBegin);
+
+				if (response.getStatusCode() != corpus.expectedStatusCode)
+				{
+					++mismatches;
+				}
+			}
+
+			const Optional<uint64> allocationsEnd = GetAllocationCount();
+
+			HeaderParsingBenchmarkResult result;
+			result.corpus = corpus.name;
+			result.responses = responses;
+			result.callbackNsPerResponse = (std::chrono::duration<double, std::nano>(callbackTime).count() / responses);
+			result.constructorNsPerResponse = (std::chrono::duration<double, std::nano>(constructorTime).count() / responses);
+			result.nsPerResponse = (result.callbackNsPerResponse + result.constructorNsPerResponse);
+			result.mismatches = mismatches;
+
+			if (allocationsBegin && allocationsEnd)
+			{
+				result.allocationsPerResponse = (static_cast<double>(*allocationsEnd - *allocationsBegin) / responses);
+			}
+
+			return result;
+		}
+
+		inline Array<HeaderParsingBenchmarkResult> RunHeaderParsingBenchmarks(const size_t responses = 100000)
+		{
+			Array<HeaderParsingBenchmarkResult> results;
+
+			for (const auto& corpus : GetHeaderCorpora())
+			{
+				results.push_back(RunHeaderParsingBenchmark(corpus, responses));
+			}
+
+			return results;
+		}
+	}
+}
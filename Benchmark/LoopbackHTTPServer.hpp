@@ -0,0 +1,732 @@
+﻿# pragma once
+# include <atomic>
+# include <mutex>
+# include <thread>
+# include <condition_variable>
+# include <algorithm>
+# include <cstring>
+# include "../HTTPClient.hpp"
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <WinSock2.h>
+#	include <WS2tcpip.h>
+#	include <afunix.h>
+#	pragma comment(lib, "ws2_32")
+# else
+#	include <sys/socket.h>
+#	include <sys/un.h>
+#	include <netinet/in.h>
+#	include <netinet/tcp.h>
+#	include <arpa/inet.h>
+#	include <unistd.h>
+# endif
+
+//
+// ベンチマーク用に 127.0.0.1 か Unix ドメインソケットで待ち受ける HTTP/1.1 サーバ
+// リクエストのクエリで、レスポンスの大きさ・応答までの待ち時間・chunked 転送を指定できます。
+//
+//	/?size=<バイト数>&latency=<ミリ秒>&chunked=<0|1>&chunk=<チャンクのバイト数>
+//
+// events を指定すると Server-Sent Events で応答します。Last-Event-ID の次のイベントから batch 個を送って接続を切り、
+// すべて送った後は 204 No Content を返します。各イベントの 2 行目の data: は、受け取った Last-Event-ID です。
+//
+//	/?events=<イベントの数>&batch=<1 回の接続で送るイベントの数>&retry=<再接続までのミリ秒>
+//
+// POST の本文は読み捨てます。接続は keep-alive で、1 接続ごとに 1 スレッドで応答します。
+// 計測に影響しないよう、接続ごとのスレッドの作成以外ではヒープ確保を行いません。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		class LoopbackHTTPServer
+		{
+		private:
+
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			using NativeSocket = ::SOCKET;
+
+			static constexpr NativeSocket InvalidSocket = INVALID_SOCKET;
+
+		# else
+
+			using NativeSocket = int;
+
+			static constexpr NativeSocket InvalidSocket = -1;
+
+		# endif
+
+			static constexpr size_t RequestBufferSize = (16 * 1024);
+
+			static constexpr size_t BodyBlockSize = (64 * 1024);
+
+			struct RequestParameters
+			{
+				int64 size = 0;
+
+				int32 latencyMs = 0;
+
+				bool chunked = false;
+
+				size_t chunkSize = (16 * 1024);
+
+				// 0 より大きい場合、Server-Sent Events で応答する
+				int64 events = 0;
+
+				int64 batch = 10;
+
+				int32 retryMs = 10;
+
+				// リクエストの Last-Event-ID ヘッダー（無い場合は 0）
+				int64 lastEventID = 0;
+			};
+
+			NativeSocket m_listener = InvalidSocket;
+
+			uint16 m_port = 0;
+
+			// Unix ドメインソケットで待ち受けている場合、そのパス
+			FilePath m_unixSocketPath;
+
+			std::atomic<bool> m_running = false;
+
+			std::thread m_acceptThread;
+
+			std::mutex m_mutex;
+
+			std::condition_variable m_connectionsClosed;
+
+			Array<NativeSocket> m_connections;
+
+			Array<char> m_bodyBlock = Array<char>(BodyBlockSize, 'x');
+
+			static void CloseSocket(const NativeSocket socket)
+			{
+			# if SIV3D_PLATFORM(WINDOWS)
+				::closesocket(socket);
+			# else
+				::close(socket);
+			# endif
+			}
+
+			static void ShutdownSocket(const NativeSocket socket)
+			{
+			# if SIV3D_PLATFORM(WINDOWS)
+				::shutdown(socket, SD_BOTH);
+			# else
+				::shutdown(socket, SHUT_RDWR);
+			# endif
+			}
+
+			static bool SendAll(const NativeSocket socket, const char* data, size_t size)
+			{
+			# if SIV3D_PLATFORM(LINUX)
+				constexpr int flags = MSG_NOSIGNAL;
+			# else
+				constexpr int flags = 0;
+			# endif
+
+				while (size)
+				{
+					const int sent = static_cast<int>(::send(socket, data, static_cast<int>(Min<size_t>(size, INT32_MAX)), flags));
+
+					if (sent <= 0)
+					{
+						return false;
+					}
+
+					data += sent;
+					size -= sent;
+				}
+
+				return true;
+			}
+
+			static int64 ParseInteger(const char* first, const char* last)
+			{
+				int64 value = 0;
+
+				for (; (first != last) && ('0' <= *first) && (*first <= '9'); ++first)
+				{
+					value = (value * 10 + (*first - '0'));
+				}
+
+				return value;
+			}
+
+			static bool EqualsIgnoreCase(const char* first, const char* last, const char* lowerCaseName)
+			{
+				for (; first != last; ++first, ++lowerCaseName)
+				{
+					char ch = *first;
+
+					if (('A' <= ch) && (ch <= 'Z'))
+					{
+						ch = static_cast<char>(ch - 'A' + 'a');
+					}
+
+					if (ch != *lowerCaseName)
+					{
+						return false;
+					}
+				}
+
+				return (*lowerCaseName == '\0');
+			}
+
+			static RequestParameters ParseTarget(const char* first, const char* last)
+			{
+				RequestParameters parameters;
+
+				const char* query = std::find(first, last, '?');
+
+				while (query != last)
+				{
+					const char* name = (query + 1);
+					const char* end = std::find(name, last, '&');
+					const char* equal = std::find(name, end, '=');
+					const char* value = ((equal == end) ? end : (equal + 1));
+
+					if (EqualsIgnoreCase(name, equal, "size"))
+					{
+						parameters.size = ParseInteger(value, end);
+					}
+					else if (EqualsIgnoreCase(name, equal, "latency"))
+					{
+						parameters.latencyMs = static_cast<int32>(ParseInteger(value, end));
+					}
+					else if (EqualsIgnoreCase(name, equal, "chunked"))
+					{
+						parameters.chunked = (ParseInteger(value, end) != 0);
+					}
+					else if (EqualsIgnoreCase(name, equal, "chunk"))
+					{
+						parameters.chunkSize = static_cast<size_t>(Max<int64>(1, ParseInteger(value, end)));
+					}
+					else if (EqualsIgnoreCase(name, equal, "events"))
+					{
+						parameters.events = ParseInteger(value, end);
+					}
+					else if (EqualsIgnoreCase(name, equal, "batch"))
+					{
+						parameters.batch = Max<int64>(1, ParseInteger(value, end));
+					}
+					else if (EqualsIgnoreCase(name, equal, "retry"))
+					{
+						parameters.retryMs = static_cast<int32>(ParseInteger(value, end));
+					}
+
+					query = end;
+				}
+
+				return parameters;
+			}
+
+			bool sendBody(const NativeSocket socket, int64 size) const
+			{
+				while (size > 0)
+				{
+					const size_t blockSize = static_cast<size_t>(Min<int64>(size, BodyBlockSize));
+
+					if (!SendAll(socket, m_bodyBlock.data(), blockSize))
+					{
+						return false;
+					}
+
+					size -= blockSize;
+				}
+
+				return true;
+			}
+
+			/// <summary>
+			/// Last-Event-ID の次のイベントから最大 batch 個を送ります。送った後は false を返して接続を切らせます。
+			/// </summary>
+			static bool RespondEventStream(const NativeSocket socket, const RequestParameters& parameters)
+			{
+				if (parameters.events <= parameters.lastEventID)
+				{
+					static constexpr char NoContent[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+
+					return SendAll(socket, NoContent, (sizeof(NoContent) - 1));
+				}
+
+				static constexpr char Header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+
+				if (!SendAll(socket, Header, (sizeof(Header) - 1)))
+				{
+					return false;
+				}
+
+				const int64 last = Min((parameters.lastEventID + parameters.batch), parameters.events);
+				char event[256];
+
+				for (int64 id = (parameters.lastEventID + 1); id <= last; ++id)
+				{
+					const int length = std::snprintf(event, sizeof(event), "id: %lld\nretry: %d\ndata: event %lld\ndata: last-event-id %lld\n\n",
+						static_cast<long long>(id), parameters.retryMs, static_cast<long long>(id), static_cast<long long>(parameters.lastEventID));
+
+					if ((length < 0) || !SendAll(socket, event, static_cast<size_t>(length)))
+					{
+						return false;
+					}
+				}
+
+				// イベントの区切りの後で切断する
+				return false;
+			}
+
+			bool respond(const NativeSocket socket, const RequestParameters& parameters) const
+			{
+				if (parameters.latencyMs > 0)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(parameters.latencyMs));
+				}
+
+				if (parameters.events > 0)
+				{
+					return RespondEventStream(socket, parameters);
+				}
+
+				char header[256];
+
+				if (!parameters.chunked)
+				{
+					const int length = std::snprintf(header, sizeof(header),
+						"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %lld\r\n\r\n",
+						static_cast<long long>(parameters.size));
+
+					return SendAll(socket, header, length)
+						&& sendBody(socket, parameters.size);
+				}
+
+				const int length = std::snprintf(header, sizeof(header),
+					"HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+				if (!SendAll(socket, header, length))
+				{
+					return false;
+				}
+
+				for (int64 remaining = parameters.size; remaining > 0;)
+				{
+					const int64 chunkSize = Min<int64>(remaining, parameters.chunkSize);
+					const int chunkHeaderLength = std::snprintf(header, sizeof(header), "%llx\r\n", static_cast<unsigned long long>(chunkSize));
+
+					if (!SendAll(socket, header, chunkHeaderLength)
+						|| !sendBody(socket, chunkSize)
+						|| !SendAll(socket, "\r\n", 2))
+					{
+						return false;
+					}
+
+					remaining -= chunkSize;
+				}
+
+				return SendAll(socket, "0\r\n\r\n", 5);
+			}
+
+			void serve(const NativeSocket socket)
+			{
+				char buffer[RequestBufferSize];
+				size_t buffered = 0;
+
+				while (m_running)
+				{
+					const char* headerEnd = nullptr;
+
+					for (;;)
+					{
+						if (buffered >= 4)
+						{
+							const char* const found = std::search(buffer, (buffer + buffered), "\r\n\r\n", ("\r\n\r\n" + 4));
+
+							if (found != (buffer + buffered))
+							{
+								headerEnd = (found + 4);
+								break;
+							}
+						}
+
+						if (buffered == sizeof(buffer))
+						{
+							return;
+						}
+
+						const int received = static_cast<int>(::recv(socket, (buffer + buffered), static_cast<int>(sizeof(buffer) - buffered), 0));
+
+						if (received <= 0)
+						{
+							return;
+						}
+
+						buffered += received;
+					}
+
+					// リクエストライン: <method> <target> HTTP/1.1
+					const char* const lineEnd = std::search(static_cast<const char*>(buffer), headerEnd, "\r\n", ("\r\n" + 2));
+					const char* const targetBegin = (std::find(static_cast<const char*>(buffer), lineEnd, ' ') + 1);
+					const char* const targetEnd = std::find(targetBegin, lineEnd, ' ');
+
+					if (targetBegin > lineEnd)
+					{
+						return;
+					}
+
+					RequestParameters parameters = ParseTarget(targetBegin, targetEnd);
+
+					int64 contentLength = 0;
+					bool keepAlive = true;
+					bool expectContinue = false;
+
+					for (const char* line = (lineEnd + 2); line < (headerEnd - 2);)
+					{
+						const char* const end = std::search(line, headerEnd, "\r\n", ("\r\n" + 2));
+						const char* const colon = std::find(line, end, ':');
+						const char* value = ((colon == end) ? end : (colon + 1));
+
+						while ((value != end) && (*value == ' '))
+						{
+							++value;
+						}
+
+						if (EqualsIgnoreCase(line, colon, "content-length"))
+						{
+							contentLength = ParseInteger(value, end);
+						}
+						else if (EqualsIgnoreCase(line, colon, "connection"))
+						{
+							keepAlive = !EqualsIgnoreCase(value, end, "close");
+						}
+						else if (EqualsIgnoreCase(line, colon, "expect"))
+						{
+							expectContinue = EqualsIgnoreCase(value, end, "100-continue");
+						}
+						else if (EqualsIgnoreCase(line, colon, "last-event-id"))
+						{
+							parameters.lastEventID = ParseInteger(value, end);
+						}
+
+						line = (end + 2);
+					}
+
+					// 応答しないと、curl は本文を送る前に待ち時間（既定で 1 秒）が過ぎるまで待つ
+					if (expectContinue && !SendAll(socket, "HTTP/1.1 100 Continue\r\n\r\n", 25))
+					{
+						return;
+					}
+
+					// 本文を読み捨てる
+					size_t consumed = static_cast<size_t>(headerEnd - buffer);
+					const size_t bufferedBody = static_cast<size_t>(Min<int64>(contentLength, (buffered - consumed)));
+					consumed += bufferedBody;
+					contentLength -= bufferedBody;
+
+					while (contentLength > 0)
+					{
+						const int received = static_cast<int>(::recv(socket, buffer, static_cast<int>(Min<int64>(contentLength, sizeof(buffer))), 0));
+
+						if (received <= 0)
+						{
+							return;
+						}
+
+						contentLength -= received;
+					}
+
+					// パイプライン化された次のリクエストを先頭に詰める
+					if (consumed < buffered)
+					{
+						std::memmove(buffer, (buffer + consumed), (buffered - consumed));
+						buffered -= consumed;
+					}
+					else
+					{
+						buffered = 0;
+					}
+
+					if (!respond(socket, parameters) || !keepAlive)
+					{
+						return;
+					}
+				}
+			}
+
+			void acceptConnections()
+			{
+				while (m_running)
+				{
+					const NativeSocket socket = ::accept(m_listener, nullptr, nullptr);
+
+					if (socket == InvalidSocket)
+					{
+						if (!m_running)
+						{
+							break;
+						}
+
+						// ファイルディスクリプタの不足などで失敗し続ける場合に、CPU を使い切らないようにする
+						std::this_thread::sleep_for(std::chrono::milliseconds(10));
+						continue;
+					}
+
+					if (m_unixSocketPath.isEmpty())
+					{
+						int noDelay = 1;
+						::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+					}
+
+				# if SIV3D_PLATFORM(MACOS)
+					int noSigPipe = 1;
+					::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+				# endif
+
+					{
+						std::lock_guard lock(m_mutex);
+						m_connections.push_back(socket);
+					}
+
+					// 終了したスレッドが溜まらないよう切り離し、stop() では接続の数が 0 になるのを待つ
+					std::thread([this, socket]()
+					{
+						serve(socket);
+
+						std::lock_guard lock(m_mutex);
+						CloseSocket(socket);
+						m_connections.erase(std::find(m_connections.begin(), m_connections.end(), socket));
+						m_connectionsClosed.notify_all();
+					}).detach();
+				}
+			}
+
+			bool listen(const ::sockaddr* address, const ::socklen_t addressLength)
+			{
+				if ((::bind(m_listener, address, addressLength) != 0)
+					|| (::listen(m_listener, SOMAXCONN) != 0))
+				{
+					CloseSocket(m_listener);
+					m_listener = InvalidSocket;
+					return false;
+				}
+
+				m_running = true;
+				m_acceptThread = std::thread(&LoopbackHTTPServer::acceptConnections, this);
+
+				return true;
+			}
+
+			static bool StartupSockets()
+			{
+			# if SIV3D_PLATFORM(WINDOWS)
+
+				::WSADATA data;
+
+				return (::WSAStartup(MAKEWORD(2, 2), &data) == 0);
+
+			# else
+
+				return true;
+
+			# endif
+			}
+
+		public:
+
+			LoopbackHTTPServer() = default;
+
+			LoopbackHTTPServer(const LoopbackHTTPServer&) = delete;
+
+			LoopbackHTTPServer& operator =(const LoopbackHTTPServer&) = delete;
+
+			~LoopbackHTTPServer()
+			{
+				stop();
+			}
+
+			/// <summary>
+			/// 空いているポートで待ち受けを開始します。
+			/// </summary>
+			bool start()
+			{
+				if (m_running)
+				{
+					return true;
+				}
+
+				if (!StartupSockets())
+				{
+					return false;
+				}
+
+				m_listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+				if (m_listener == InvalidSocket)
+				{
+					return false;
+				}
+
+				int reuse = 1;
+				::setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+				::sockaddr_in address = {};
+				address.sin_family = AF_INET;
+				address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				address.sin_port = 0;
+
+				::socklen_t addressLength = sizeof(address);
+
+				if (!listen(reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)))
+				{
+					return false;
+				}
+
+				::getsockname(m_listener, reinterpret_cast<::sockaddr*>(&address), &addressLength);
+				m_port = ntohs(address.sin_port);
+
+				return true;
+			}
+
+			/// <summary>
+			/// 指定したパスの Unix ドメインソケットで待ち受けを開始します。既にあるファイルは削除します。
+			/// </summary>
+			bool startUnixSocket(const FilePathView path)
+			{
+				if (m_running)
+				{
+					return true;
+				}
+
+				::sockaddr_un address = {};
+				address.sun_family = AF_UNIX;
+
+				const std::string pathUTF8 = Unicode::ToUTF8(path);
+
+				if (pathUTF8.size() >= sizeof(address.sun_path))
+				{
+					return false;
+				}
+
+				std::memcpy(address.sun_path, pathUTF8.c_str(), (pathUTF8.size() + 1));
+
+				if (!StartupSockets())
+				{
+					return false;
+				}
+
+				m_listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+				if (m_listener == InvalidSocket)
+				{
+					return false;
+				}
+
+				FileSystem::Remove(path);
+
+				// 受け付けのスレッドが参照するので、待ち受けを始める前に設定する
+				m_unixSocketPath = FilePath(path);
+
+				if (!listen(reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)))
+				{
+					m_unixSocketPath.clear();
+					return false;
+				}
+
+				return true;
+			}
+
+			/// <summary>
+			/// 待ち受けを終了し、すべての接続を閉じます。
+			/// </summary>
+			void stop()
+			{
+				if (!m_running)
+				{
+					return;
+				}
+
+				m_running = false;
+
+				// 待ち受けのスレッドが m_listener を読むため、終了を待ってから書き換える
+				ShutdownSocket(m_listener);
+				CloseSocket(m_listener);
+				m_acceptThread.join();
+				m_listener = InvalidSocket;
+
+				{
+					std::unique_lock lock(m_mutex);
+
+					for (const auto socket : m_connections)
+					{
+						ShutdownSocket(socket);
+					}
+
+					m_connectionsClosed.wait(lock, [this]() { return m_connections.isEmpty(); });
+				}
+
+				if (!m_unixSocketPath.isEmpty())
+				{
+					FileSystem::Remove(m_unixSocketPath);
+					m_unixSocketPath.clear();
+				}
+
+			# if SIV3D_PLATFORM(WINDOWS)
+				::WSACleanup();
+			# endif
+			}
+
+			[[nodiscard]] bool isRunning() const
+			{
+				return m_running;
+			}
+
+			[[nodiscard]] uint16 port() const
+			{
+				return m_port;
+			}
+
+			/// <summary>
+			/// Unix ドメインソケットで待ち受けている場合はそのパスを、TCP の場合は空のパスを返します。
+			/// 通信するときは HTTPRequestOptions::unixSocketPath に設定します。
+			/// </summary>
+			[[nodiscard]] const FilePath& unixSocketPath() const
+			{
+				return m_unixSocketPath;
+			}
+
+			/// <summary>
+			/// 指定した条件で応答する URL を返します。
+			/// </summary>
+			/// <param name="bodySize">
+			/// レスポンスの本文のバイト数
+			/// </param>
+			/// <param name="latencyMs">
+			/// リクエストを受け取ってから応答するまでの待ち時間（ミリ秒）
+			/// </param>
+			/// <param name="chunked">
+			/// Transfer-Encoding: chunked で送る場合 true
+			/// </param>
+			/// <param name="chunkSize">
+			/// chunked で送る場合の 1 チャンクのバイト数
+			/// </param>
+			[[nodiscard]] URL url(const int64 bodySize, const int32 latencyMs = 0, const bool chunked = false, const size_t chunkSize = (16 * 1024)) const
+			{
+				// Unix ドメインソケットの場合、ホストは Host ヘッダーにだけ使われる
+				const String host = (m_unixSocketPath.isEmpty() ? U"127.0.0.1:{}"_fmt(m_port) : String(U"localhost"));
+
+				return U"http://{}/?size={}&latency={}&chunked={}&chunk={}"_fmt(host, bodySize, latencyMs, (chunked ? 1 : 0), chunkSize);
+			}
+
+			/// <summary>
+			/// Server-Sent Events で events 個のイベントを送り、batch 個ごとに接続を切る URL を返します。
+			/// </summary>
+			[[nodiscard]] URL eventStreamURL(const int64 events, const int64 batch = 10, const int32 retryMs = 10) const
+			{
+				const String host = (m_unixSocketPath.isEmpty() ? U"127.0.0.1:{}"_fmt(m_port) : String(U"localhost"));
+
+				return U"http://{}/?events={}&batch={}&retry={}"_fmt(host, events, batch, retryMs);
+			}
+		};
+	}
+}
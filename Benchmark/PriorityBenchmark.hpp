@@ -0,0 +1,132 @@
+﻿# pragma once
+# include <algorithm>
+# include <chrono>
+# include <thread>
+# include "../HTTPClient.hpp"
+# include "LoopbackHTTPServer.hpp"
+
+//
+// 同時に実行する通信の数の上限（全体とホストごと）を Background の通信で埋めた状態で、Interactive の通信の応答時間を測ります。
+// SetPauseBackgroundWhileInteractive(true) の場合も、Interactive の通信は Background の通信の完了を待たずに終わる必要があります。
+// 終了時に、接続数の上限と一時停止の設定を既定値に戻します。
+//
+
+namespace s3d
+{
+	namespace Benchmark
+	{
+		struct PriorityBenchmarkResult
+		{
+			bool pauseBackground = false;
+
+			size_t interactiveRequests = 0;
+
+			/// <summary>
+			/// 制限時間内に成功しなかった Interactive の通信の数
+			/// </summary>
+			size_t interactiveFailed = 0;
+
+			double p50LatencyMs = 0.0;
+
+			double maxLatencyMs = 0.0;
+
+			size_t backgroundRequests = 0;
+
+			size_t backgroundFailed = 0;
+		};
+
+		/// <summary>
+		/// 上限を Background の通信で埋めたまま、Interactive の Get を 1 つずつ実行します。
+		/// </summary>
+		/// <param name="pauseBackground">
+		/// SetPauseBackgroundWhileInteractive に渡す値
+		/// </param>
+		/// <param name="maxTransfers">
+		/// 全体とホストごとの上限。同じ数の Background の通信を開始します
+		/// </param>
+		inline PriorityBenchmarkResult RunPriorityBenchmark(const bool pauseBackground, const size_t maxTransfers = 4,
+			const size_t interactiveRequests = 16, const FilePath& directory = U"http_benchmark")
+		{
+			PriorityBenchmarkResult result;
+			result.pauseBackground = pauseBackground;
+			result.interactiveRequests = interactiveRequests;
+			result.backgroundRequests = maxTransfers;
+
+			LoopbackHTTPServer server;
+
+			if (!server.start())
+			{
+				return result;
+			}
+
+			FileSystem::CreateDirectories(directory);
+			SimpleHTTP::SetConnectionLimits(maxTransfers, maxTransfers);
+			SimpleHTTP::SetPauseBackgroundWhileInteractive(pauseBackground);
+
+			// 応答までに 2 秒かかるため、計測中に Background の通信は終わらない
+			HTTPRequestOptions background;
+			background.priority = HTTPPriority::Background;
+
+			Array<AsyncHTTPTask> backgroundTasks;
+
+			for (size_t i = 0; i < maxTransfers; ++i)
+			{
+				backgroundTasks.push_back(SimpleHTTP::DownloadFileAsync(server.url((1 << 20), 2000), U"{}/background_{}.bin"_fmt(directory, i), background));
+			}
+
+			// Background の通信が上限を埋めるまで待つ
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			HTTPRequestOptions interactive;
+			interactive.priority = HTTPPriority::Interactive;
+			interactive.timeout = Milliseconds{ 5000 };
+
+			Array<double> latencies;
+
+			for (size_t i = 0; i < interactiveRequests; ++i)
+			{
+				// 同期 API は上限に数えないため、非同期 API で待機中の通信の順番を測る
+				const auto begin = std::chrono::steady_clock::now();
+				AsyncHTTPTask task = SimpleHTTP::GetAsync(server.url(1024), {}, U"{}/interactive.bin"_fmt(directory), interactive);
+
+				while (!task.isDone())
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+
+				latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+
+				if (task.getResponse().getStatusCode() != HTTPResponseStatusCode::OK)
+				{
+					++result.interactiveFailed;
+				}
+			}
+
+			for (auto& task : backgroundTasks)
+			{
+				while (!task.isDone())
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				}
+
+				if (task.currentStatus() != HTTPAsyncStatus::Succeeded)
+				{
+					++result.backgroundFailed;
+				}
+			}
+
+			if (!latencies.isEmpty())
+			{
+				std::sort(latencies.begin(), latencies.end());
+				result.p50LatencyMs = latencies[latencies.size() / 2];
+				result.maxLatencyMs = latencies.back();
+			}
+
+			SimpleHTTP::SetConnectionLimits(64, 8);
+			SimpleHTTP::SetPauseBackgroundWhileInteractive(false);
+			FileSystem::Remove(directory);
+
+			return result;
+		}
+	}
+}
@@ -1,5 +1,6 @@
 ﻿# pragma once
 # define SIV3D_CONCURRENT
+# include <array>
 # include <Siv3D.hpp>
 
 # if SIV3D_BUILD_TYPE(DEBUG)
@@ -18,6 +19,13 @@ namespace s3d
 	class HTTPResponse;
 	struct HTTPProgress;
 	class AsyncHTTPTask;
+	class AsyncHTTPImageTask;
+	class HTTPEventStream;
+
+	namespace detail
+	{
+		class HTTPEngineTransfer;
+	}
 
 	/// <summary>
 	/// ダウンロードの進行状況
@@ -48,6 +56,11 @@ namespace s3d
 		/// ダウンロード完了
 		/// </summary>
 		Succeeded,
+
+		/// <summary>
+		/// 制限時間（HTTPRequestOptions の timeout, connectTimeout, lowSpeedTime）を超えたため中断された
+		/// </summary>
+		TimedOut,
 	};
 
 	/// <summary>
@@ -99,6 +112,7 @@ namespace s3d
 		RangeNotSatisfiable = 416,
 		ExpectationFailed = 417,
 		UpgradeRequied = 426,
+		TooManyRequests = 429, // RFC 6585
 
 		// Server Error 5xx
 		InternalServerError = 500,
@@ -119,199 +133,1338 @@ namespace s3d
 		ServerError = 5
 	};
 
-	namespace SimpleHTTP
+	/// <summary>
+	/// 受信したデータをファイルへ書き込む方式
+	/// </summary>
+	enum class HTTPFileWriteMode
 	{
 		/// <summary>
-		/// HTTPClient を使うアプリケーションで、最初に 1 回だけ呼び出します。([Siv3D ToDo]: エンジン内に組み込み)
+		/// 通信スレッド上で BinaryWriter に直接書き込む
 		/// </summary>
-		bool InitCURL();
+		Direct,
 
 		/// <summary>
-		/// HTTPClient を使うアプリケーションで、最後に 1 回だけ呼び出します。([Siv3D ToDo]: エンジン内に組み込み)
+		/// 大きなバッファにまとめ、バックグラウンドのスレッドで書き込む
+		/// Content-Length が既知の場合はファイルの領域を事前に確保する
 		/// </summary>
-		void CleanupCURL();
+		WriteBehind,
 
 		/// <summary>
-		/// ファイルをダウンロードします。
+		/// Content-Length が既知の場合、ファイルをそのサイズで作成してメモリマップし、受信したデータを直接コピーする
+		/// サイズが不明の場合は Direct と同様に書き込む
 		/// </summary>
-		/// <param name="url">
-		/// URL
-		/// </param>
-		/// <param name="saveFilePath">
-		/// 取得したファイルの保存先のファイルパス
-		/// </param>
-		HTTPResponse DownloadFile(URLView url, FilePathView saveFilePath, bool autoFollowLocation = true);
+		MemoryMapped,
 
-		[[nodiscard]] AsyncHTTPTask DownloadFileAsync(URLView url, FilePathView saveFilePath, bool autoFollowLocation = true);
+		/// <summary>
+		/// [Linux] io_uring で書き込みをまとめて発行する
+		/// io_uring が使えない環境では Direct と同様に書き込む
+		/// </summary>
+		IoUring,
+	};
 
+	/// <summary>
+	/// MemoryMapped で書き込んだデータを、通信完了時にディスクへ書き出す方法
+	/// </summary>
+	enum class HTTPMappedFileFlush
+	{
 		/// <summary>
-		/// HTTP-GETリクエストを送ります
+		/// OS に任せる
 		/// </summary>
-		/// <param name="url">
-		/// URL
-		/// </param>
-		/// <param name="header">
-		/// ヘッダ
-		/// </param>
-		/// <param name="saveFilePath">
-		/// 取得したファイルの保存先のファイルパス
-		/// </param>
-		HTTPResponse Get(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, bool autoFollowLocation = true);
+		None,
 
 		/// <summary>
-		/// HTTP-POSTリクエストを送ります
+		/// 書き出しを開始し、完了は待たない
 		/// </summary>
-		/// <param name="url">
-		/// URL
-		/// </param>
-		/// <param name="header">
-		/// ヘッダ
-		/// </param>
-		/// <param name="src">
-		/// 送信するデータの先頭ポインタ
-		/// </param>
-		/// <param name="size">
-		/// 送信するデータのサイズ（バイト）
-		/// </param>
-		/// <param name="saveFilePath">
-		/// 取得したファイルの保存先のファイルパス
-		/// </param>
-		HTTPResponse Post(URLView url, const HTTPHeader& header, const void* src, size_t size, FilePathView saveFilePath, bool autoFollowLocation = true);
-	
-		inline bool IsStatusCodeTypeOf(HTTPResponseStatusCode code, HTTPResponseStatusType type) {
-			return static_cast<uint32>(code) / 100 == static_cast<uint32>(type);
-		}
+		Async,
+
+		/// <summary>
+		/// 書き出しが完了するまで待つ
+		/// </summary>
+		Sync,
 	};
 
-	class HTTPResponse
+	/// <summary>
+	/// 通信が失敗した理由
+	/// </summary>
+	enum class HTTPError
 	{
-	private:
+		/// <summary>
+		/// エラーなし
+		/// </summary>
+		None,
 
-		String m_header;
+		/// <summary>
+		/// 保存先のファイルを開けなかった
+		/// </summary>
+		FileOpen,
 
-		HTTPResponseStatusCode m_statusCode = HTTPResponseStatusCode::Invalid;
+		/// <summary>
+		/// 通信に失敗した
+		/// </summary>
+		Transfer,
 
-	public:
+		/// <summary>
+		/// 受信したデータをファイルに書き込めなかった
+		/// </summary>
+		FileWrite,
 
-		HTTPResponse() = default;
+		/// <summary>
+		/// 受信したデータのハッシュ値が expectedDigest と一致しなかった
+		/// </summary>
+		DigestMismatch,
+
+		/// <summary>
+		/// 制限時間を超えた
+		/// </summary>
+		TimedOut,
+	};
+
+	/// <summary>
+	/// 受信したデータから計算するハッシュ値の種類
+	/// </summary>
+	enum class HTTPDigestType
+	{
+		None,
 
-		explicit HTTPResponse(const String& header);
+		SHA256,
 
 		/// <summary>
-		/// レスポンスヘッダーのステータスコードが有効であるかを返します。
+		/// xxHash (XXH64, seed = 0)
 		/// </summary>
-		[[nodiscard]] bool isValid() const;
+		XXH64,
+	};
+
+	/// <summary>
+	/// 受信したファイルを保存先に確定させる方法
+	/// </summary>
+	enum class HTTPFileCommitMode
+	{
+		/// <summary>
+		/// 保存先のファイルに直接書き込む
+		/// </summary>
+		Overwrite,
 
 		/// <summary>
-		/// isVaild()
+		/// 同じディレクトリの一時ファイルに書き込み、通信が成功したら保存先にリネームする
+		/// 失敗した場合や中断された場合、保存先のファイルは変更されない
 		/// </summary>
-		[[nodiscard]] explicit operator bool() const;
+		AtomicRename,
+	};
 
+	/// <summary>
+	/// 通信の優先度
+	/// 同時に実行する通信の数の上限に達している場合、優先度の高い通信から開始されます。
+	/// </summary>
+	enum class HTTPPriority
+	{
 		/// <summary>
-		/// レスポンスヘッダーを返します。
+		/// 画面に表示中のものなど、すぐに必要なデータ
 		/// </summary>
-		[[nodiscard]] const String& getHeader() const;
+		Interactive,
+
+		Normal,
 
 		/// <summary>
-		/// ステータスコードを返します。
+		/// 先読みなど、急がないデータ
 		/// </summary>
-		[[nodiscard]] HTTPResponseStatusCode getStatusCode() const;
+		Background,
 	};
 
-	struct HTTPProgress
+	/// <summary>
+	/// 再試行までの待ち時間に加えるゆらぎ
+	/// 多数のクライアントが同時に再試行して、サーバーに負荷が集中するのを防ぎます。
+	/// </summary>
+	enum class HTTPRetryJitter
 	{
-		HTTPProgress() = default;
+		/// <summary>
+		/// ゆらぎを加えない
+		/// </summary>
+		None,
 
-		explicit HTTPProgress(URLView url);
+		/// <summary>
+		/// 0 から待ち時間までの一様乱数だけ待つ
+		/// </summary>
+		Full,
 
 		/// <summary>
-		/// ダウンロードするファイルの合計サイズ。不明の場合 none
+		/// 待ち時間の半分に、0 から待ち時間の半分までの一様乱数を加えた時間だけ待つ
 		/// </summary>
-		Optional<int64> downloadTotalSize;
+		Equal,
+	};
 
+	/// <summary>
+	/// 通信が失敗したときの再試行の方法
+	/// 再試行は HTTPEngine のタイマーで予約され、待っている間スレッドを使いません。
+	/// </summary>
+	struct HTTPRetryPolicy
+	{
 		/// <summary>
-		/// アップロードするファイルの合計サイズ。不明の場合 none
+		/// 最初の通信を含む最大の試行回数。1 の場合は再試行しない
 		/// </summary>
-		Optional<int64> uploadTotalSize;
+		uint32 maxAttempts = 1;
 
 		/// <summary>
-		/// ダウンロードしたファイルのサイズ。
+		/// 1 回目の再試行までの待ち時間
 		/// </summary>
-		int64 downloadNowSize = 0;
+		Milliseconds initialBackoff = Milliseconds{ 200 };
 
 		/// <summary>
-		/// アップロードしたファイルのサイズ。
+		/// 再試行のたびに待ち時間を何倍にするか
 		/// </summary>
-		int64 uploadNowSize = 0;
+		double backoffMultiplier = 2.0;
 
 		/// <summary>
-		/// ダウンロードの進行状況の割合。不明の場合 none
+		/// 待ち時間の上限
 		/// </summary>
-		[[nodiscard]] Optional<double> getDownloadProgress() const;
+		Milliseconds maxBackoff = Milliseconds{ 30'000 };
+
+		HTTPRetryJitter jitter = HTTPRetryJitter::Full;
 
 		/// <summary>
-		/// アップロードの進行状況の割合。不明の場合 none
+		/// レスポンスの Retry-After ヘッダーが待ち時間より長い場合、その時間だけ待つか
+		/// Retry-After が maxBackoff より長い場合は再試行せず、そのレスポンス（429 や 503）を返す
 		/// </summary>
-		[[nodiscard]] Optional<double> getUploadProgress() const;
+		bool honorRetryAfter = true;
 
 		/// <summary>
-		/// 通信先のURL
+		/// 名前解決や接続の失敗、切断など、libcurl のエラーで失敗した場合に再試行するか
 		/// </summary>
-		URL url;
+		bool retryOnTransferError = true;
 
-		HTTPAsyncStatus status = HTTPAsyncStatus::None;
+		/// <summary>
+		/// 接続や低速の制限時間（connectTimeout, lowSpeedTime）を超えた場合に再試行するか
+		/// timeout を超えた場合は再試行しない
+		/// </summary>
+		bool retryOnTimeout = true;
 
 		/// <summary>
-		/// 通信中にtrueにすると通信をキャンセルします
+		/// 再試行するステータスコード
 		/// </summary>
-		bool cancelCommunication = false;
+		Array<HTTPResponseStatusCode> retryableStatusCodes = { HTTPResponseStatusCode::TooManyRequests, HTTPResponseStatusCode::ServiceUnavailable };
 	};
 
-	class AsyncHTTPTask
+	/// <summary>
+	/// GET のヘッジの方法
+	/// 最初のバイトが一定時間届かない場合に同じ通信をもう 1 つ開始し、先に応答した方を使って、もう一方をキャンセルします。
+	/// 冪等で小さな GET のテールレイテンシを減らすためのもので、ヘッジした通信の本文は完了までメモリに保持されます。
+	/// </summary>
+	struct HTTPHedgePolicy
 	{
-	private:
+		/// <summary>
+		/// ヘッジするか。POST はヘッジしない
+		/// </summary>
+		bool enabled = false;
+
+		/// <summary>
+		/// ホストの TTFB のこのパーセンタイルを超えても応答が無い場合にヘッジする（0.0 ～ 1.0）
+		/// </summary>
+		double percentile = 0.95;
 
-		friend AsyncHTTPTask SimpleHTTP::DownloadFileAsync(URLView url, FilePathView saveFilePath, bool autoFollowLocation);
+		/// <summary>
+		/// ホストの TTFB の記録が minSamples 個未満の場合に使う待ち時間
+		/// </summary>
+		Milliseconds fallbackDelay = Milliseconds{ 100 };
 
-		class AsyncHTTPTaskImpl;
+		/// <summary>
+		/// パーセンタイルから求めた待ち時間の下限
+		/// </summary>
+		Milliseconds minDelay = Milliseconds{ 5 };
 
-		std::shared_ptr<AsyncHTTPTaskImpl> pImpl;
+		uint32 minSamples = 20;
+
+		/// <summary>
+		/// ヘッジした通信の数の、ヘッジ可能な通信の数に対する割合の上限
+		/// </summary>
+		double maxHedgeRatio = 0.05;
+
+		/// <summary>
+		/// ヘッジした通信の送信先。空の場合は同じ URL に別の接続で送る
+		/// </summary>
+		Array<URL> mirrors;
+	};
+
+	/// <summary>
+	/// 同じファイルを配信する複数の URL（ミラー）からダウンロードする方法
+	/// ミラーはホストごとの受信の速度と失敗の割合の指数移動平均から選び、失敗した場合や遅い場合は、
+	/// 受信済みの位置から Range で別のミラーに切り替えます。
+	/// </summary>
+	struct HTTPMirrorPolicy
+	{
+		/// <summary>
+		/// 受信の速度が slowTime の間これを下回った場合、別のミラーに切り替える（バイト/秒）。0 の場合は切り替えない
+		/// </summary>
+		int64 minBytesPerSec = 0;
+
+		Milliseconds slowTime = Milliseconds{ 3000 };
+
+		/// <summary>
+		/// ファイルを区間に分けて、異なるミラーから同時に受信する区間の最大数
+		/// サーバーが Range に対応していない場合や、digest を計算する場合、
+		/// 保存先に順番にしか書き込めない場合（HTTPFileWriteMode::WriteBehind と IoUring）は 1 つの区間で受信する
+		/// </summary>
+		size_t parallelSegments = 1;
 
-		explicit AsyncHTTPTask(URLView url, FilePathView path, bool autoFollowLocation = true);
+		/// <summary>
+		/// 区間の最小サイズ（バイト）
+		/// </summary>
+		int64 minSegmentSize = (int64{ 1 } << 20);
+	};
+
+	/// <summary>
+	/// 複数の通信をまとめてキャンセルするためのトークン
+	/// コピーしたトークンは同じ状態を共有し、どのスレッドからでも cancel() を呼べます。
+	/// </summary>
+	class HTTPCancellationToken
+	{
+	private:
+
+		std::shared_ptr<std::atomic<bool>> m_canceled;
 
 	public:
 
-		AsyncHTTPTask();
+		HTTPCancellationToken();
 
-		~AsyncHTTPTask();
+		/// <summary>
+		/// このトークンを設定した通信をすべてキャンセルします。
+		/// HTTPEngine をすぐに起こすため、実行中の通信は進行状況の通知を待たずに中断され、接続も解放されます。
+		/// 以降にこのトークンを設定して開始した通信も、すぐにキャンセルされます。
+		/// </summary>
+		void cancel() const;
+
+		[[nodiscard]] bool isCanceled() const noexcept;
+	};
+
+	/// <summary>
+	/// 通信が終わった後の処理（co_await の再開など）を実行するスレッド
+	/// </summary>
+	enum class HTTPExecutor
+	{
+		/// <summary>
+		/// 通信を終わらせたスレッドで、すぐに実行する。時間のかかる処理は他の通信の完了を遅らせる
+		/// 通常は後処理のスレッドだが、終了処理中に開始された通信は開始したスレッドになる
+		/// then() で前の処理がある場合や、既に終わった通信に登録した場合は、そのスレッドで実行する
+		/// SimpleHTTP::Get() などの同期 API も使えるが、終わるまで他の通信の後処理が止まる
+		/// </summary>
+		IOThread,
 
 		/// <summary>
-		/// 通信の進行状況クラスを返します
+		/// HTTPClient のワーカースレッドで実行する
 		/// </summary>
-		[[nodiscard]] const HTTPProgress& getProgress() const;
+		ThreadPool,
 
 		/// <summary>
-		/// Tips: isDoneを実行しないと無効なレスポンスしか返ってきません
+		/// 次の System::Update() でメインスレッドで実行する
 		/// </summary>
-		[[nodiscard]] const HTTPResponse& getResponse() const;
+		MainThread,
+	};
 
+	/// <summary>
+	/// SimpleHTTP::GetJSONStreamAsync() で受信する JSON の形式
+	/// </summary>
+	enum class HTTPJSONStreamFormat
+	{
 		/// <summary>
-		/// 現在のステータスを返します
+		/// 最上位の配列の要素を 1 つずつ解析する
 		/// </summary>
-		[[nodiscard]] const HTTPAsyncStatus& currentStatus() const;
+		Array,
 
 		/// <summary>
-		/// 実行中の通信をキャンセルします
+		/// 改行で区切られた JSON（NDJSON）を 1 行ずつ解析する
 		/// </summary>
-		void cancelTask();
+		NDJSON,
+	};
 
+	/// <summary>
+	/// SimpleHTTP::OpenEventStream() で受信するストリームの形式
+	/// </summary>
+	enum class HTTPEventStreamFormat
+	{
 		/// <summary>
-		/// 通信が完了したかを返します
-		/// 1回の通信で1度しかtrueを返しません
+		/// Server-Sent Events（text/event-stream）。空行で区切られたイベントの data: などのフィールドを解析する
 		/// </summary>
-		[[nodiscard]] bool isDone();
+		ServerSentEvents,
+
+		/// <summary>
+		/// 1 行を 1 つのイベントの data とする（chunked で送られるログなど）
+		/// </summary>
+		Lines,
+	};
+
+	/// <summary>
+	/// HTTPEventStream で受信したイベント
+	/// </summary>
+	struct HTTPEvent
+	{
+		/// <summary>
+		/// event: フィールドの値。省略された場合は U"message"
+		/// </summary>
+		String type;
+
+		/// <summary>
+		/// data: フィールドの値。複数行の場合は改行でつなげる
+		/// </summary>
+		String data;
+
+		/// <summary>
+		/// 最後に受信した id: フィールドの値
+		/// </summary>
+		String id;
 	};
 
+	struct HTTPRequestOptions
+	{
+		/// <summary>
+		/// リダイレクトに自動で従うか
+		/// </summary>
+		bool autoFollowLocation = true;
+
+		/// <summary>
+		/// 受信したデータをファイルへ書き込む方式
+		/// </summary>
+		HTTPFileWriteMode writeMode = HTTPFileWriteMode::Direct;
+
+		/// <summary>
+		/// WriteBehind, IoUring で使うバッファ 1 個あたりのサイズ（バイト）
+		/// </summary>
+		size_t writeBufferSize = (1 << 20);
+
+		/// <summary>
+		/// WriteBehind, IoUring で書き込み待ちにできるバッファの最大数
+		/// </summary>
+		size_t writeQueueLength = 4;
+
+		/// <summary>
+		/// MemoryMapped で通信完了時にディスクへ書き出す方法
+		/// </summary>
+		HTTPMappedFileFlush mappedFileFlush = HTTPMappedFileFlush::Async;
+
+		/// <summary>
+		/// 受信したファイルを保存先に確定させる方法
+		/// </summary>
+		HTTPFileCommitMode commitMode = HTTPFileCommitMode::Overwrite;
+
+		/// <summary>
+		/// AtomicRename で、リネームの前後にファイルとディレクトリをディスクに書き出すか
+		/// false にした場合は、後で SimpleHTTP::SyncFiles() でまとめて書き出せる
+		/// </summary>
+		bool syncOnCommit = true;
+
+		/// <summary>
+		/// 受信しながら計算するハッシュ値の種類。HTTPResponse::getDigest() で取得できる
+		/// </summary>
+		HTTPDigestType digest = HTTPDigestType::None;
+
+		/// <summary>
+		/// 期待するハッシュ値（16 進数）。空でない場合、一致しなければ通信は失敗となり、ファイルは確定されない
+		/// </summary>
+		String expectedDigest;
+
+		/// <summary>
+		/// 通信の優先度。HTTP/2 では、ストリームの重みとしてサーバーにも伝えられる
+		/// </summary>
+		HTTPPriority priority = HTTPPriority::Normal;
+
+		/// <summary>
+		/// この通信の受信の帯域の上限（バイト/秒）。0 の場合は無制限
+		/// </summary>
+		int64 maxRecvBytesPerSec = 0;
+
+		/// <summary>
+		/// この通信の送信の帯域の上限（バイト/秒）。0 の場合は無制限
+		/// </summary>
+		int64 maxSendBytesPerSec = 0;
+
+		/// <summary>
+		/// 通信を要求してから完了するまでの制限時間（開始を待っている時間を含む）。0 の場合は無制限
+		/// </summary>
+		Milliseconds timeout = Milliseconds{ 0 };
+
+		/// <summary>
+		/// 接続を確立するまでの制限時間。0 の場合は libcurl の既定値（300 秒）
+		/// </summary>
+		Milliseconds connectTimeout = Milliseconds{ 0 };
+
+		/// <summary>
+		/// 受信の速度が lowSpeedTime の間 lowSpeedBytesPerSec を下回り続けた場合に、通信を中断する。0 の場合は無効
+		/// </summary>
+		int64 lowSpeedBytesPerSec = 0;
+
+		Seconds lowSpeedTime = Seconds{ 0 };
+
+		/// <summary>
+		/// 空でない場合、URL のホストに TCP で接続する代わりに、この Unix ドメインソケットに接続する（URL のホストは Host ヘッダーに使われる）
+		/// 同じマシンのサイドカーとの通信で、ループバックの TCP のオーバーヘッドを省けます。
+		/// 同時に実行する通信の数や帯域の上限は、"unix:<パス>" を 1 つのホストとして扱います。
+		/// libcurl が Unix ドメインソケットに対応していない場合（同梱の Windows 版 libcurl 7.65.1 など）、通信は HTTPError::Transfer で失敗します。
+		/// </summary>
+		FilePath unixSocketPath;
+
+		/// <summary>
+		/// 通信が失敗したときの再試行の方法
+		/// </summary>
+		HTTPRetryPolicy retry;
+
+		/// <summary>
+		/// 最初のバイトが遅い GET をヘッジする方法
+		/// </summary>
+		HTTPHedgePolicy hedge;
+
+		/// <summary>
+		/// ミラーの URL を指定してダウンロードする場合の、ミラーの選び方
+		/// </summary>
+		HTTPMirrorPolicy mirror;
+
+		/// <summary>
+		/// 設定した場合、トークンの cancel() でこの通信をキャンセルします。
+		/// </summary>
+		Optional<HTTPCancellationToken> cancellation;
+	};
+
+	/// <summary>
+	/// ホストごとの同時に実行する通信の数の上限を、TTFB とエラーから自動で調整する方法（Gradient2 方式）
+	/// 直近の TTFB が長期の平均より伸びると上限を下げ、伸びていなければ少しずつ上げます。
+	/// 429, 503 やタイムアウト、接続の失敗では、上限を backoffRatio 倍にします。
+	/// 調整した上限は HTTPMetricsSnapshot::concurrencyLimit で取得できます。
+	/// </summary>
+	struct HTTPAdaptiveConcurrency
+	{
+		bool enabled = false;
+
+		/// <summary>
+		/// 調整を始めるときの上限
+		/// </summary>
+		size_t initialLimit = 4;
+
+		/// <summary>
+		/// 上限の下限。上限の上限は SimpleHTTP::SetConnectionLimits() の maxTransfersPerHost
+		/// </summary>
+		size_t minLimit = 1;
+
+		/// <summary>
+		/// 直近の TTFB が長期の平均のこの倍数を超えるまでは、上限を下げない
+		/// </summary>
+		double tolerance = 1.5;
+
+		/// <summary>
+		/// 1 回の調整で新しい値に近づける割合（0.0 ～ 1.0）
+		/// </summary>
+		double smoothing = 0.2;
+
+		/// <summary>
+		/// 失敗したときに上限に掛ける値
+		/// </summary>
+		double backoffRatio = 0.9;
+	};
+
+	/// <summary>
+	/// multipart/form-data で送信するフォーム
+	/// 本文全体をメモリに作らず、送信しながら各項目のデータを読み込みます。
+	/// </summary>
+	class HTTPForm
+	{
+	public:
+
+		struct Part
+		{
+			String name;
+
+			/// <summary>
+			/// Content-Disposition の filename。空の場合は付けない
+			/// </summary>
+			String fileName;
+
+			/// <summary>
+			/// Content-Type。空の場合は fileName の拡張子から決まる
+			/// </summary>
+			String contentType;
+
+			/// <summary>
+			/// 送信するデータ。path も reader も空の場合に使う
+			/// </summary>
+			std::shared_ptr<const Array<uint8>> data;
+
+			/// <summary>
+			/// 空でない場合、送信するたびにこのファイルを開いて読み込む
+			/// </summary>
+			FilePath path;
+
+			/// <summary>
+			/// 設定した場合、送信するたびに先頭に戻して読み込む
+			/// </summary>
+			std::shared_ptr<IReader> reader;
+		};
+
+		/// <summary>
+		/// 文字列の項目を追加します
+		/// </summary>
+		HTTPForm& addText(StringView name, StringView value);
+
+		/// <summary>
+		/// メモリのデータの項目を追加します
+		/// </summary>
+		HTTPForm& addData(StringView name, Array<uint8> data, StringView fileName = U"", StringView contentType = U"");
+
+		/// <summary>
+		/// ファイルの項目を追加します。ファイルは送信しながら少しずつ読み込みます
+		/// </summary>
+		/// <param name="fileName">
+		/// 送信するファイル名。空の場合は path のファイル名
+		/// </param>
+		HTTPForm& addFile(StringView name, FilePathView path, StringView fileName = U"", StringView contentType = U"");
+
+		/// <summary>
+		/// IReader から読み込む項目を追加します。通信が終わるまで、reader を他の用途に使ってはいけません
+		/// </summary>
+		HTTPForm& addReader(StringView name, const std::shared_ptr<IReader>& reader, StringView fileName = U"", StringView contentType = U"");
+
+		[[nodiscard]] const Array<Part>& parts() const noexcept;
+
+		[[nodiscard]] bool isEmpty() const noexcept;
+
+	private:
+
+		Array<Part> m_parts;
+	};
+
+	namespace SimpleHTTP
+	{
+		/// <summary>
+		/// HTTPClient を使うアプリケーションで、最初に 1 回だけ呼び出します。([Siv3D ToDo]: エンジン内に組み込み)
+		/// </summary>
+		bool InitCURL();
+
+		/// <summary>
+		/// HTTPClient を使うアプリケーションで、最後に 1 回だけ呼び出します。([Siv3D ToDo]: エンジン内に組み込み)
+		/// </summary>
+		void CleanupCURL();
+
+		/// <summary>
+		/// 同時に実行する通信の数の上限を設定します。
+		/// 上限を超えた通信は待機し、待機中の通信があるホストから順番に 1 つずつ開始されるため、
+		/// 1 つのホストへの大量の通信が、他のホストへの通信を待たせることはありません。
+		/// Get() などの同期 API の通信と OpenEventStream() の接続は、上限に数えず、すぐに開始されます。
+		/// </summary>
+		/// <param name="maxTransfers">
+		/// 全体の上限（既定値は 64）
+		/// </param>
+		/// <param name="maxTransfersPerHost">
+		/// ホスト（"example.com:8080" の形式）ごとの上限（既定値は 8）
+		/// </param>
+		void SetConnectionLimits(size_t maxTransfers, size_t maxTransfersPerHost);
+
+		/// <summary>
+		/// HTTPPriority::Interactive の通信が待機中または実行中の間、
+		/// HTTPPriority::Background の通信を開始せず、実行中のものも一時停止するかを設定します。
+		/// 一時停止した通信は SetConnectionLimits の上限に数えないため、上限が埋まっていても Interactive の通信を開始できます。
+		/// </summary>
+		/// <param name="enabled">
+		/// 一時停止する場合 true（既定値は false）
+		/// </param>
+		void SetPauseBackgroundWhileInteractive(bool enabled);
+
+		/// <summary>
+		/// すべての通信の合計の帯域の上限（バイト/秒、0 で無制限）を設定します。通信中でも反映されます。
+		/// 上限を超えた通信は、帯域に空きができるまで一時停止されます。
+		/// </summary>
+		void SetBandwidthLimit(int64 maxRecvBytesPerSec, int64 maxSendBytesPerSec);
+
+		/// <summary>
+		/// ホスト（"example.com:8080" の形式）への通信の合計の帯域の上限（バイト/秒、0 で無制限）を設定します。通信中でも反映されます。
+		/// </summary>
+		void SetHostBandwidthLimit(StringView host, int64 maxRecvBytesPerSec, int64 maxSendBytesPerSec);
+
+		/// <summary>
+		/// ホストごとの同時に実行する通信の数の上限を、自動で調整するかを設定します。
+		/// 設定を変更すると、調整した上限は initialLimit に戻ります。
+		/// </summary>
+		void SetAdaptiveConcurrency(const HTTPAdaptiveConcurrency& settings);
+
+		/// <summary>
+		/// HTTPExecutor::MainThread で実行する処理を、すべて実行します。
+		/// InitCURL() がアドオンを登録するため、System::Update() のたびに自動で呼ばれます。
+		/// </summary>
+		void RunMainThreadContinuations();
+
+		/// <summary>
+		/// ファイルをダウンロードします。
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		HTTPResponse DownloadFile(URLView url, FilePathView saveFilePath, bool autoFollowLocation = true);
+
+		/// <summary>
+		/// ファイルをダウンロードします。
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		/// <param name="options">
+		/// 通信のオプション
+		/// </param>
+		HTTPResponse DownloadFile(URLView url, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		[[nodiscard]] AsyncHTTPTask DownloadFileAsync(URLView url, FilePathView saveFilePath, bool autoFollowLocation = true);
+
+		[[nodiscard]] AsyncHTTPTask DownloadFileAsync(URLView url, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		/// <summary>
+		/// 同じファイルを配信する複数の URL（ミラー）のうち、速いものを選んでファイルをダウンロードします。
+		/// ミラーが失敗した場合は、受信済みの位置から別のミラーで続けます。すべてのミラーが失敗した場合は HTTPError::Transfer になります。
+		/// </summary>
+		/// <param name="urls">
+		/// 同じファイルを配信する URL
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		/// <param name="options">
+		/// 通信のオプション。ミラーの選び方は options.mirror
+		/// </param>
+		HTTPResponse DownloadFile(const Array<URL>& urls, FilePathView saveFilePath, const HTTPRequestOptions& options = {});
+
+		[[nodiscard]] AsyncHTTPTask DownloadFileAsync(const Array<URL>& urls, FilePathView saveFilePath, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// HTTP-GETリクエストを送ります
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="header">
+		/// ヘッダ
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		HTTPResponse Get(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, bool autoFollowLocation = true);
+
+		HTTPResponse Get(URLView url, const HTTPHeader& header, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		/// <summary>
+		/// HTTP-GETリクエストを非同期で送ります
+		/// HTTPCoroutine.hpp をインクルードすると、戻り値を co_await できます。
+		/// </summary>
+		[[nodiscard]] AsyncHTTPTask GetAsync(URLView url, const HTTPHeader& header, FilePathView saveFilePath, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// HTTP-GETリクエストを非同期で送り、受信した JSON をダウンロードと並行して要素ごとに解析します。
+		/// ファイルには保存せず、解析中の要素 1 つ分のデータだけを保持します。
+		/// ステータスコードが 2xx でない場合は解析しません。JSON の形式が正しくない場合は HTTPError::FileWrite で失敗します。
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="header">
+		/// ヘッダ
+		/// </param>
+		/// <param name="format">
+		/// 受信する JSON の形式
+		/// </param>
+		/// <param name="onElement">
+		/// 解析した要素を受け取る関数。通信スレッドで、受信した順に呼ばれます。
+		/// 実行している間は他のすべての通信が止まるため、時間のかかる処理は別のスレッドに任せてください。
+		/// この関数から Get() などの同期 API を呼ぶと、通信スレッドが自身を待ってデッドロックします。
+		/// 再試行した場合も、既に渡した要素をもう一度渡すことはありません。ヘッジはしません
+		/// </param>
+		/// <param name="options">
+		/// 通信のオプション
+		/// </param>
+		[[nodiscard]] AsyncHTTPTask GetJSONStreamAsync(URLView url, const HTTPHeader& header, HTTPJSONStreamFormat format, std::function<void(const JSONValue&)> onElement, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// HTTP-POSTリクエストを送ります
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="header">
+		/// ヘッダ
+		/// </param>
+		/// <param name="src">
+		/// 送信するデータの先頭ポインタ
+		/// </param>
+		/// <param name="size">
+		/// 送信するデータのサイズ（バイト）
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		HTTPResponse Post(URLView url, const HTTPHeader& header, const void* src, size_t size, FilePathView saveFilePath, bool autoFollowLocation = true);
+
+		HTTPResponse Post(URLView url, const HTTPHeader& header, const void* src, size_t size, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		/// <summary>
+		/// フォームを multipart/form-data で HTTP-POST します
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="header">
+		/// ヘッダ。Content-Type は自動で設定されます
+		/// </param>
+		/// <param name="form">
+		/// 送信するフォーム
+		/// </param>
+		/// <param name="saveFilePath">
+		/// 取得したファイルの保存先のファイルパス
+		/// </param>
+		HTTPResponse PostForm(URLView url, const HTTPHeader& header, const HTTPForm& form, FilePathView saveFilePath, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// フォームを multipart/form-data で非同期に HTTP-POST します。
+		/// 送信済みのバイト数は HTTPProgress::uploadNowSize で取得できます。
+		/// </summary>
+		[[nodiscard]] AsyncHTTPTask PostFormAsync(URLView url, const HTTPHeader& header, const HTTPForm& form, FilePathView saveFilePath, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// 画像をメモリにダウンロードし、ワーカースレッドで Image にデコードします。
+		/// メインスレッドでは、完了後に Texture を作るだけで済みます。
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="options">
+		/// 通信のオプション
+		/// </param>
+		/// <param name="cacheFilePath">
+		/// 空でない場合、ダウンロードした画像をこのファイルにも保存し、次からはダウンロードせずにこのファイルから読み込みます。
+		/// このファイルを画像として読み込めない場合は、削除してダウンロードし直します。
+		/// </param>
+		[[nodiscard]] AsyncHTTPImageTask LoadImageAsync(URLView url, const HTTPRequestOptions& options = {}, FilePathView cacheFilePath = U"");
+
+		/// <summary>
+		/// 長く続くレスポンスを受信しながらイベントに分け、HTTPEventStream のキューに追加します。
+		/// 接続が切れた場合やサーバーがレスポンスを終えた場合は、待ち時間（既定値は 3 秒、retry: フィールドで変更される）の後に、
+		/// 最後に受信したイベントの ID を Last-Event-ID ヘッダーで送って再接続します。ステータスコードが 2xx でない場合は再接続しません。
+		/// 接続は SetConnectionLimits() の上限に数えず、待機せずに開始します。開いたままのストリームが他の通信を待たせることはありません。
+		/// </summary>
+		/// <param name="url">
+		/// URL
+		/// </param>
+		/// <param name="header">
+		/// ヘッダ
+		/// </param>
+		/// <param name="format">
+		/// ストリームの形式
+		/// </param>
+		/// <param name="options">
+		/// 通信のオプション。レスポンスは終わらないため timeout は 0 にしてください。ヘッジはしません
+		/// </param>
+		[[nodiscard]] HTTPEventStream OpenEventStream(URLView url, const HTTPHeader& header = {}, HTTPEventStreamFormat format = HTTPEventStreamFormat::ServerSentEvents, const HTTPRequestOptions& options = {});
+
+		/// <summary>
+		/// syncOnCommit = false でダウンロードしたファイルを、まとめてディスクに書き出します。
+		/// </summary>
+		/// <param name="paths">
+		/// ファイルパスの一覧
+		/// </param>
+		bool SyncFiles(const Array<FilePath>& paths);
+
+		inline bool IsStatusCodeTypeOf(HTTPResponseStatusCode code, HTTPResponseStatusType type) {
+			return static_cast<uint32>(code) / 100 == static_cast<uint32>(type);
+		}
+	};
+
+	class HTTPResponse
+	{
+	private:
+
+		String m_header;
+
+		HTTPResponseStatusCode m_statusCode = HTTPResponseStatusCode::Invalid;
+
+		HTTPError m_error = HTTPError::None;
+
+		String m_digest;
+
+	public:
+
+		HTTPResponse() = default;
+
+		explicit HTTPResponse(const String& header, const String& digest = String());
+
+		/// <summary>
+		/// 失敗した通信のレスポンスを作成します。
+		/// </summary>
+		explicit HTTPResponse(HTTPError error);
+
+		/// <summary>
+		/// レスポンスヘッダーのステータスコードが有効であるかを返します。
+		/// </summary>
+		[[nodiscard]] bool isValid() const;
+
+		/// <summary>
+		/// isVaild()
+		/// </summary>
+		[[nodiscard]] explicit operator bool() const;
+
+		/// <summary>
+		/// レスポンスヘッダーを返します。
+		/// </summary>
+		[[nodiscard]] const String& getHeader() const;
+
+		/// <summary>
+		/// ステータスコードを返します。
+		/// </summary>
+		[[nodiscard]] HTTPResponseStatusCode getStatusCode() const;
+
+		/// <summary>
+		/// 通信が失敗した理由を返します。
+		/// </summary>
+		[[nodiscard]] HTTPError getError() const;
+
+		/// <summary>
+		/// 受信したデータのハッシュ値（小文字の 16 進数）を返します。計算していない場合は空の文字列です。
+		/// </summary>
+		[[nodiscard]] const String& getDigest() const;
+	};
+
+	struct HTTPProgress
+	{
+		HTTPProgress() = default;
+
+		explicit HTTPProgress(URLView url);
+
+		/// <summary>
+		/// ダウンロードするファイルの合計サイズ。不明の場合 none
+		/// </summary>
+		Optional<int64> downloadTotalSize;
+
+		/// <summary>
+		/// アップロードするファイルの合計サイズ。不明の場合 none
+		/// </summary>
+		Optional<int64> uploadTotalSize;
+
+		/// <summary>
+		/// ダウンロードしたファイルのサイズ。
+		/// </summary>
+		int64 downloadNowSize = 0;
+
+		/// <summary>
+		/// アップロードしたファイルのサイズ。
+		/// </summary>
+		int64 uploadNowSize = 0;
+
+		/// <summary>
+		/// ダウンロードの進行状況の割合。不明の場合 none
+		/// </summary>
+		[[nodiscard]] Optional<double> getDownloadProgress() const;
+
+		/// <summary>
+		/// アップロードの進行状況の割合。不明の場合 none
+		/// </summary>
+		[[nodiscard]] Optional<double> getUploadProgress() const;
+
+		/// <summary>
+		/// 通信先のURL
+		/// </summary>
+		URL url;
+
+		HTTPAsyncStatus status = HTTPAsyncStatus::None;
+
+		/// <summary>
+		/// 使われていません。通信をキャンセルするには AsyncHTTPTask::cancelTask() か HTTPCancellationToken を使ってください。
+		/// </summary>
+		bool cancelCommunication = false;
+	};
+
+	class AsyncHTTPTask
+	{
+	private:
+
+		friend AsyncHTTPTask SimpleHTTP::DownloadFileAsync(URLView url, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		friend AsyncHTTPTask SimpleHTTP::DownloadFileAsync(const Array<URL>& urls, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		friend AsyncHTTPTask SimpleHTTP::GetAsync(URLView url, const HTTPHeader& header, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		friend AsyncHTTPTask SimpleHTTP::PostFormAsync(URLView url, const HTTPHeader& header, const HTTPForm& form, FilePathView saveFilePath, const HTTPRequestOptions& options);
+
+		friend AsyncHTTPTask SimpleHTTP::GetJSONStreamAsync(URLView url, const HTTPHeader& header, HTTPJSONStreamFormat format, std::function<void(const JSONValue&)> onElement, const HTTPRequestOptions& options);
+
+		friend class HTTPAwaiter;
+
+		friend class AsyncHTTPImageTask;
+
+		friend AsyncHTTPImageTask SimpleHTTP::LoadImageAsync(URLView url, const HTTPRequestOptions& options, FilePathView cacheFilePath);
+
+		class AsyncHTTPTaskImpl;
+
+		std::shared_ptr<AsyncHTTPTaskImpl> pImpl;
+
+		explicit AsyncHTTPTask(const std::shared_ptr<detail::HTTPEngineTransfer>& transfer);
+
+		AsyncHTTPTask(URLView url, const HTTPHeader& header, FilePathView path, const HTTPRequestOptions& options);
+
+		AsyncHTTPTask(const Array<URL>& urls, FilePathView path, const HTTPRequestOptions& options);
+
+		/// <summary>
+		/// 通信が終わったときに、resumeOn() で設定したスレッドで callback(context) を 1 度だけ呼ぶように登録します。メモリを確保しません。
+		/// 既に終わっている場合は登録せずに false を返します。
+		/// </summary>
+		bool setContinuation(void (*callback)(void*), void* context);
+
+		/// <summary>
+		/// 通信が終わったかを、完了を書き込んだスレッドと同期して返します。isDone() と異なり、何度呼んでも同じ結果を返します。
+		/// 通信が無い場合は true を返します。
+		/// </summary>
+		[[nodiscard]] bool isFinished() const;
+
+		/// <summary>
+		/// isFinished() が true を返した後に、通信のレスポンスを返します。
+		/// </summary>
+		[[nodiscard]] const HTTPResponse& getFinishedResponse() const;
+
+	public:
+
+		AsyncHTTPTask();
+
+		~AsyncHTTPTask();
+
+		/// <summary>
+		/// 通信の進行状況クラスを返します
+		/// 呼び出したときの値のコピーで、次に getProgress() か currentStatus() を呼ぶまで変わりません
+		/// </summary>
+		[[nodiscard]] const HTTPProgress& getProgress() const;
+
+		/// <summary>
+		/// Tips: isDoneを実行しないと無効なレスポンスしか返ってきません
+		/// </summary>
+		[[nodiscard]] const HTTPResponse& getResponse() const;
+
+		/// <summary>
+		/// 現在のステータスを返します
+		/// </summary>
+		[[nodiscard]] const HTTPAsyncStatus& currentStatus() const;
+
+		/// <summary>
+		/// 実行中の通信をキャンセルします
+		/// </summary>
+		void cancelTask();
+
+		/// <summary>
+		/// この通信の帯域の上限（バイト/秒、0 で無制限）を変更します。通信中でも反映されます。
+		/// </summary>
+		void setBandwidthLimit(int64 maxRecvBytesPerSec, int64 maxSendBytesPerSec);
+
+		/// <summary>
+		/// co_await したときに再開するスレッドを設定します（既定値は HTTPExecutor::MainThread）。
+		/// </summary>
+		AsyncHTTPTask& resumeOn(HTTPExecutor executor);
+
+		/// <summary>
+		/// 通信が終わった後に、executor で callback(response) を実行するように登録します。
+		/// then() を続けて呼ぶと、前の処理が終わってから次の処理を実行するため、
+		/// ワーカースレッドでデコードしてから、メインスレッドでテクスチャを作る、のように処理をつなげられます。
+		/// 既に終わっている場合もすぐに実行します。isDone() や getResponse() には影響しません。
+		/// then() で処理を登録した場合は、AsyncHTTPTask を破棄しても通信を続けます。
+		/// </summary>
+		/// <param name="callback">
+		/// 通信の結果を受け取る関数。例外を投げてはいけません
+		/// </param>
+		/// <param name="executor">
+		/// callback を実行するスレッド
+		/// </param>
+		AsyncHTTPTask& then(std::function<void(const HTTPResponse&)> callback, HTTPExecutor executor = HTTPExecutor::MainThread);
+
+		/// <summary>
+		/// 通信が完了したかを返します
+		/// 1回の通信で1度しかtrueを返しません
+		/// </summary>
+		[[nodiscard]] bool isDone();
+	};
+
+	/// <summary>
+	/// SimpleHTTP::LoadImageAsync() で、画像のダウンロードとデコードを行うタスク
+	/// </summary>
+	class AsyncHTTPImageTask
+	{
+	private:
+
+		friend AsyncHTTPImageTask SimpleHTTP::LoadImageAsync(URLView url, const HTTPRequestOptions& options, FilePathView cacheFilePath);
+
+		struct State;
+
+		std::shared_ptr<State> m_state;
+
+		static void LoadCachedImage(void* context);
+
+		static void StartDownload(const std::shared_ptr<State>& state);
+
+	public:
+
+		AsyncHTTPImageTask();
+
+		/// <summary>
+		/// 通信の進行状況を返します。キャッシュから読み込む場合は、読み込めずにダウンロードし直すまで HTTPAsyncStatus::None のままです
+		/// </summary>
+		[[nodiscard]] const HTTPProgress& getProgress() const;
+
+		/// <summary>
+		/// デコードまで終わった場合は Succeeded、通信かデコードに失敗した場合は Failed などを返します
+		/// </summary>
+		[[nodiscard]] HTTPAsyncStatus currentStatus() const;
+
+		/// <summary>
+		/// デコードまで終わったか（失敗した場合も含む）を返します
+		/// </summary>
+		[[nodiscard]] bool isReady() const;
+
+		/// <summary>
+		/// isReady() が true を返した後は、通信のレスポンスを返します。キャッシュから読み込んだ場合は無効なレスポンスです
+		/// </summary>
+		[[nodiscard]] const HTTPResponse& getResponse() const;
+
+		/// <summary>
+		/// isReady() が true を返した後は、デコードした画像をムーブして返します。失敗した場合は空の画像です
+		/// </summary>
+		[[nodiscard]] Image getImage();
+
+		/// <summary>
+		/// 実行中の通信をキャンセルします
+		/// </summary>
+		void cancelTask();
+	};
+
+	/// <summary>
+	/// SimpleHTTP::OpenEventStream() で開いた、イベントのストリーム
+	/// 受信したイベントは通信スレッドでロックフリーのキューに追加されるので、メインスレッドで毎フレーム tryPop() で取り出します。
+	/// すべてのコピーが破棄されると、接続を閉じます。
+	/// </summary>
+	class HTTPEventStream
+	{
+	private:
+
+		friend HTTPEventStream SimpleHTTP::OpenEventStream(URLView url, const HTTPHeader& header, HTTPEventStreamFormat format, const HTTPRequestOptions& options);
+
+		struct State;
+
+		std::shared_ptr<State> m_state;
+
+	public:
+
+		HTTPEventStream();
+
+		/// <summary>
+		/// 受信したイベントを古い順に 1 つ取り出します。キューが空の場合は false を返します。
+		/// 取り出すのは 1 つのスレッド（通常はメインスレッド）からだけにしてください
+		/// </summary>
+		bool tryPop(HTTPEvent& event);
+
+		/// <summary>
+		/// 接続中または再接続を待っている間は Working、ステータスコードが 2xx でなかった場合は Failed、サーバーが 204 No Content で終了を指示した場合は Succeeded、close() の後は Canceled を返します
+		/// </summary>
+		[[nodiscard]] HTTPAsyncStatus currentStatus() const;
+
+		/// <summary>
+		/// 再接続した回数（再接続を待っている場合を含む）を返します
+		/// </summary>
+		[[nodiscard]] uint32 reconnectCount() const;
+
+		/// <summary>
+		/// 接続を閉じ、再接続をやめます。キューに残っているイベントは取り出せます
+		/// </summary>
+		void close();
+	};
+
+	/// <summary>
+	/// レイテンシのヒストグラム
+	/// バケット i には、BucketUpperBoundMicrosec(i - 1) より大きく BucketUpperBoundMicrosec(i) 以下の値が入ります。最後のバケットは上限がありません。
+	/// </summary>
+	struct HTTPLatencyHistogram
+	{
+		static constexpr size_t BucketCount = 20;
+
+		std::array<uint64, BucketCount> buckets = {};
+
+		uint64 count = 0;
+
+		int64 sumMicrosec = 0;
+
+		/// <summary>
+		/// バケットの上限（マイクロ秒）を返します。50 us から 2 倍ずつ増えます。
+		/// </summary>
+		[[nodiscard]] static constexpr int64 BucketUpperBoundMicrosec(size_t index)
+		{
+			return (int64{ 50 } << index);
+		}
+
+		/// <summary>
+		/// 平均値（ミリ秒）。値が無い場合 none
+		/// </summary>
+		[[nodiscard]] Optional<double> meanMs() const;
+
+		/// <summary>
+		/// 指定したパーセンタイルの値が含まれるバケットの上限（ミリ秒）。値が無い場合 none
+		/// </summary>
+		/// <param name="p">
+		/// 0.0 ～ 1.0
+		/// </param>
+		[[nodiscard]] Optional<double> percentileMs(double p) const;
+	};
+
+	/// <summary>
+	/// HTTPMetrics で集計した値
+	/// </summary>
+	struct HTTPMetricsSnapshot
+	{
+		uint64 requestsStarted = 0;
+
+		/// <summary>
+		/// HTTPAsyncStatus::Succeeded で終わった通信の数
+		/// </summary>
+		uint64 requestsSucceeded = 0;
+
+		/// <summary>
+		/// HTTPAsyncStatus::Failed で終わった通信の数
+		/// </summary>
+		uint64 requestsFailed = 0;
+
+		/// <summary>
+		/// HTTPAsyncStatus::Canceled で終わった通信の数
+		/// </summary>
+		uint64 requestsCanceled = 0;
+
+		/// <summary>
+		/// HTTPAsyncStatus::TimedOut で終わった通信の数
+		/// </summary>
+		uint64 requestsTimedOut = 0;
+
+		/// <summary>
+		/// HTTPRetryPolicy によって再試行した回数
+		/// </summary>
+		uint64 retries = 0;
+
+		/// <summary>
+		/// HTTPHedgePolicy によってヘッジした回数
+		/// </summary>
+		uint64 hedges = 0;
+
+		/// <summary>
+		/// ヘッジした通信が先に応答し、使われた回数
+		/// </summary>
+		uint64 hedgesWon = 0;
+
+		/// <summary>
+		/// ミラーからのダウンロードで、失敗したか遅いために別のミラーに切り替えた回数
+		/// </summary>
+		uint64 mirrorSwitches = 0;
+
+		/// <summary>
+		/// 受信した本文のバイト数
+		/// </summary>
+		uint64 bytesReceived = 0;
+
+		/// <summary>
+		/// 送信した本文のバイト数
+		/// </summary>
+		uint64 bytesSent = 0;
+
+		uint64 connectionsCreated = 0;
+
+		uint64 connectionsReused = 0;
+
+		/// <summary>
+		/// 同時に実行する通信の数の上限のために、開始を待っている通信の数
+		/// </summary>
+		int64 queuedRequests = 0;
+
+		/// <summary>
+		/// 実行中の通信の数
+		/// </summary>
+		int64 inFlightRequests = 0;
+
+		/// <summary>
+		/// HTTPAdaptiveConcurrency で調整した、同時に実行する通信の数の上限。全体の値はホストごとの上限の合計
+		/// </summary>
+		int64 concurrencyLimit = 0;
+
+		HTTPLatencyHistogram dnsLatency;
+
+		/// <summary>
+		/// 名前解決の完了から TCP 接続の確立まで
+		/// </summary>
+		HTTPLatencyHistogram connectLatency;
+
+		/// <summary>
+		/// TCP 接続の確立から TLS ハンドシェイクの完了まで（TLS を使った通信のみ）
+		/// </summary>
+		HTTPLatencyHistogram tlsLatency;
+
+		/// <summary>
+		/// 通信の開始から最初のバイトを受信するまで
+		/// </summary>
+		HTTPLatencyHistogram ttfbLatency;
+	};
+
+	/// <summary>
+	/// HTTP クライアント全体とホストごとの統計
+	/// 集計はロックを使わずに行われ、スナップショットはいつでも取得できます。
+	/// </summary>
+	namespace HTTPMetrics
+	{
+		/// <summary>
+		/// プロセス全体の統計を返します。
+		/// </summary>
+		[[nodiscard]] HTTPMetricsSnapshot GetSnapshot();
+
+		/// <summary>
+		/// ホスト（"example.com:8080" の形式）ごとの統計を返します。
+		/// </summary>
+		[[nodiscard]] HashTable<String, HTTPMetricsSnapshot> GetHostSnapshots();
+
+		/// <summary>
+		/// 統計を Prometheus のテキスト形式で返します。
+		/// </summary>
+		[[nodiscard]] String ExportText();
+
+		/// <summary>
+		/// 実行中の通信の数を除いて、統計を 0 に戻します。
+		/// </summary>
+		void Reset();
+	}
+
+	/// <summary>
+	/// 通信の各段階（待機・名前解決・接続・TLS・最初のバイト・本文・ディスクへの書き出し・完了の受け取り）の記録
+	/// 記録はリングバッファに保存され、Chrome のトレース形式（chrome://tracing, Perfetto）で出力できます。
+	/// 無効の間は、通信ごとにフラグを 1 回読むだけです。
+	/// </summary>
+	namespace HTTPTrace
+	{
+		/// <summary>
+		/// 記録を開始します。既存の記録は消去されます。
+		/// </summary>
+		/// <param name="capacity">
+		/// 保存するイベントの最大数。超えた場合は古いものから上書きされます。
+		/// </param>
+		void Enable(size_t capacity = 16384);
+
+		/// <summary>
+		/// 記録を停止します。記録済みのイベントは残ります。
+		/// </summary>
+		void Disable();
+
+		[[nodiscard]] bool IsEnabled();
+
+		void Clear();
+
+		/// <summary>
+		/// 記録したイベントを Chrome のトレース形式の JSON で返します。
+		/// </summary>
+		[[nodiscard]] String ExportChromeTrace();
+
+		/// <summary>
+		/// 記録したイベントを Chrome のトレース形式の JSON ファイルに保存します。
+		/// </summary>
+		bool SaveChromeTrace(FilePathView path);
+	}
 }
 
 //////////////////////////////////////////////////
@@ -0,0 +1,153 @@
+﻿# pragma once
+# include "HTTPClient.hpp"
+
+// C++20 のコルーチンに対応したコンパイラでのみ使えます
+# if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+# include <coroutine>
+# include <exception>
+
+namespace s3d
+{
+	/// <summary>
+	/// AsyncHTTPTask を co_await するための Awaiter
+	/// 中断と再開でメモリを確保しません（コルーチンのハンドルは、コルーチンのフレーム内のこのオブジェクトに保持します）。
+	/// </summary>
+	class HTTPAwaiter
+	{
+	private:
+
+		AsyncHTTPTask& m_task;
+
+		std::coroutine_handle<> m_handle;
+
+		static void Resume(void* context)
+		{
+			static_cast<HTTPAwaiter*>(context)->m_handle.resume();
+		}
+
+	public:
+
+		explicit HTTPAwaiter(AsyncHTTPTask& task) noexcept
+			: m_task(task) {}
+
+		[[nodiscard]] bool await_ready() const
+		{
+			// setContinuation() が登録できるかと同じ isFinished() で判定する
+			return m_task.isFinished();
+		}
+
+		bool await_suspend(const std::coroutine_handle<> handle)
+		{
+			m_handle = handle;
+
+			// 登録した後は、他のスレッドで再開されている可能性があるため、このオブジェクトに触れない
+			return m_task.setContinuation(&HTTPAwaiter::Resume, this);
+		}
+
+		/// <summary>
+		/// 一時オブジェクトの AsyncHTTPTask を co_await した場合も使えるように、レスポンスはコピーして返します。
+		/// </summary>
+		HTTPResponse await_resume()
+		{
+			// getResponse() でも同じレスポンスを取れるようにする
+			[[maybe_unused]] const bool delivered = m_task.isDone();
+
+			return m_task.getFinishedResponse();
+		}
+	};
+
+	/// <summary>
+	/// 通信が終わるまで中断し、AsyncHTTPTask::resumeOn() で設定したスレッドで再開します。
+	/// </summary>
+	[[nodiscard]] inline HTTPAwaiter operator co_await(AsyncHTTPTask& task) noexcept
+	{
+		return HTTPAwaiter{ task };
+	}
+
+	/// <summary>
+	/// co_await SimpleHTTP::GetAsync(...) のように、一時オブジェクトを co_await できるようにします。
+	/// 一時オブジェクトは co_await を含む式の終わりまで破棄されません。
+	/// </summary>
+	[[nodiscard]] inline HTTPAwaiter operator co_await(AsyncHTTPTask&& task) noexcept
+	{
+		return HTTPAwaiter{ task };
+	}
+
+	/// <summary>
+	/// HTTP の通信を co_await するコルーチンの戻り値の型
+	/// 呼び出すとすぐに開始し、最後まで実行されるとコルーチンのフレームは自動で破棄されます。
+	/// </summary>
+	class HTTPCoroutine
+	{
+	private:
+
+		struct State
+		{
+			std::atomic<bool> done = false;
+
+			std::exception_ptr exception;
+		};
+
+		std::shared_ptr<State> m_state;
+
+		explicit HTTPCoroutine(std::shared_ptr<State> state) noexcept
+			: m_state(std::move(state)) {}
+
+	public:
+
+		struct promise_type
+		{
+			std::shared_ptr<State> state = std::make_shared<State>();
+
+			HTTPCoroutine get_return_object() noexcept
+			{
+				return HTTPCoroutine{ state };
+			}
+
+			std::suspend_never initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never final_suspend() const noexcept
+			{
+				return {};
+			}
+
+			void return_void() noexcept
+			{
+				state->done.store(true, std::memory_order_release);
+			}
+
+			void unhandled_exception() noexcept
+			{
+				state->exception = std::current_exception();
+				state->done.store(true, std::memory_order_release);
+			}
+		};
+
+		HTTPCoroutine() = default;
+
+		/// <summary>
+		/// コルーチンが最後まで実行されたか（例外で終わった場合も含む）を返します。
+		/// </summary>
+		[[nodiscard]] bool isDone() const noexcept
+		{
+			return (m_state && m_state->done.load(std::memory_order_acquire));
+		}
+
+		/// <summary>
+		/// コルーチンが例外で終わった場合、その例外を投げます。
+		/// </summary>
+		void rethrowIfFailed() const
+		{
+			if (isDone() && m_state->exception)
+			{
+				std::rethrow_exception(m_state->exception);
+			}
+		}
+	};
+}
+
+# endif
@@ -0,0 +1,87 @@
+﻿# pragma once
+# include <array>
+# include "HTTPClient.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		class SHA256Hasher
+		{
+		private:
+
+			std::array<uint32, 8> m_state;
+
+			std::array<uint8, 64> m_block;
+
+			size_t m_blockSize = 0;
+
+			uint64 m_totalSize = 0;
+
+			void transform(const uint8* block);
+
+		public:
+
+			SHA256Hasher();
+
+			void update(const void* data, size_t size);
+
+			[[nodiscard]] std::array<uint8, 32> finalize();
+		};
+
+		class XXH64Hasher
+		{
+		private:
+
+			std::array<uint64, 4> m_state;
+
+			std::array<uint8, 32> m_block;
+
+			size_t m_blockSize = 0;
+
+			uint64 m_totalSize = 0;
+
+		public:
+
+			XXH64Hasher();
+
+			void update(const void* data, size_t size);
+
+			[[nodiscard]] uint64 finalize() const;
+		};
+
+		/// <summary>
+		/// 受信したデータのハッシュ値を逐次計算します。
+		/// </summary>
+		class HTTPDigester
+		{
+		private:
+
+			HTTPDigestType m_type = HTTPDigestType::None;
+
+			SHA256Hasher m_sha256;
+
+			XXH64Hasher m_xxh64;
+
+		public:
+
+			HTTPDigester() = default;
+
+			explicit HTTPDigester(HTTPDigestType type);
+
+			[[nodiscard]] bool isEnabled() const;
+
+			void update(const void* data, size_t size);
+
+			/// <summary>
+			/// ハッシュ値を小文字の 16 進数文字列で返します。
+			/// </summary>
+			[[nodiscard]] String finalize();
+		};
+
+		/// <summary>
+		/// 2 つの 16 進数のハッシュ値が等しいかを、大文字と小文字を区別せずに比較します。
+		/// </summary>
+		[[nodiscard]] bool DigestEquals(StringView a, StringView b);
+	}
+}
@@ -0,0 +1,269 @@
+﻿# pragma once
+# include <atomic>
+# include <condition_variable>
+# include <functional>
+# include <mutex>
+# include "HTTPClient.hpp"
+# include "HTTPFileSink.hpp"
+# include "HTTPMetrics.hpp"
+# include "HTTPTrace.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		/// <summary>
+		/// HTTPEngine のスレッドが書き込み、呼び出し側のスレッドが読む通信の進行状況
+		/// </summary>
+		struct HTTPAtomicProgress
+		{
+			std::atomic<HTTPAsyncStatus> status = HTTPAsyncStatus::None;
+
+			std::atomic<int64> downloadNowSize = 0;
+
+			// 不明の場合は -1
+			std::atomic<int64> downloadTotalSize = -1;
+
+			std::atomic<int64> uploadNowSize = 0;
+
+			// 不明の場合は -1
+			std::atomic<int64> uploadTotalSize = -1;
+
+			/// <summary>
+			/// 現在の値を progress にコピーします。
+			/// </summary>
+			void load(HTTPProgress& progress) const;
+		};
+
+		/// <summary>
+		/// HTTPEngine で行う通信 1 回分の要求と結果
+		/// 呼び出し側と HTTPEngine の両方が所有し、どちらが先に手放しても安全です。
+		/// </summary>
+		class HTTPEngineTransfer : public std::enable_shared_from_this<HTTPEngineTransfer>
+		{
+		private:
+
+			std::mutex m_mutex;
+
+			std::condition_variable m_finishedCondition;
+
+			std::atomic<bool> m_finished = false;
+
+			std::atomic<bool> m_cancelRequested = false;
+
+			HTTPResponse m_response;
+
+			// synchronous の通信で、wait() を呼んだスレッドに実行させる後処理
+			std::function<void()> m_completion;
+
+			struct Continuation
+			{
+				HTTPExecutor executor = HTTPExecutor::IOThread;
+
+				void (*callback)(void*) = nullptr;
+
+				void* context = nullptr;
+			};
+
+			Optional<Continuation> m_continuation;
+
+			struct ThenStage
+			{
+				std::function<void(const HTTPResponse&)> callback;
+
+				HTTPExecutor executor = HTTPExecutor::MainThread;
+			};
+
+			// then() で登録された処理。通信が終わった後、登録した順に 1 つずつ実行する
+			Array<ThenStage> m_thenStages;
+
+			size_t m_nextThenStage = 0;
+
+			// then() の処理を実行している間、この通信を破棄しないための参照
+			std::shared_ptr<HTTPEngineTransfer> m_thenSelf;
+
+			static void RunThenStage(void* context);
+
+			void scheduleNextThenStage();
+
+			void startThenStages();
+
+		public:
+
+			/// <summary>
+			/// 受信したデータの書き込み先を作成する関数。再試行のたびに新しく作成します。
+			/// </summary>
+			using SinkFactory = std::function<std::unique_ptr<IHTTPFileSink>()>;
+
+			HTTPEngineTransfer(URLView url, const HTTPHeader& header, const HTTPRequestOptions& options, SinkFactory createSink);
+
+			URL url;
+
+			/// <summary>
+			/// 同じファイルを配信する URL（ミラー）。空でない場合は url の代わりに、この中から HTTPEngine が選ぶ
+			/// </summary>
+			Array<URL> mirrors;
+
+			/// <summary>
+			/// スケジューリングに使うホスト名とポート
+			/// </summary>
+			String host;
+
+			HTTPHeader header;
+
+			HTTPRequestOptions options;
+
+			/// <summary>
+			/// POST する場合 true。送信するデータは通信が終わるまで呼び出し側が保持します。
+			/// </summary>
+			bool post = false;
+
+			const void* postData = nullptr;
+
+			size_t postSize = 0;
+
+			/// <summary>
+			/// 設定した場合、postData の代わりにこのフォームを multipart/form-data で送る
+			/// </summary>
+			std::shared_ptr<const HTTPForm> form;
+
+			SinkFactory createSink;
+
+			std::unique_ptr<IHTTPFileSink> sink;
+
+			/// <summary>
+			/// 通信の進行状況。HTTPEngine のスレッドが書き込みます。
+			/// </summary>
+			HTTPAtomicProgress progress;
+
+			/// <summary>
+			/// progress の downloadNowSize などを更新するか
+			/// </summary>
+			bool reportProgress = false;
+
+			/// <summary>
+			/// 同期 API の通信の場合 true。後処理を HTTPEngine の後処理のスレッドではなく、wait() を呼んだスレッドで行います。
+			/// </summary>
+			bool synchronous = false;
+
+			/// <summary>
+			/// true の場合、同時に実行する通信の数の上限（全体とホストごと）に数えず、待機せずに開始します。
+			/// 同期 API の通信と、終わらないイベントストリームの接続で使います。
+			/// </summary>
+			bool bypassLimits = false;
+
+			/// <summary>
+			/// この通信の帯域の上限（バイト/秒、0 で無制限）。通信中に変更すると、HTTPEngine が次に起きたときに反映されます。
+			/// </summary>
+			std::atomic<int64> maxRecvBytesPerSec;
+
+			std::atomic<int64> maxSendBytesPerSec;
+
+			/// <summary>
+			/// options.timeout から求めた期限（GetEngineMicrosec() の値）。0 の場合は無制限
+			/// </summary>
+			int64 deadlineMicrosec = 0;
+
+			/// <summary>
+			/// 開始した回数
+			/// </summary>
+			uint32 attempts = 0;
+
+			/// <summary>
+			/// 再試行を待っている場合、再試行する時刻（GetEngineMicrosec() の値）
+			/// </summary>
+			int64 retryAtMicrosec = 0;
+
+			HTTPRequestMetrics metrics;
+
+			HTTPRequestTrace trace;
+
+			/// <summary>
+			/// 通信が終わったかを返します。true を返した後は getResponse() を呼べます。
+			/// </summary>
+			[[nodiscard]] bool isFinished() const noexcept;
+
+			/// <summary>
+			/// 通信が終わるまで待ちます。HTTPEngine のスレッドから呼んではいけません。
+			/// synchronous の通信の場合は、待っている間に postCompletion() で渡された後処理を実行します。
+			/// </summary>
+			void wait();
+
+			/// <summary>
+			/// wait() を呼んでいるスレッドに completion を実行させます。synchronous の通信の後処理に使います。
+			/// </summary>
+			void postCompletion(std::function<void()> completion);
+
+			[[nodiscard]] const HTTPResponse& getResponse() const noexcept;
+
+			/// <summary>
+			/// キャンセルを要求します。どのスレッドからでも呼べます。
+			/// </summary>
+			void requestCancel() noexcept;
+
+			/// <summary>
+			/// キャンセルが要求されたか（requestCancel() か options.cancellation）を返します。
+			/// </summary>
+			[[nodiscard]] bool isCancelRequested() const noexcept;
+
+			/// <summary>
+			/// 通信が終わったときに、executor で callback(context) を 1 度だけ呼ぶように登録します。
+			/// 既に終わっている場合は登録せずに false を返します。
+			/// </summary>
+			bool setContinuation(HTTPExecutor executor, void (*callback)(void*), void* context);
+
+			/// <summary>
+			/// 通信が終わった後に executor で callback(response) を実行するように登録します。
+			/// 前に登録した処理が終わってから実行します。既に終わっている場合もすぐに実行します。
+			/// </summary>
+			void then(std::function<void(const HTTPResponse&)> callback, HTTPExecutor executor);
+
+			/// <summary>
+			/// 結果を設定し、待っているスレッドを起こして、登録された継続を実行します。HTTPEngine から 1 度だけ呼ばれます。
+			/// </summary>
+			void finish(const HTTPResponse& response, HTTPAsyncStatus status);
+		};
+
+		/// <summary>
+		/// HTTPEngine が期限や帯域の計算に使う時刻（マイクロ秒、steady_clock）
+		/// </summary>
+		[[nodiscard]] int64 GetEngineMicrosec() noexcept;
+
+		/// <summary>
+		/// 通信を HTTPEngine のキューに追加します。
+		/// HTTPEngine は 1 つのスレッドで curl_multi を使ってすべての通信を進め、
+		/// 同時に実行する通信の数を全体とホストごとに制限しながら、ホストを順番に選んで開始します。
+		/// </summary>
+		void SubmitTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer);
+
+		/// <summary>
+		/// キャンセルの要求や設定の変更を、HTTPEngine にすぐに確認させます。
+		/// </summary>
+		void WakeEngine();
+
+		/// <summary>
+		/// HTTPEngine のスレッドを終了します。実行中の通信はキャンセルされます。
+		/// </summary>
+		void ShutdownEngine();
+
+		/// <summary>
+		/// callback(context) を executor で実行します。キューに追加するだけで、メモリの確保は最初の数回だけです。
+		/// </summary>
+		void Schedule(HTTPExecutor executor, void (*callback)(void*), void* context);
+
+		/// <summary>
+		/// HTTPExecutor::MainThread の処理を System::Update() で実行するアドオンを登録します。メインスレッドから呼びます。
+		/// </summary>
+		void RegisterExecutorAddon();
+
+		/// <summary>
+		/// ワーカースレッドを、キューに残っている処理を実行してから終了します。
+		/// </summary>
+		void ShutdownExecutors();
+
+		/// <summary>
+		/// 通信を実行し、終わるまで待ちます。
+		/// </summary>
+		HTTPResponse PerformTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer);
+	}
+}
@@ -0,0 +1,578 @@
+﻿# pragma once
+# include <atomic>
+# include <mutex>
+# include <condition_variable>
+# include <thread>
+# include <deque>
+# include "HTTPClient.hpp"
+
+# if SIV3D_PLATFORM(LINUX) && __has_include(<linux/io_uring.h>)
+#	define SIV3D_HTTPCLIENT_IO_URING 1
+# else
+#	define SIV3D_HTTPCLIENT_IO_URING 0
+# endif
+
+namespace s3d
+{
+	namespace detail
+	{
+		/// <summary>
+		/// OS のファイルハンドルの薄いラッパー
+		/// </summary>
+		class NativeFile
+		{
+		private:
+
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			void* m_handle = nullptr;
+
+		# else
+
+			int m_fd = -1;
+
+		# endif
+
+		public:
+
+			NativeFile() = default;
+
+			NativeFile(const NativeFile&) = delete;
+
+			NativeFile& operator =(const NativeFile&) = delete;
+
+			~NativeFile();
+
+			/// <summary>
+			/// 読み書き用にファイルを開きます。既存のファイルは空になります。
+			/// </summary>
+			bool open(FilePathView path);
+
+			[[nodiscard]] bool isOpen() const;
+
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			[[nodiscard]] void* nativeHandle() const;
+
+		# else
+
+			[[nodiscard]] int nativeHandle() const;
+
+		# endif
+
+			/// <summary>
+			/// 指定した位置に書き込みます。すべて書き込めた場合に true を返します。
+			/// </summary>
+			bool writeAt(int64 offset, const void* src, size_t size);
+
+			/// <summary>
+			/// ファイルサイズを変えずに、ディスク上の領域を事前に確保します。
+			/// </summary>
+			bool preallocate(int64 size);
+
+			bool truncate(int64 size);
+
+			void close();
+		};
+
+		/// <summary>
+		/// 受信したデータの書き込み先
+		/// </summary>
+		class IHTTPFileSink : public IWriter
+		{
+		public:
+
+			/// <summary>
+			/// 受信するデータのサイズが判明したときに呼ばれます。
+			/// </summary>
+			virtual bool preallocate(int64 size) = 0;
+
+			/// <summary>
+			/// レスポンスボディの最初のデータを書き込む前に、レスポンスのステータスコードを伝えます。
+			/// </summary>
+			virtual void beginBody(int32) {}
+
+			/// <summary>
+			/// 通信が成功したときに呼ばれ、未書き込みのデータをすべて書き出してファイルを閉じます。
+			/// </summary>
+			virtual bool commit() = 0;
+
+			/// <summary>
+			/// 通信が失敗したときに呼ばれ、書き込んだデータを破棄します。
+			/// </summary>
+			virtual void discard() = 0;
+
+			/// <summary>
+			/// setPos() で書き込む位置を自由に動かせる場合 true を返します。
+			/// ミラーからのダウンロードは、この場合だけ区間に分けて並行して受信します。
+			/// </summary>
+			[[nodiscard]] virtual bool supportsRandomAccess() const
+			{
+				return false;
+			}
+
+			/// <summary>
+			/// 受信したデータを書き込んだときにすぐ処理する（後から書き直せない）場合 true を返します。
+			/// ヘッジした通信の本文は完了までメモリに保持されてから書き込まれるため、このような書き込み先ではヘッジしません。
+			/// </summary>
+			[[nodiscard]] virtual bool isStreaming() const
+			{
+				return false;
+			}
+		};
+
+		class BinaryWriterFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			BinaryWriter m_writer;
+
+		public:
+
+			explicit BinaryWriterFileSink(FilePathView path);
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64 pos) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64) override;
+
+			bool commit() override;
+
+			void discard() override;
+
+			bool supportsRandomAccess() const override;
+		};
+
+		/// <summary>
+		/// 受信したデータをメモリに保持します。
+		/// </summary>
+		class MemoryFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			Array<uint8> m_data;
+
+			int64 m_pos = 0;
+
+		public:
+
+			MemoryFileSink() = default;
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64 pos) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64 size) override;
+
+			bool commit() override;
+
+			void discard() override;
+
+			bool supportsRandomAccess() const override;
+
+			[[nodiscard]] const Array<uint8>& data() const noexcept;
+		};
+
+		/// <summary>
+		/// 受信した JSON を要素ごとに解析し、コールバックに渡します。
+		/// 保持するのは解析中の要素 1 つ分のデータだけです。
+		/// </summary>
+		class JSONStreamFileSink final : public IHTTPFileSink
+		{
+		public:
+
+			/// <summary>
+			/// 再試行で作り直した書き込み先の間で共有する状態
+			/// </summary>
+			struct Consumer
+			{
+				HTTPJSONStreamFormat format = HTTPJSONStreamFormat::Array;
+
+				std::function<void(const JSONValue&)> onElement;
+
+				/// <summary>
+				/// onElement に渡した要素の数。再試行した場合は、この数だけ読み飛ばす
+				/// </summary>
+				size_t delivered = 0;
+			};
+
+		private:
+
+			enum class State
+			{
+				// 配列の '[' の前
+				BeforeArray,
+
+				// 要素と要素の間
+				BetweenElements,
+
+				InElement,
+
+				// 配列の ']' の後
+				AfterArray,
+
+				// 2xx 以外のレスポンスのため、解析しない
+				Skip,
+
+				Failed,
+			};
+
+			std::shared_ptr<Consumer> m_consumer;
+
+			State m_state = State::BetweenElements;
+
+			// 解析中の要素
+			std::string m_element;
+
+			// 解析中の要素の括弧の深さ。0 の場合は文字列か数値などの値
+			int32 m_depth = 0;
+
+			bool m_container = false;
+
+			bool m_inString = false;
+
+			bool m_escaped = false;
+
+			// 解析中の要素の番号
+			size_t m_index = 0;
+
+			int64 m_pos = 0;
+
+			bool feedArray(const char* data, size_t size);
+
+			bool feedLines(const char* data, size_t size);
+
+			bool emitElement();
+
+		public:
+
+			explicit JSONStreamFileSink(const std::shared_ptr<Consumer>& consumer);
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64 pos) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64) override;
+
+			void beginBody(int32 statusCode) override;
+
+			bool commit() override;
+
+			void discard() override;
+
+			bool isStreaming() const override;
+		};
+
+		/// <summary>
+		/// 受信したデータを大きなバッファにまとめ、バックグラウンドのスレッドでファイルに書き込みます。
+		/// 書き込み待ちのバッファが上限に達すると、通信スレッドは空きができるまで待機します。
+		/// </summary>
+		class WriteBehindFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			struct Buffer
+			{
+				uint8* data = nullptr;
+
+				size_t size = 0;
+
+				int64 offset = 0;
+			};
+
+			NativeFile m_file;
+
+			size_t m_bufferSize = 0;
+
+			size_t m_maxBuffers = 0;
+
+			Array<uint8*> m_allocatedBuffers;
+
+			Array<uint8*> m_freeBuffers;
+
+			std::deque<Buffer> m_pendingBuffers;
+
+			Buffer m_current;
+
+			int64 m_writtenSize = 0;
+
+			bool m_writing = false;
+
+			bool m_failed = false;
+
+			bool m_quit = false;
+
+			std::mutex m_mutex;
+
+			std::condition_variable m_pendingCondition;
+
+			std::condition_variable m_freeCondition;
+
+			std::thread m_thread;
+
+			bool acquireBuffer();
+
+			void submitCurrent();
+
+			void stop();
+
+			void run();
+
+		public:
+
+			WriteBehindFileSink(FilePathView path, size_t bufferSize, size_t queueLength);
+
+			~WriteBehindFileSink() override;
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64 size) override;
+
+			bool commit() override;
+
+			void discard() override;
+		};
+
+		/// <summary>
+		/// サイズが判明した時点でファイルをメモリマップし、受信したデータを直接コピーします。
+		/// サイズが不明な場合や、ディスク上の領域を確保できない場合は、通常のファイル書き込みを行います。
+		/// </summary>
+		class MemoryMappedFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			NativeFile m_file;
+
+			HTTPMappedFileFlush m_flush = HTTPMappedFileFlush::Async;
+
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			void* m_mappingHandle = nullptr;
+
+		# endif
+
+			uint8* m_mapped = nullptr;
+
+			int64 m_mappedSize = 0;
+
+			int64 m_pos = 0;
+
+			std::atomic<int64> m_writtenSize = 0;
+
+			std::atomic<bool> m_failed = false;
+
+			bool map(int64 size);
+
+			bool flush();
+
+			void unmap();
+
+		public:
+
+			MemoryMappedFileSink(FilePathView path, HTTPMappedFileFlush flush);
+
+			~MemoryMappedFileSink() override;
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64 pos) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			/// <summary>
+			/// 指定した位置に書き込みます。
+			/// マップ済みの範囲であれば、重ならない範囲への書き込みは複数のスレッドから同時に行えます。
+			/// </summary>
+			bool writeAt(int64 offset, const void* src, int64 size);
+
+			bool preallocate(int64 size) override;
+
+			bool commit() override;
+
+			void discard() override;
+
+			bool supportsRandomAccess() const override;
+		};
+
+	# if SIV3D_HTTPCLIENT_IO_URING
+
+		/// <summary>
+		/// 受信したデータを登録済みのバッファにまとめ、io_uring で書き込みを発行します。
+		/// 書き込みはカーネル側で非同期に行われ、空きバッファが無くなったときだけ完了を待ちます。
+		/// </summary>
+		class IoUringFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			struct Ring;
+
+			struct Buffer
+			{
+				uint8* data = nullptr;
+
+				size_t size = 0;
+
+				int64 offset = 0;
+			};
+
+			std::unique_ptr<Ring> m_ring;
+
+			NativeFile m_file;
+
+			size_t m_bufferSize = 0;
+
+			Array<Buffer> m_buffers;
+
+			Array<uint16> m_freeBuffers;
+
+			Optional<uint16> m_current;
+
+			// 発行待ちの書き込みの数
+			uint32 m_unsubmitted = 0;
+
+			// 完了待ちの書き込みの数
+			uint32 m_inFlight = 0;
+
+			bool m_registered = false;
+
+			int64 m_writtenSize = 0;
+
+			bool m_failed = false;
+
+			void queueCurrent();
+
+			// io_uring_enter が失敗した場合に false を返す。書き込みの失敗は m_failed で表す
+			bool submit(uint32 waitCount);
+
+			void reap();
+
+			bool waitAll();
+
+			void release();
+
+		public:
+
+			/// <summary>
+			/// この環境で io_uring が使えるかを返します。
+			/// </summary>
+			[[nodiscard]] static bool IsAvailable();
+
+			IoUringFileSink(FilePathView path, size_t bufferSize, size_t queueLength);
+
+			~IoUringFileSink() override;
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64 size) override;
+
+			bool commit() override;
+
+			void discard() override;
+		};
+
+	# endif
+
+		/// <summary>
+		/// 一時ファイルに書き込み、commit() で保存先にリネームします。
+		/// </summary>
+		class AtomicRenameFileSink final : public IHTTPFileSink
+		{
+		private:
+
+			std::unique_ptr<IHTTPFileSink> m_sink;
+
+			FilePath m_temporaryPath;
+
+			FilePath m_path;
+
+			bool m_sync = true;
+
+			bool m_finished = false;
+
+		public:
+
+			AtomicRenameFileSink(std::unique_ptr<IHTTPFileSink>&& sink, FilePathView temporaryPath, FilePathView path, bool sync);
+
+			~AtomicRenameFileSink() override;
+
+			bool isOpen() const override;
+
+			int64 size() const override;
+
+			int64 getPos() const override;
+
+			bool setPos(int64 pos) override;
+
+			int64 write(const void* src, int64 size) override;
+
+			bool preallocate(int64 size) override;
+
+			bool commit() override;
+
+			void discard() override;
+
+			bool supportsRandomAccess() const override;
+		};
+
+		/// <summary>
+		/// 保存先と同じディレクトリに、一時ファイルのパスを作成します。
+		/// </summary>
+		[[nodiscard]] FilePath MakeTemporaryFilePath(FilePathView path);
+
+		/// <summary>
+		/// ファイルの内容をディスクに書き出します。
+		/// </summary>
+		bool SyncFile(FilePathView path);
+
+		/// <summary>
+		/// ファイルのあるディレクトリのエントリをディスクに書き出します。
+		/// </summary>
+		bool SyncParentDirectory(FilePathView path);
+
+		/// <summary>
+		/// from を to にリネームします。to が既に存在する場合は置き換えます。
+		/// </summary>
+		bool RenameReplacing(FilePathView from, FilePathView to);
+
+		[[nodiscard]] std::unique_ptr<IHTTPFileSink> CreateFileSink(FilePathView path, const HTTPRequestOptions& options);
+	}
+}
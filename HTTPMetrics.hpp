@@ -0,0 +1,165 @@
+﻿# pragma once
+# include <atomic>
+# include "HTTPClient.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		class AtomicLatencyHistogram
+		{
+		private:
+
+			std::array<std::atomic<uint64>, HTTPLatencyHistogram::BucketCount> m_buckets = {};
+
+			std::atomic<uint64> m_count = 0;
+
+			std::atomic<int64> m_sumMicrosec = 0;
+
+		public:
+
+			void record(int64 microsec);
+
+			[[nodiscard]] HTTPLatencyHistogram load() const;
+
+			void reset();
+		};
+
+		struct HTTPMetricsCounters
+		{
+			std::atomic<uint64> requestsStarted = 0;
+
+			std::atomic<uint64> requestsSucceeded = 0;
+
+			std::atomic<uint64> requestsFailed = 0;
+
+			std::atomic<uint64> requestsCanceled = 0;
+
+			std::atomic<uint64> requestsTimedOut = 0;
+
+			std::atomic<uint64> retries = 0;
+
+			std::atomic<uint64> hedges = 0;
+
+			std::atomic<uint64> hedgesWon = 0;
+
+			std::atomic<uint64> mirrorSwitches = 0;
+
+			std::atomic<uint64> bytesReceived = 0;
+
+			std::atomic<uint64> bytesSent = 0;
+
+			std::atomic<uint64> connectionsCreated = 0;
+
+			std::atomic<uint64> connectionsReused = 0;
+
+			std::atomic<int64> queuedRequests = 0;
+
+			std::atomic<int64> inFlightRequests = 0;
+
+			std::atomic<int64> concurrencyLimit = 0;
+
+			AtomicLatencyHistogram dnsLatency;
+
+			AtomicLatencyHistogram connectLatency;
+
+			AtomicLatencyHistogram tlsLatency;
+
+			AtomicLatencyHistogram ttfbLatency;
+
+			[[nodiscard]] HTTPMetricsSnapshot load() const;
+
+			void reset();
+		};
+
+		/// <summary>
+		/// 通信 1 回分の接続とレイテンシの情報（時間はマイクロ秒、不明な場合は負の値）
+		/// </summary>
+		struct HTTPTransferInfo
+		{
+			int64 dnsMicrosec = -1;
+
+			int64 connectMicrosec = -1;
+
+			int64 tlsMicrosec = -1;
+
+			int64 ttfbMicrosec = -1;
+
+			/// <summary>
+			/// 通信の開始から終了まで
+			/// </summary>
+			int64 totalMicrosec = -1;
+
+			int64 bytesSent = 0;
+
+			/// <summary>
+			/// 新しく作成した接続の数。0 の場合は既存の接続を再利用した
+			/// </summary>
+			int64 newConnections = 0;
+		};
+
+		/// <summary>
+		/// 通信 1 回分の統計を、プロセス全体とホストの両方に記録します。
+		/// ホストの集計先は作成時に 1 度だけ探し、以降の記録はすべてアトミック変数の更新だけで行います。
+		/// </summary>
+		class HTTPRequestMetrics
+		{
+		private:
+
+			HTTPMetricsCounters* m_host = nullptr;
+
+			bool m_dispatched = false;
+
+			bool m_finished = false;
+
+		public:
+
+			explicit HTTPRequestMetrics(URLView url);
+
+			HTTPRequestMetrics(const HTTPRequestMetrics&) = delete;
+
+			HTTPRequestMetrics& operator =(const HTTPRequestMetrics&) = delete;
+
+			~HTTPRequestMetrics();
+
+			/// <summary>
+			/// 待機中の通信が開始されたときに呼びます。
+			/// </summary>
+			void dispatched();
+
+			void addBytesReceived(size_t size);
+
+			/// <summary>
+			/// HTTPRetryPolicy によって再試行するときに呼びます。
+			/// </summary>
+			void retried();
+
+			/// <summary>
+			/// HTTPHedgePolicy によってヘッジしたときに呼びます。
+			/// </summary>
+			void hedged();
+
+			/// <summary>
+			/// ヘッジした通信が先に応答したときに呼びます。
+			/// </summary>
+			void hedgeWon();
+
+			/// <summary>
+			/// ミラーからのダウンロードで、別のミラーに切り替えたときに呼びます。
+			/// </summary>
+			void mirrorSwitched();
+
+			/// <summary>
+			/// この通信のホストの TTFB の分布を返します。
+			/// </summary>
+			[[nodiscard]] HTTPLatencyHistogram loadHostTTFB() const;
+
+			void finish(HTTPAsyncStatus status, const HTTPTransferInfo& info);
+		};
+
+		/// <summary>
+		/// HTTPAdaptiveConcurrency で調整した、ホストの同時に実行する通信の数の上限を記録します。0 の場合は調整していない
+		/// </summary>
+		void SetHostConcurrencyLimit(StringView host, int64 limit);
+	}
+}
@@ -0,0 +1,23 @@
+﻿# pragma once
+# include "HTTPClient.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		/// <summary>
+		/// libcurl の CURLOPT_HEADERFUNCTION。受信したヘッダーの 1 行を gotData に追加します。
+		/// </summary>
+		size_t HeaderCallback(char* buffer, size_t size, size_t nitems, String* gotData);
+
+		/// <summary>
+		/// URL からホスト名とポート（"example.com:8080"）を取り出します。
+		/// </summary>
+		[[nodiscard]] StringView GetURLHost(URLView url);
+
+		/// <summary>
+		/// 通信の結果を HTTPAsyncStatus で表します。
+		/// </summary>
+		[[nodiscard]] HTTPAsyncStatus GetResultStatus(const HTTPResponse& response, bool cancelRequested);
+	}
+}
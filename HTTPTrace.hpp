@@ -0,0 +1,80 @@
+﻿# pragma once
+# include <atomic>
+# include <string>
+# include "HTTPClient.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		struct HTTPTransferInfo;
+
+		/// <summary>
+		/// HTTPTrace が有効であるか
+		/// </summary>
+		inline std::atomic<bool> HTTPTraceEnabled = false;
+
+		/// <summary>
+		/// トレースで使う時刻（マイクロ秒）を返します。
+		/// </summary>
+		[[nodiscard]] int64 GetTraceMicrosec();
+
+		/// <summary>
+		/// 通信 1 回分のトレースイベントを記録します。
+		/// 作成時に HTTPTrace が無効であれば、以降のすべての関数は何もしません。
+		/// </summary>
+		class HTTPRequestTrace
+		{
+		private:
+
+			// 0 の場合は記録しない
+			uint64 m_id = 0;
+
+			std::string m_url;
+
+			int64 m_createdAt = 0;
+
+			int64 m_finishedAt = 0;
+
+			// delivered() を記録済み
+			std::atomic<bool> m_delivered = false;
+
+		public:
+
+			HTTPRequestTrace() = default;
+
+			explicit HTTPRequestTrace(URLView url);
+
+			[[nodiscard]] bool isEnabled() const noexcept
+			{
+				return (m_id != 0);
+			}
+
+			/// <summary>
+			/// 通信を開始するときに呼び、作成からの待ち時間を記録します。
+			/// </summary>
+			void started();
+
+			/// <summary>
+			/// 通信が終わったときに呼び、名前解決・接続・TLS・最初のバイト・本文の各段階を記録します。
+			/// </summary>
+			void transferred(int64 performBegin, const HTTPTransferInfo& info);
+
+			/// <summary>
+			/// 受信したデータをディスクに書き出す処理を記録します。
+			/// </summary>
+			void flushed(int64 flushBegin);
+
+			/// <summary>
+			/// 通信全体を記録します。
+			/// </summary>
+			void finished(HTTPAsyncStatus status);
+
+			/// <summary>
+			/// 通信の完了を呼び出し側が受け取ったときに呼び、完了からの遅れを記録します。
+			/// isDone(), then() の処理、同期 API のうち最初に受け取ったときだけ記録します。
+			/// </summary>
+			void delivered();
+		};
+	}
+}
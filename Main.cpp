@@ -1,5 +1,14 @@
 ﻿# include "HTTPClient.hpp"
 # include <Siv3D.hpp> // OpenSiv3D v0.4.3
+# include "Benchmark/FileSinkBenchmark.hpp"
+
+// C++ のヒープ確保の回数も計測する場合は、次の行を有効にしてください
+// # define SIV3D_HTTPCLIENT_DEFINE_ALLOCATION_COUNTER
+# include "Benchmark/HTTPBenchmark.hpp"
+# include "Benchmark/HeaderParsingBenchmark.hpp"
+# include "Benchmark/PriorityBenchmark.hpp"
+# include "Benchmark/EventStreamBenchmark.hpp"
+# include "HTTPCoroutine.hpp"
 
 std::string CreateTestJSONData()
 {
@@ -14,6 +23,36 @@ std::string CreateTestJSONData()
 	return json.get().toUTF8();
 }
 
+# if defined(__cpp_impl_coroutine)
+
+// 認証 → マニフェスト → アセットの並列ダウンロードを、isDone() の状態遷移を書かずに順番に記述する
+HTTPCoroutine DownloadAssets(Array<String>& log)
+{
+	const HTTPHeader header = { { U"Authorization", U"Bearer RequestFromSiv3D" } };
+
+	const HTTPResponse auth = co_await SimpleHTTP::GetAsync(U"https://httpbin.org/bearer", header, U"auth.json");
+	log << U"auth: {}"_fmt(auth.getStatusCode());
+
+	const HTTPResponse manifest = co_await SimpleHTTP::GetAsync(U"https://httpbin.org/json", header, U"manifest.json");
+	log << U"manifest: {}"_fmt(manifest.getStatusCode());
+
+	// 先にすべて開始してから待つと、同時にダウンロードされる
+	Array<AsyncHTTPTask> assets;
+
+	for (int32 i = 0; i < 4; ++i)
+	{
+		assets << SimpleHTTP::GetAsync(U"https://httpbin.org/bytes/{}"_fmt(1024 << i), header, U"asset{}.bin"_fmt(i));
+	}
+
+	for (auto& asset : assets)
+	{
+		const HTTPResponse response = co_await asset;
+		log << U"asset: {}"_fmt(response.getStatusCode());
+	}
+}
+
+# endif
+
 void Main()
 {
 	if (!SimpleHTTP::InitCURL())
@@ -29,16 +68,18 @@ void Main()
 
 	const FilePath localFilePath = U"logo.png";
 
-	if (const HTTPResponse response = SimpleHTTP::DownloadFile(U"https://raw.githubusercontent.com/Siv3D/siv3d.docs.images/master/logo/logo.png", localFilePath))
-	{
-		Print << response.getHeader();
-		Print << response.getStatusCode();
-	}
+	// ダウンロードとデコードはワーカースレッドで行い、メインスレッドではテクスチャの作成だけを行う
+	AsyncHTTPImageTask task = SimpleHTTP::LoadImageAsync(U"https://raw.githubusercontent.com/Siv3D/siv3d.docs.images/master/logo/logo.png", {}, localFilePath);
 
-	const Texture texture(localFilePath);
+	Texture texture;
 
 	while (System::Update())
 	{
+		if (!texture && task.isReady())
+		{
+			texture = Texture(task.getImage());
+		}
+
 		texture.draw();
 	}
 
@@ -84,12 +125,22 @@ void Main()
 
 	Font font(50);
 
+	Font metricsFont(16);
+
 	Rect PFrame(Arg::center(Scene::Center()), 400, 50);
 
 	double progressPercentage = 0;
 
+	// T キーで、通信の各段階を Chrome のトレース形式で保存する
+	HTTPTrace::Enable();
+
 	while (System::Update())
 	{
+		if (KeyT.down())
+		{
+			HTTPTrace::SaveChromeTrace(U"http_trace.json");
+		}
+
 		if (SimpleGUI::ButtonAt(U"Download Start!", Scene::Center() - Point(0, 100), unspecified,
 			task.getProgress().status == HTTPAsyncStatus::None))
 		{
@@ -117,6 +168,9 @@ void Main()
 		case HTTPAsyncStatus::Canceled:
 			font(U"Canceled").drawAt(Scene::Center() + Point(0, 100));
 			break;
+		case HTTPAsyncStatus::TimedOut:
+			font(U"Timed out").drawAt(Scene::Center() + Point(0, 100));
+			break;
 		case HTTPAsyncStatus::Succeeded:
 			font(U"Done!").drawAt(Scene::Center() + Point(0, 100));
 			break;
@@ -124,6 +178,16 @@ void Main()
 			break;
 		}
 
+		// 統計
+		{
+			const HTTPMetricsSnapshot metrics = HTTPMetrics::GetSnapshot();
+
+			metricsFont(U"in flight: {} / succeeded: {} / failed: {} / canceled: {}"_fmt(metrics.inFlightRequests,
+				metrics.requestsSucceeded, metrics.requestsFailed, metrics.requestsCanceled)).draw(10, 10);
+			metricsFont(U"received: {} bytes / TTFB p50: {} ms"_fmt(metrics.bytesReceived,
+				metrics.ttfbLatency.percentileMs(0.5).value_or(0))).draw(10, 30);
+		}
+
 		if (MouseR.down())
 		{
 			task.cancelTask();
@@ -146,6 +210,241 @@ void Main()
 
 	}
 
+# elif 0 && defined(__cpp_impl_coroutine)
+
+	//
+	// HTTP GET - Coroutine
+	//
+
+	Array<String> log;
+
+	// co_await の後は、System::Update() でメインスレッドで再開する
+	const HTTPCoroutine coroutine = DownloadAssets(log);
+
+	while (System::Update())
+	{
+		ClearPrint();
+
+		for (const auto& line : log)
+		{
+			Print << line;
+		}
+
+		if (coroutine.isDone())
+		{
+			Print << U"Done!";
+		}
+	}
+
+# elif 0
+
+	//
+	// HTTP GET - JSON Stream
+	//
+
+	// 受信した配列の要素を、ダウンロードの完了を待たずに 1 つずつ受け取る
+	std::atomic<int32> count = 0;
+
+	AsyncHTTPTask task = SimpleHTTP::GetJSONStreamAsync(U"https://httpbin.org/stream/100", {}, HTTPJSONStreamFormat::NDJSON,
+		[&count](const JSONValue&) { ++count; });
+
+	while (System::Update())
+	{
+		ClearPrint();
+		Print << U"elements: {}"_fmt(count.load());
+
+		if (task.currentStatus() == HTTPAsyncStatus::Succeeded)
+		{
+			Print << U"Done!";
+		}
+	}
+
+# elif 0
+
+	//
+	// HTTP POST - multipart/form-data
+	//
+
+	ScreenCapture::SaveCurrentFrame(U"screenshot.png");
+	System::Update();
+
+	// ファイルは送信しながら読み込むため、本文全体をメモリに作らない
+	HTTPForm form;
+	form.addText(U"title", U"Hello, Siv3D!")
+		.addText(U"date", DateTime::Now().format())
+		.addFile(U"screenshot", U"screenshot.png", U"", U"image/png");
+
+	AsyncHTTPTask task = SimpleHTTP::PostFormAsync(U"https://httpbin.org/post", {}, form, U"resultForm.json");
+
+	while (System::Update())
+	{
+		ClearPrint();
+		Print << U"uploaded: {} / {} bytes"_fmt(task.getProgress().uploadNowSize, task.getProgress().uploadTotalSize.value_or(0));
+
+		if (task.isDone())
+		{
+			Print << task.getResponse().getStatusCode();
+		}
+	}
+
+# elif 0
+
+	//
+	// HTTP GET - Server-Sent Events
+	//
+
+	// 10 イベントごとに接続を切り、retry: で 500 ms 後の再接続を指示するローカルのサーバー
+	Benchmark::LoopbackHTTPServer server;
+
+	if (!server.start())
+	{
+		return;
+	}
+
+	HTTPEventStream stream = SimpleHTTP::OpenEventStream(server.eventStreamURL(1000, 10, 500));
+
+	Array<String> log;
+
+	while (System::Update())
+	{
+		// 受信したイベントを毎フレームまとめて取り出す
+		HTTPEvent event;
+
+		while (stream.tryPop(event))
+		{
+			log << U"{}: {}"_fmt(event.type, event.data);
+		}
+
+		ClearPrint();
+		Print << U"reconnects: {}"_fmt(stream.reconnectCount());
+
+		for (const auto& line : log.slice(log.size() - Min<size_t>(log.size(), 20)))
+		{
+			Print << line;
+		}
+	}
+
+# elif 0
+
+	//
+	// Benchmark - File Sink
+	//
+
+	const Array<String> modeNames = { U"Direct", U"WriteBehind", U"MemoryMapped", U"IoUring" };
+
+	for (const auto& result : Benchmark::RunFileSinkBenchmarks())
+	{
+		Print << U"{} ({}): {:.2f} s, CPU {:.2f} s, {:.1f} MB/s, failed {}"_fmt(modeNames[static_cast<size_t>(result.mode)],
+			modeNames[static_cast<size_t>(result.actualMode)], result.wallSec, result.cpuSec, (result.bytesPerSec / (1024 * 1024)), result.failedTransfers);
+	}
+
+	while (System::Update())
+	{
+
+	}
+
+# elif 0
+
+	//
+	// Benchmark - Loopback
+	//
+
+	// libcurl 内部のヒープ確保も数える
+	Benchmark::InitCURLWithAllocationCounter();
+
+	const Array<String> apiNames = { U"Get", U"Post", U"DownloadFile", U"DownloadFileAsync" };
+
+	for (const auto& result : Benchmark::RunHTTPBenchmarks())
+	{
+		Print << U"{} x{}: {:.0f} req/s, p50 {:.2f} ms, p99 {:.2f} ms, {:.1f} MB/s, {} alloc/req, failed {}"_fmt(apiNames[static_cast<size_t>(result.api)],
+			result.concurrency, result.requestsPerSec, result.p50LatencyMs, result.p99LatencyMs, (result.bytesPerSec / (1024 * 1024)),
+			(result.allocationsPerRequest ? U"{:.1f}"_fmt(*result.allocationsPerRequest) : U"-"), result.failedRequests);
+	}
+
+	while (System::Update())
+	{
+
+	}
+
+# elif 0
+
+	//
+	// Benchmark - Unix Domain Socket
+	//
+
+	// 同じリクエストを 127.0.0.1 と Unix ドメインソケットで比べる
+	const Array<String> apiNames = { U"Get", U"Post", U"DownloadFile", U"DownloadFileAsync" };
+	const Array<String> transportNames = { U"TCP", U"Unix" };
+
+	for (const auto& result : Benchmark::RunTransportBenchmarks())
+	{
+		Print << U"{} {} x{}: {:.0f} req/s, p50 {:.3f} ms, p99 {:.3f} ms, failed {}"_fmt(apiNames[static_cast<size_t>(result.api)],
+			transportNames[static_cast<size_t>(result.transport)], result.concurrency, result.requestsPerSec,
+			result.p50LatencyMs, result.p99LatencyMs, result.failedRequests);
+	}
+
+	while (System::Update())
+	{
+
+	}
+
+# elif 0
+
+	//
+	// Benchmark - Priority
+	//
+
+	// 上限を Background の通信で埋めたまま、Interactive の通信が待たされないことを確かめる
+	for (const bool pauseBackground : { false, true })
+	{
+		const auto result = Benchmark::RunPriorityBenchmark(pauseBackground);
+
+		Print << U"pause {}: Interactive p50 {:.2f} ms, max {:.2f} ms, failed {}/{}, Background failed {}/{}"_fmt(result.pauseBackground,
+			result.p50LatencyMs, result.maxLatencyMs, result.interactiveFailed, result.interactiveRequests,
+			result.backgroundFailed, result.backgroundRequests);
+	}
+
+	while (System::Update())
+	{
+
+	}
+
+# elif 0
+
+	//
+	// Benchmark - Event Stream
+	//
+
+	// 接続を切られても、イベントが順番どおりに届き、再接続で Last-Event-ID が送られることを確かめる
+	const auto result = Benchmark::RunEventStreamBenchmark();
+
+	Print << U"{}/{} events, out of order {}, Last-Event-ID mismatches {}, reconnects {}, status {}, {:.2f} s"_fmt(result.received,
+		result.events, result.outOfOrder, result.lastEventIDMismatches, result.reconnects,
+		static_cast<int32>(result.status), result.wallSec);
+
+	while (System::Update())
+	{
+
+	}
+
+# elif 0
+
+	//
+	// Benchmark - Header Parsing
+	//
+
+	for (const auto& result : Benchmark::RunHeaderParsingBenchmarks())
+	{
+		Print << U"{}: {:.0f} ns/response (HeaderCallback {:.0f} ns, HTTPResponse {:.0f} ns), {} alloc/response, mismatches {}"_fmt(result.corpus,
+			result.nsPerResponse, result.callbackNsPerResponse, result.constructorNsPerResponse,
+			(result.allocationsPerResponse ? U"{:.1f}"_fmt(*result.allocationsPerResponse) : U"-"), result.mismatches);
+	}
+
+	while (System::Update())
+	{
+
+	}
+
 # else
 
 	//
@@ -1,5 +1,7 @@
 ﻿#include "HTTPClient.hpp"
 #include "AsyncHTTPTaskImpl.hpp"
+#include "HTTPEngine.hpp"
+#include "HTTPRequest.hpp"
 #define CURL_STATICLIB
 #include <curl/curl.h>
 #include <utility>
@@ -8,16 +10,14 @@ namespace s3d
 {
 	namespace detail
 	{
-		static size_t CallbackWrite(char* ptr, size_t size, size_t nmemb, IWriter* pWriter)
+		struct PostData
 		{
-			const size_t size_bytes = (size * nmemb);
+			const void* src = nullptr;
 
-			pWriter->write(static_cast<const void*>(ptr), size_bytes);
+			size_t size = 0;
+		};
 
-			return size_bytes;
-		}
-
-		static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, String* gotData)
+		size_t HeaderCallback(char* buffer, size_t size, size_t nitems, String* gotData)
 		{
 			const size_t size_bytes = (size * nitems);
 			std::string str;
@@ -26,32 +26,91 @@ namespace s3d
 
 			return size_bytes;
 		}
+	}
 
-		static int XferInfo(HTTPProgress* progress, curl_off_t dlTotal, curl_off_t dlNow, curl_off_t ulTotal, curl_off_t ulNow)
+	namespace detail
+	{
+		StringView GetURLHost(const URLView url)
 		{
-			progress->downloadNowSize = static_cast<int64>(dlNow);
-			progress->uploadNowSize = static_cast<int64>(ulNow);
+			size_t begin = url.find(U"://");
+			begin = ((begin == URLView::npos) ? 0 : (begin + 3));
+
+			size_t end = begin;
+
+			while ((end < url.size()) && (url[end] != U'/') && (url[end] != U'?') && (url[end] != U'#'))
+			{
+				++end;
+			}
+
+			URLView host = url.substr(begin, (end - begin));
+
+			// ユーザー情報を除く
+			if (const size_t at = host.rfind(U'@'); at != URLView::npos)
+			{
+				host = host.substr(at + 1);
+			}
+
+			return host;
+		}
 
-			if (dlTotal != 0L)
+		HTTPAsyncStatus GetResultStatus(const HTTPResponse& response, const bool cancelRequested)
+		{
+			if (response.getError() == HTTPError::None)
+			{
+				return HTTPAsyncStatus::Succeeded;
+			}
+			else if ((response.getError() == HTTPError::Transfer) && cancelRequested)
 			{
-				progress->downloadTotalSize = static_cast<int64>(dlTotal);
+				return HTTPAsyncStatus::Canceled;
 			}
-			if (ulTotal != 0L)
+			else if (response.getError() == HTTPError::TimedOut)
 			{
-				progress->downloadTotalSize = static_cast<int64>(ulTotal);
+				return HTTPAsyncStatus::TimedOut;
 			}
+			else
+			{
+				return HTTPAsyncStatus::Failed;
+			}
+		}
 
-			if (progress->cancelCommunication)
+		static HTTPResponse PerformRequest(const URLView url, const HTTPHeader& header, const PostData* post, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+		{
+			const auto transfer = std::make_shared<HTTPEngineTransfer>(url, header, options,
+				[path = FilePath(saveFilePath), options]() { return CreateFileSink(path, options); });
+
+			if (post)
 			{
-				return 1;
+				transfer->post = true;
+				transfer->postData = post->src;
+				transfer->postSize = post->size;
 			}
 
-			return 0;
+			return PerformTransfer(transfer);
+		}
+
+		static std::shared_ptr<HTTPEngineTransfer> CreateFormTransfer(const URLView url, const HTTPHeader& header, const HTTPForm& form, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+		{
+			const auto transfer = std::make_shared<HTTPEngineTransfer>(url, header, options,
+				[path = FilePath(saveFilePath), options]() { return CreateFileSink(path, options); });
+			transfer->post = true;
+			transfer->form = std::make_shared<const HTTPForm>(form);
+
+			return transfer;
+		}
+
+		static std::shared_ptr<HTTPEngineTransfer> CreateMirrorTransfer(const Array<URL>& urls, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+		{
+			const auto transfer = std::make_shared<HTTPEngineTransfer>((urls.isEmpty() ? URLView{} : URLView(urls.front())), HTTPHeader{}, options,
+				[path = FilePath(saveFilePath), options]() { return CreateFileSink(path, options); });
+			transfer->mirrors = urls;
+
+			return transfer;
 		}
 	}
 
-	HTTPResponse::HTTPResponse(const String& header)
+	HTTPResponse::HTTPResponse(const String& header, const String& digest)
 		: m_header(header)
+		, m_digest(digest)
 	{
 		if (m_header.isEmpty())
 		{
@@ -64,16 +123,17 @@ namespace s3d
 			return;
 		}
 
-		int Block = 0, swapBlock = 0;
+		// リダイレクトや 100 Continue で複数のレスポンスヘッダーが含まれる場合は、最後のステータスラインを使う
+		// chunked のトレーラーもヘッダーとして渡されるため、空行の後の HTTP/ で始まる行だけをステータスラインとみなす
+		size_t statusLine = 0;
 
-		for (int i = 0; i < splitStr.size(); i++) {
-			if (splitStr.at(i).size() == 1 && splitStr.at(i) == U"\r") {
-				Block = i;
-				std::swap(Block,swapBlock);
+		for (size_t i = 1; i < splitStr.size(); i++) {
+			if (splitStr.at(i - 1) == U"\r" && splitStr.at(i).starts_with(U"HTTP/")) {
+				statusLine = i;
 			}
 		}
 
-		const Array<String> splitStr2 = splitStr.at(Block+1).split(' ');
+		const Array<String> splitStr2 = splitStr.at(statusLine).split(' ');
 		if (splitStr2.size() < 2)
 		{
 			return;
@@ -82,6 +142,11 @@ namespace s3d
 		m_statusCode = static_cast<HTTPResponseStatusCode>(ParseOr<int32>(splitStr2[1], 0));
 	}
 
+	HTTPResponse::HTTPResponse(const HTTPError error)
+		: m_error(error)
+	{
+	}
+
 	bool HTTPResponse::isValid() const
 	{
 		return m_statusCode != HTTPResponseStatusCode::Invalid;
@@ -102,6 +167,16 @@ namespace s3d
 		return m_statusCode;
 	}
 
+	HTTPError HTTPResponse::getError() const
+	{
+		return m_error;
+	}
+
+	const String& HTTPResponse::getDigest() const
+	{
+		return m_digest;
+	}
+
 	HTTPProgress::HTTPProgress(URLView url)
 		: url(url)
 	{
@@ -132,19 +207,24 @@ namespace s3d
 	{
 	}
 
-	AsyncHTTPTask::AsyncHTTPTask(URLView url, FilePathView path, bool autoFollowLocation)
-		: pImpl(std::make_shared<AsyncHTTPTaskImpl>(url, path, autoFollowLocation))
+	AsyncHTTPTask::AsyncHTTPTask(const URLView url, const HTTPHeader& header, const FilePathView path, const HTTPRequestOptions& options)
+		: pImpl(std::make_shared<AsyncHTTPTaskImpl>(url, header, path, options))
+	{
+	}
+
+	AsyncHTTPTask::AsyncHTTPTask(const Array<URL>& urls, const FilePathView path, const HTTPRequestOptions& options)
+		: pImpl(std::make_shared<AsyncHTTPTaskImpl>(urls, path, options))
+	{
+	}
+
+	AsyncHTTPTask::AsyncHTTPTask(const std::shared_ptr<detail::HTTPEngineTransfer>& transfer)
+		: pImpl(std::make_shared<AsyncHTTPTaskImpl>(transfer))
 	{
 	}
 
 	AsyncHTTPTask::~AsyncHTTPTask()
 	{
-		if (currentStatus() == HTTPAsyncStatus::Working)
-		{
-			cancelTask();
-			//libcurl側でfailするのでログ出力はそれに任せてもよいかも知れない
-			LOG_FAIL(U"Cancel of Download.");
-		}
+		// コピーは AsyncHTTPTaskImpl を共有する。通信の中止は最後のコピーが破棄されたときに ~AsyncHTTPTaskImpl で行う
 	}
 
 	const HTTPProgress& AsyncHTTPTask::getProgress() const
@@ -167,284 +247,266 @@ namespace s3d
 		pImpl->cancelTask();
 	}
 
-	bool AsyncHTTPTask::isDone()
+	void AsyncHTTPTask::setBandwidthLimit(const int64 maxRecvBytesPerSec, const int64 maxSendBytesPerSec)
 	{
-		return pImpl->isDone();
+		pImpl->setBandwidthLimit(maxRecvBytesPerSec, maxSendBytesPerSec);
 	}
 
-	bool SimpleHTTP::InitCURL()
+	AsyncHTTPTask& AsyncHTTPTask::resumeOn(const HTTPExecutor executor)
 	{
-		return (::CURLE_OK == ::curl_global_init(CURL_GLOBAL_ALL));
-	}
+		pImpl->resumeOn(executor);
 
-	void SimpleHTTP::CleanupCURL()
-	{
-		::curl_global_cleanup();
+		return *this;
 	}
 
-	HTTPResponse SimpleHTTP::DownloadFile(const URLView url, FilePathView saveFilePath, bool autoFollowRocation)
+	AsyncHTTPTask& AsyncHTTPTask::then(std::function<void(const HTTPResponse&)> callback, const HTTPExecutor executor)
 	{
+		pImpl->then(std::move(callback), executor);
 
-		BinaryWriter writer(saveFilePath);
-		{
-			if (!writer)
-			{
-				return HTTPResponse{};
-			}
-		}
-
-		::CURL* curl = ::curl_easy_init();
-		{
-			if (!curl)
-			{
-				return HTTPResponse{};
-			}
-		}
+		return *this;
+	}
 
-		const std::string urlUTF8 = Unicode::ToUTF8(url);
-		::curl_easy_setopt(curl, ::CURLOPT_URL, urlUTF8.c_str());
+	bool AsyncHTTPTask::setContinuation(void (*callback)(void*), void* context)
+	{
+		return pImpl->setContinuation(callback, context);
+	}
 
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEFUNCTION, detail::CallbackWrite);
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEDATA, &writer);
+	bool AsyncHTTPTask::isFinished() const
+	{
+		return pImpl->isFinished();
+	}
 
-		// レスポンスヘッダーの設定
-		String headerString;
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERFUNCTION, detail::HeaderCallback);
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERDATA, &headerString);
-		}
+	const HTTPResponse& AsyncHTTPTask::getFinishedResponse() const
+	{
+		return pImpl->getFinishedResponse();
+	}
 
-		if (autoFollowRocation) {
-			::curl_easy_setopt(curl, ::CURLOPT_FOLLOWLOCATION, 1L);
-		}
+	bool AsyncHTTPTask::isDone()
+	{
+		return pImpl->isDone();
+	}
 
-		const ::CURLcode result = ::curl_easy_perform(curl);
-		::curl_easy_cleanup(curl);
+	HTTPCancellationToken::HTTPCancellationToken()
+		: m_canceled(std::make_shared<std::atomic<bool>>(false))
+	{
+	}
 
-		if (result != ::CURLE_OK)
+	void HTTPCancellationToken::cancel() const
+	{
+		if (m_canceled->exchange(true))
 		{
-			LOG_FAIL(U"curl failed (CURLcode: {})"_fmt(result));
-			writer.clear();
-			return HTTPResponse{};
+			return;
 		}
 
-		return HTTPResponse(headerString);
+		// 進行状況の通知や HTTPEngine の定期的な確認を待たずに、すぐに中断させる
+		detail::WakeEngine();
 	}
 
-	AsyncHTTPTask SimpleHTTP::DownloadFileAsync(URLView url, FilePathView saveFilePath, bool autoFollowRocation)
+	bool HTTPCancellationToken::isCanceled() const noexcept
 	{
-		return AsyncHTTPTask(url, saveFilePath, autoFollowRocation);
+		return m_canceled->load(std::memory_order_relaxed);
 	}
 
-	HTTPResponse SimpleHTTP::Get(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, bool autoFollowRocation)
+	bool SimpleHTTP::InitCURL()
 	{
-		BinaryWriter writer(saveFilePath);
+		if (::CURLE_OK != ::curl_global_init(CURL_GLOBAL_ALL))
 		{
-			if (!writer)
-			{
-				return HTTPResponse{};
-			}
+			return false;
 		}
 
-		::CURL* curl = ::curl_easy_init();
-		{
-			if (!curl)
-			{
-				return HTTPResponse{};
-			}
-		}
+		detail::RegisterExecutorAddon();
 
-		// ヘッダの追加
-		::curl_slist* header_slist = nullptr;
+		return true;
+	}
 
-		for (auto [f, s] : header)
-		{
-			const std::string text = U"{}: {}"_fmt(f, s).toUTF8();
-			header_slist = ::curl_slist_append(header_slist, text.c_str());
-		}
+	void SimpleHTTP::CleanupCURL()
+	{
+		detail::ShutdownEngine();
 
-		::curl_easy_setopt(curl, ::CURLOPT_HTTPHEADER, header_slist);
+		detail::ShutdownExecutors();
 
-		const std::string urlUTF8 = Unicode::ToUTF8(url);
-		::curl_easy_setopt(curl, ::CURLOPT_URL, urlUTF8.c_str());
+		::curl_global_cleanup();
+	}
 
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEFUNCTION, detail::CallbackWrite);
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEDATA, &writer);
+	HTTPResponse SimpleHTTP::DownloadFile(const URLView url, const FilePathView saveFilePath, const bool autoFollowLocation)
+	{
+		HTTPRequestOptions options;
+		options.autoFollowLocation = autoFollowLocation;
 
-		// レスポンスヘッダーの設定
-		String headerString;
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERFUNCTION, detail::HeaderCallback);
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERDATA, &headerString);
-		}
+		return DownloadFile(url, saveFilePath, options);
+	}
 
-		if (autoFollowRocation)
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_FOLLOWLOCATION, 1L);
-		}
+	HTTPResponse SimpleHTTP::DownloadFile(const URLView url, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return detail::PerformRequest(url, HTTPHeader{}, nullptr, saveFilePath, options);
+	}
 
-		const ::CURLcode result = ::curl_easy_perform(curl);
-		::curl_easy_cleanup(curl);
-		::curl_slist_free_all(header_slist);
+	AsyncHTTPTask SimpleHTTP::DownloadFileAsync(const URLView url, const FilePathView saveFilePath, const bool autoFollowLocation)
+	{
+		HTTPRequestOptions options;
+		options.autoFollowLocation = autoFollowLocation;
 
-		if (result != ::CURLE_OK)
-		{
-			LOG_FAIL(U"curl failed (CURLcode: {})"_fmt(result));
-			writer.clear();
-			return HTTPResponse{};
-		}
+		return DownloadFileAsync(url, saveFilePath, options);
+	}
 
-		return HTTPResponse(headerString);
+	AsyncHTTPTask SimpleHTTP::DownloadFileAsync(const URLView url, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return AsyncHTTPTask(url, HTTPHeader{}, saveFilePath, options);
 	}
 
-	HTTPResponse SimpleHTTP::Post(const URLView url, const HTTPHeader& header, const void* src, size_t size, const FilePathView saveFilePath, bool autoFollowRocation)
+	HTTPResponse SimpleHTTP::DownloadFile(const Array<URL>& urls, const FilePathView saveFilePath, const HTTPRequestOptions& options)
 	{
-		BinaryWriter writer(saveFilePath);
-		{
-			if (!writer)
-			{
-				return HTTPResponse{};
-			}
-		}
+		return detail::PerformTransfer(detail::CreateMirrorTransfer(urls, saveFilePath, options));
+	}
 
-		::CURL* curl = ::curl_easy_init();
-		{
-			if (!curl)
-			{
-				return HTTPResponse{};
-			}
-		}
+	AsyncHTTPTask SimpleHTTP::DownloadFileAsync(const Array<URL>& urls, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return AsyncHTTPTask(urls, saveFilePath, options);
+	}
 
-		// ヘッダの追加
-		::curl_slist* header_slist = nullptr;
+	HTTPResponse SimpleHTTP::Get(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, const bool autoFollowLocation)
+	{
+		HTTPRequestOptions options;
+		options.autoFollowLocation = autoFollowLocation;
 
-		for (auto [f, s] : header)
-		{
-			const std::string text = U"{}: {}"_fmt(f, s).toUTF8();
-			header_slist = ::curl_slist_append(header_slist, text.c_str());
-		}
+		return Get(url, header, saveFilePath, options);
+	}
 
-		::curl_easy_setopt(curl, ::CURLOPT_HTTPHEADER, header_slist);
+	HTTPResponse SimpleHTTP::Get(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return detail::PerformRequest(url, header, nullptr, saveFilePath, options);
+	}
 
-		const std::string urlUTF8 = Unicode::ToUTF8(url);
-		::curl_easy_setopt(curl, ::CURLOPT_URL, urlUTF8.c_str());
+	AsyncHTTPTask SimpleHTTP::GetAsync(const URLView url, const HTTPHeader& header, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return AsyncHTTPTask(url, header, saveFilePath, options);
+	}
 
-		// POST
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_POST, 1L);
-			::curl_easy_setopt(curl, ::CURLOPT_POSTFIELDS, const_cast<char*>(static_cast<const char*>(src)));
-			::curl_easy_setopt(curl, ::CURLOPT_POSTFIELDSIZE, static_cast<long>(size));
-		}
+	AsyncHTTPTask SimpleHTTP::GetJSONStreamAsync(const URLView url, const HTTPHeader& header, const HTTPJSONStreamFormat format, std::function<void(const JSONValue&)> onElement, const HTTPRequestOptions& options)
+	{
+		const auto consumer = std::make_shared<detail::JSONStreamFileSink::Consumer>();
+		consumer->format = format;
+		consumer->onElement = std::move(onElement);
 
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEFUNCTION, detail::CallbackWrite);
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEDATA, &writer);
+		return AsyncHTTPTask(std::make_shared<detail::HTTPEngineTransfer>(url, header, options,
+			[consumer]() { return std::make_unique<detail::JSONStreamFileSink>(consumer); }));
+	}
 
-		// レスポンスヘッダーの設定
-		String headerString;
+	HTTPResponse SimpleHTTP::Post(const URLView url, const HTTPHeader& header, const void* src, const size_t size, const FilePathView saveFilePath, const bool autoFollowLocation)
+	{
+		HTTPRequestOptions options;
+		options.autoFollowLocation = autoFollowLocation;
 
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERFUNCTION, detail::HeaderCallback);
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERDATA, &headerString);
-		}
+		return Post(url, header, src, size, saveFilePath, options);
+	}
 
-		if (autoFollowRocation) {
-			::curl_easy_setopt(curl, ::CURLOPT_FOLLOWLOCATION, 1L);
-		}
+	HTTPResponse SimpleHTTP::Post(const URLView url, const HTTPHeader& header, const void* src, const size_t size, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		const detail::PostData post{ src, size };
 
-		const ::CURLcode result = ::curl_easy_perform(curl);
-		::curl_easy_cleanup(curl);
-		::curl_slist_free_all(header_slist);
+		return detail::PerformRequest(url, header, &post, saveFilePath, options);
+	}
 
-		if (result != ::CURLE_OK)
-		{
-			LOG_FAIL(U"curl failed (CURLcode: {})"_fmt(result));
-			writer.clear();
-			return HTTPResponse{};
-		}
+	HTTPResponse SimpleHTTP::PostForm(const URLView url, const HTTPHeader& header, const HTTPForm& form, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return detail::PerformTransfer(detail::CreateFormTransfer(url, header, form, saveFilePath, options));
+	}
 
-		return HTTPResponse(headerString);
+	AsyncHTTPTask SimpleHTTP::PostFormAsync(const URLView url, const HTTPHeader& header, const HTTPForm& form, const FilePathView saveFilePath, const HTTPRequestOptions& options)
+	{
+		return AsyncHTTPTask(detail::CreateFormTransfer(url, header, form, saveFilePath, options));
 	}
 
-	//AsyncHTTPTaskImpl.hpp
+	HTTPForm& HTTPForm::addText(const StringView name, const StringView value)
+	{
+		const std::string utf8 = Unicode::ToUTF8(value);
 
-	HTTPResponse AsyncHTTPTask::AsyncHTTPTaskImpl::innerDownloadTask()
+		return addData(name, Array<uint8>(utf8.begin(), utf8.end()));
+	}
+
+	HTTPForm& HTTPForm::addData(const StringView name, Array<uint8> data, const StringView fileName, const StringView contentType)
 	{
-		m_progressValue.status = HTTPAsyncStatus::Working;
-		{
-			if (!m_writer)
-			{
-				m_progressValue.status = HTTPAsyncStatus::Failed;
-				return HTTPResponse{};
-			}
-		}
+		Part part;
+		part.name = String(name);
+		part.fileName = String(fileName);
+		part.contentType = String(contentType);
+		part.data = std::make_shared<const Array<uint8>>(std::move(data));
+		m_parts.push_back(std::move(part));
 
-		::CURL* curl = ::curl_easy_init();
-		{
-			if (!curl)
-			{
-				m_progressValue.status = HTTPAsyncStatus::Failed;
-				return HTTPResponse{};
-			}
-		}
+		return *this;
+	}
 
-		const std::string urlUTF8 = Unicode::ToUTF8(m_progressValue.url);
-		::curl_easy_setopt(curl, ::CURLOPT_URL, urlUTF8.c_str());
+	HTTPForm& HTTPForm::addFile(const StringView name, const FilePathView path, const StringView fileName, const StringView contentType)
+	{
+		Part part;
+		part.name = String(name);
+		part.fileName = (fileName.isEmpty() ? FileSystem::FileName(path) : String(fileName));
+		part.contentType = String(contentType);
+		part.path = FilePath(path);
+		m_parts.push_back(std::move(part));
 
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEFUNCTION, detail::CallbackWrite);
-		::curl_easy_setopt(curl, ::CURLOPT_WRITEDATA, &m_writer);
+		return *this;
+	}
 
-		::curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, detail::XferInfo);
-		::curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &m_progressValue);
+	HTTPForm& HTTPForm::addReader(const StringView name, const std::shared_ptr<IReader>& reader, const StringView fileName, const StringView contentType)
+	{
+		Part part;
+		part.name = String(name);
+		part.fileName = String(fileName);
+		part.contentType = String(contentType);
+		part.reader = reader;
+		m_parts.push_back(std::move(part));
 
-		::curl_easy_setopt(curl, ::CURLOPT_NOPROGRESS, 0L);
+		return *this;
+	}
 
-		// レスポンスヘッダーの設定
-		String headerString;
-		{
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERFUNCTION, detail::HeaderCallback);
-			::curl_easy_setopt(curl, ::CURLOPT_HEADERDATA, &headerString);
-		}
+	const Array<HTTPForm::Part>& HTTPForm::parts() const noexcept
+	{
+		return m_parts;
+	}
 
-		if (m_autoFollowLocation) {
-			::curl_easy_setopt(curl, ::CURLOPT_FOLLOWLOCATION, 1L);
-		}
+	bool HTTPForm::isEmpty() const noexcept
+	{
+		return m_parts.isEmpty();
+	}
 
-		const ::CURLcode result = ::curl_easy_perform(curl);
-		::curl_easy_cleanup(curl);
+	//AsyncHTTPTaskImpl.hpp
 
-		if (result != ::CURLE_OK)
-		{
-			LOG_FAIL(U"curl failed (CURLcode: {})"_fmt(result));
-			m_writer.clear();
-			if (m_progressValue.cancelCommunication)
-			{
-				m_progressValue.status = HTTPAsyncStatus::Canceled;
-			}
-			else
-			{
-				m_progressValue.status = HTTPAsyncStatus::Failed;
-			}
-			return HTTPResponse{};
-		}
+	AsyncHTTPTask::AsyncHTTPTaskImpl::AsyncHTTPTaskImpl(URLView url, const HTTPHeader& header, FilePathView path, const HTTPRequestOptions& options)
+		: m_progressValue(url)
+		, m_response()
+		, m_transfer(std::make_shared<detail::HTTPEngineTransfer>(url, header, options,
+			[path = FilePath(path), options]() { return detail::CreateFileSink(path, options); }))
+	{
+		m_transfer->reportProgress = true;
 
-		m_writer.close();
-		m_progressValue.status = HTTPAsyncStatus::Succeeded;
-		return HTTPResponse(headerString);
+		detail::SubmitTransfer(m_transfer);
 	}
 
-	AsyncHTTPTask::AsyncHTTPTaskImpl::AsyncHTTPTaskImpl(URLView url, FilePathView path, bool autoFollowLocation)
-		: m_progressValue(url)
+	AsyncHTTPTask::AsyncHTTPTaskImpl::AsyncHTTPTaskImpl(const Array<URL>& urls, FilePathView path, const HTTPRequestOptions& options)
+		: m_progressValue(urls.isEmpty() ? URLView{} : URLView(urls.front()))
 		, m_response()
-		, m_writer(path)
-		, m_task()
-		, m_autoFollowLocation(autoFollowLocation)
+		, m_transfer(detail::CreateMirrorTransfer(urls, path, options))
 	{
-		m_task = CreateConcurrentTask(&AsyncHTTPTask::AsyncHTTPTaskImpl::innerDownloadTask, this);
+		m_transfer->reportProgress = true;
+
+		detail::SubmitTransfer(m_transfer);
+	}
+
+	AsyncHTTPTask::AsyncHTTPTaskImpl::AsyncHTTPTaskImpl(const std::shared_ptr<detail::HTTPEngineTransfer>& transfer)
+		: m_progressValue(transfer->url)
+		, m_response()
+		, m_transfer(transfer)
+	{
+		m_transfer->reportProgress = true;
+
+		detail::SubmitTransfer(m_transfer);
 	}
 
 	AsyncHTTPTask::AsyncHTTPTaskImpl::~AsyncHTTPTaskImpl()
 	{
-		if (currentStatus() == HTTPAsyncStatus::Working)
+		// then() で処理を登録した場合は通信を続ける
+		if ((currentStatus() == HTTPAsyncStatus::Working) && !m_hasThen)
 		{
 			cancelTask();
 			//libcurl側でfailするのでログ出力はそれに任せてもよいかも知れない
@@ -454,6 +516,12 @@ namespace s3d
 
 	const HTTPProgress& AsyncHTTPTask::AsyncHTTPTaskImpl::getProgress() const
 	{
+		// HTTPEngine のスレッドが書き込んでいる値を、呼び出したスレッドのコピーに読み込む
+		if (m_transfer)
+		{
+			m_transfer->progress.load(m_progressValue);
+		}
+
 		return m_progressValue;
 	}
 
@@ -464,28 +532,85 @@ namespace s3d
 
 	const HTTPAsyncStatus& AsyncHTTPTask::AsyncHTTPTaskImpl::currentStatus() const
 	{
+		if (m_transfer)
+		{
+			m_progressValue.status = m_transfer->progress.status.load(std::memory_order_acquire);
+		}
+
 		return m_progressValue.status;
 	}
 
 	void AsyncHTTPTask::AsyncHTTPTaskImpl::cancelTask()
 	{
-		m_progressValue.cancelCommunication = true;
+		if (!m_transfer)
+		{
+			return;
+		}
+
+		m_transfer->requestCancel();
+
+		detail::WakeEngine();
+	}
+
+	void AsyncHTTPTask::AsyncHTTPTaskImpl::setBandwidthLimit(const int64 maxRecvBytesPerSec, const int64 maxSendBytesPerSec)
+	{
+		if (!m_transfer)
+		{
+			return;
+		}
+
+		m_transfer->maxRecvBytesPerSec = maxRecvBytesPerSec;
+		m_transfer->maxSendBytesPerSec = maxSendBytesPerSec;
+
+		detail::WakeEngine();
 	}
 
-	bool AsyncHTTPTask::AsyncHTTPTaskImpl::isDone()
+	void AsyncHTTPTask::AsyncHTTPTaskImpl::resumeOn(const HTTPExecutor executor)
+	{
+		m_executor = executor;
+	}
+
+	void AsyncHTTPTask::AsyncHTTPTaskImpl::then(std::function<void(const HTTPResponse&)> callback, const HTTPExecutor executor)
 	{
-		//Linuxでvaildを見る前にis_doneを見るとabortするので順序を意図的につけてます
-		if (!m_task.valid())
+		if (!m_transfer)
+		{
+			return;
+		}
+
+		m_transfer->then(std::move(callback), executor);
+		m_hasThen = true;
+	}
+
+	bool AsyncHTTPTask::AsyncHTTPTaskImpl::setContinuation(void (*callback)(void*), void* context)
+	{
+		if (!m_transfer)
 		{
 			return false;
 		}
 
-		if (!m_task.is_done())
+		return m_transfer->setContinuation(m_executor, callback, context);
+	}
+
+	bool AsyncHTTPTask::AsyncHTTPTaskImpl::isFinished() const
+	{
+		return (!m_transfer || m_transfer->isFinished());
+	}
+
+	const HTTPResponse& AsyncHTTPTask::AsyncHTTPTaskImpl::getFinishedResponse() const
+	{
+		return (m_transfer ? m_transfer->getResponse() : m_response);
+	}
+
+	bool AsyncHTTPTask::AsyncHTTPTaskImpl::isDone()
+	{
+		if (!m_transfer || m_delivered || !m_transfer->isFinished())
 		{
 			return false;
 		}
 
-		m_response = m_task.get();
+		m_response = m_transfer->getResponse();
+		m_delivered = true;
+		m_transfer->trace.delivered();
 		return true;
 	}
 
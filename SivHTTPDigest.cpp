@@ -0,0 +1,370 @@
+﻿# include <cstring>
+# include "HTTPDigest.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		static constexpr uint32 SHA256RoundConstants[64] =
+		{
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		static constexpr uint32 RotateRight32(const uint32 x, const int n)
+		{
+			return ((x >> n) | (x << (32 - n)));
+		}
+
+		static constexpr uint64 RotateLeft64(const uint64 x, const int n)
+		{
+			return ((x << n) | (x >> (64 - n)));
+		}
+
+		static uint64 ReadLE64(const uint8* p)
+		{
+			uint64 result = 0;
+
+			for (int i = 7; 0 <= i; --i)
+			{
+				result = ((result << 8) | p[i]);
+			}
+
+			return result;
+		}
+
+		static uint32 ReadLE32(const uint8* p)
+		{
+			return (static_cast<uint32>(p[0]) | (static_cast<uint32>(p[1]) << 8) | (static_cast<uint32>(p[2]) << 16) | (static_cast<uint32>(p[3]) << 24));
+		}
+
+		constexpr uint64 XXH64Prime1 = 0x9E3779B185EBCA87ULL;
+		constexpr uint64 XXH64Prime2 = 0xC2B2AE3D27D4EB4FULL;
+		constexpr uint64 XXH64Prime3 = 0x165667B19E3779F9ULL;
+		constexpr uint64 XXH64Prime4 = 0x85EBCA77C2B2AE63ULL;
+		constexpr uint64 XXH64Prime5 = 0x27D4EB2F165667C5ULL;
+
+		static constexpr uint64 XXH64Round(uint64 acc, const uint64 input)
+		{
+			acc += (input * XXH64Prime2);
+			acc = RotateLeft64(acc, 31);
+			return (acc * XXH64Prime1);
+		}
+
+		static constexpr uint64 XXH64MergeRound(uint64 acc, const uint64 value)
+		{
+			acc ^= XXH64Round(0, value);
+			return ((acc * XXH64Prime1) + XXH64Prime4);
+		}
+	}
+
+	//SHA256Hasher
+
+	detail::SHA256Hasher::SHA256Hasher()
+		: m_state{ { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 } }
+		, m_block{}
+	{
+	}
+
+	void detail::SHA256Hasher::transform(const uint8* block)
+	{
+		uint32 w[64];
+
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = ((static_cast<uint32>(block[i * 4]) << 24) | (static_cast<uint32>(block[i * 4 + 1]) << 16)
+				| (static_cast<uint32>(block[i * 4 + 2]) << 8) | static_cast<uint32>(block[i * 4 + 3]));
+		}
+
+		for (int i = 16; i < 64; ++i)
+		{
+			const uint32 s0 = (RotateRight32(w[i - 15], 7) ^ RotateRight32(w[i - 15], 18) ^ (w[i - 15] >> 3));
+			const uint32 s1 = (RotateRight32(w[i - 2], 17) ^ RotateRight32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+			w[i] = (w[i - 16] + s0 + w[i - 7] + s1);
+		}
+
+		uint32 a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+		uint32 e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+
+		for (int i = 0; i < 64; ++i)
+		{
+			const uint32 S1 = (RotateRight32(e, 6) ^ RotateRight32(e, 11) ^ RotateRight32(e, 25));
+			const uint32 ch = ((e & f) ^ (~e & g));
+			const uint32 t1 = (h + S1 + ch + SHA256RoundConstants[i] + w[i]);
+			const uint32 S0 = (RotateRight32(a, 2) ^ RotateRight32(a, 13) ^ RotateRight32(a, 22));
+			const uint32 maj = ((a & b) ^ (a & c) ^ (b & c));
+			const uint32 t2 = (S0 + maj);
+
+			h = g;
+			g = f;
+			f = e;
+			e = (d + t1);
+			d = c;
+			c = b;
+			b = a;
+			a = (t1 + t2);
+		}
+
+		m_state[0] += a;
+		m_state[1] += b;
+		m_state[2] += c;
+		m_state[3] += d;
+		m_state[4] += e;
+		m_state[5] += f;
+		m_state[6] += g;
+		m_state[7] += h;
+	}
+
+	void detail::SHA256Hasher::update(const void* data, size_t size)
+	{
+		const uint8* p = static_cast<const uint8*>(data);
+		m_totalSize += size;
+
+		if (m_blockSize)
+		{
+			const size_t toCopy = Min(size, (m_block.size() - m_blockSize));
+			std::memcpy(m_block.data() + m_blockSize, p, toCopy);
+			m_blockSize += toCopy;
+			p += toCopy;
+			size -= toCopy;
+
+			if (m_blockSize < m_block.size())
+			{
+				return;
+			}
+
+			transform(m_block.data());
+			m_blockSize = 0;
+		}
+
+		for (; m_block.size() <= size; p += m_block.size(), size -= m_block.size())
+		{
+			transform(p);
+		}
+
+		std::memcpy(m_block.data(), p, size);
+		m_blockSize = size;
+	}
+
+	std::array<uint8, 32> detail::SHA256Hasher::finalize()
+	{
+		const uint64 totalBits = (m_totalSize * 8);
+
+		const uint8 terminator = 0x80;
+		update(&terminator, 1);
+
+		const uint8 zero = 0;
+
+		while (m_blockSize != 56)
+		{
+			update(&zero, 1);
+		}
+
+		uint8 length[8];
+
+		for (int i = 0; i < 8; ++i)
+		{
+			length[i] = static_cast<uint8>(totalBits >> (56 - i * 8));
+		}
+
+		update(length, sizeof(length));
+
+		std::array<uint8, 32> result;
+
+		for (int i = 0; i < 8; ++i)
+		{
+			result[i * 4] = static_cast<uint8>(m_state[i] >> 24);
+			result[i * 4 + 1] = static_cast<uint8>(m_state[i] >> 16);
+			result[i * 4 + 2] = static_cast<uint8>(m_state[i] >> 8);
+			result[i * 4 + 3] = static_cast<uint8>(m_state[i]);
+		}
+
+		return result;
+	}
+
+	//XXH64Hasher
+
+	detail::XXH64Hasher::XXH64Hasher()
+		: m_state{ { (XXH64Prime1 + XXH64Prime2), XXH64Prime2, 0, (0 - XXH64Prime1) } }
+		, m_block{}
+	{
+	}
+
+	void detail::XXH64Hasher::update(const void* data, size_t size)
+	{
+		const uint8* p = static_cast<const uint8*>(data);
+		m_totalSize += size;
+
+		if ((m_blockSize + size) < m_block.size())
+		{
+			std::memcpy(m_block.data() + m_blockSize, p, size);
+			m_blockSize += size;
+			return;
+		}
+
+		if (m_blockSize)
+		{
+			const size_t toCopy = (m_block.size() - m_blockSize);
+			std::memcpy(m_block.data() + m_blockSize, p, toCopy);
+			p += toCopy;
+			size -= toCopy;
+
+			for (size_t i = 0; i < 4; ++i)
+			{
+				m_state[i] = XXH64Round(m_state[i], ReadLE64(m_block.data() + i * 8));
+			}
+
+			m_blockSize = 0;
+		}
+
+		for (; m_block.size() <= size; p += m_block.size(), size -= m_block.size())
+		{
+			for (size_t i = 0; i < 4; ++i)
+			{
+				m_state[i] = XXH64Round(m_state[i], ReadLE64(p + i * 8));
+			}
+		}
+
+		std::memcpy(m_block.data(), p, size);
+		m_blockSize = size;
+	}
+
+	uint64 detail::XXH64Hasher::finalize() const
+	{
+		uint64 h;
+
+		if (m_block.size() <= m_totalSize)
+		{
+			h = (RotateLeft64(m_state[0], 1) + RotateLeft64(m_state[1], 7) + RotateLeft64(m_state[2], 12) + RotateLeft64(m_state[3], 18));
+
+			for (size_t i = 0; i < 4; ++i)
+			{
+				h = XXH64MergeRound(h, m_state[i]);
+			}
+		}
+		else
+		{
+			// seed = 0
+			h = XXH64Prime5;
+		}
+
+		h += m_totalSize;
+
+		const uint8* p = m_block.data();
+		size_t size = m_blockSize;
+
+		for (; 8 <= size; p += 8, size -= 8)
+		{
+			h ^= XXH64Round(0, ReadLE64(p));
+			h = ((RotateLeft64(h, 27) * XXH64Prime1) + XXH64Prime4);
+		}
+
+		if (4 <= size)
+		{
+			h ^= (static_cast<uint64>(ReadLE32(p)) * XXH64Prime1);
+			h = ((RotateLeft64(h, 23) * XXH64Prime2) + XXH64Prime3);
+			p += 4;
+			size -= 4;
+		}
+
+		for (; size; ++p, --size)
+		{
+			h ^= (*p * XXH64Prime5);
+			h = (RotateLeft64(h, 11) * XXH64Prime1);
+		}
+
+		h ^= (h >> 33);
+		h *= XXH64Prime2;
+		h ^= (h >> 29);
+		h *= XXH64Prime3;
+		h ^= (h >> 32);
+
+		return h;
+	}
+
+	//HTTPDigester
+
+	detail::HTTPDigester::HTTPDigester(const HTTPDigestType type)
+		: m_type(type)
+	{
+	}
+
+	bool detail::HTTPDigester::isEnabled() const
+	{
+		return (m_type != HTTPDigestType::None);
+	}
+
+	void detail::HTTPDigester::update(const void* data, const size_t size)
+	{
+		switch (m_type)
+		{
+		case HTTPDigestType::SHA256:
+			m_sha256.update(data, size);
+			break;
+		case HTTPDigestType::XXH64:
+			m_xxh64.update(data, size);
+			break;
+		default:
+			break;
+		}
+	}
+
+	String detail::HTTPDigester::finalize()
+	{
+		constexpr char32 Hex[] = U"0123456789abcdef";
+
+		String result;
+
+		switch (m_type)
+		{
+		case HTTPDigestType::SHA256:
+			for (const uint8 byte : m_sha256.finalize())
+			{
+				result.push_back(Hex[byte >> 4]);
+				result.push_back(Hex[byte & 0xF]);
+			}
+			break;
+		case HTTPDigestType::XXH64:
+			{
+				const uint64 value = m_xxh64.finalize();
+
+				for (int i = 15; 0 <= i; --i)
+				{
+					result.push_back(Hex[(value >> (i * 4)) & 0xF]);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+
+		return result;
+	}
+
+	bool detail::DigestEquals(const StringView a, const StringView b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			const char32 ca = ((U'A' <= a[i]) && (a[i] <= U'F')) ? (a[i] + 0x20) : a[i];
+			const char32 cb = ((U'A' <= b[i]) && (b[i] <= U'F')) ? (b[i] + 0x20) : b[i];
+
+			if (ca != cb)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,3603 @@
+﻿#include "HTTPEngine.hpp"
+#include "HTTPDigest.hpp"
+#include "HTTPRequest.hpp"
+#define CURL_STATICLIB
+#include <curl/curl.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <limits>
+#include <map>
+#include <random>
+#include <thread>
+
+#if SIV3D_PLATFORM(WINDOWS)
+#	include <WinSock2.h>
+#else
+#	include <sys/socket.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+namespace s3d
+{
+	namespace detail
+	{
+		namespace
+		{
+			std::atomic<size_t> MaxTransfers = 64;
+
+			std::atomic<size_t> MaxTransfersPerHost = 8;
+
+			std::atomic<bool> PauseBackgroundWhileInteractive = false;
+
+			std::atomic<int64> MaxRecvBytesPerSec = 0;
+
+			std::atomic<int64> MaxSendBytesPerSec = 0;
+
+			struct BandwidthLimit
+			{
+				int64 maxRecvBytesPerSec = 0;
+
+				int64 maxSendBytesPerSec = 0;
+			};
+
+			std::mutex HostBandwidthLimitsMutex;
+
+			HashTable<String, BandwidthLimit> HostBandwidthLimits;
+
+			// HostBandwidthLimits を変更するたびに増やす
+			std::atomic<uint64> HostBandwidthLimitsVersion = 0;
+
+			std::mutex AdaptiveConcurrencyMutex;
+
+			HTTPAdaptiveConcurrency AdaptiveConcurrency;
+
+			// AdaptiveConcurrency を変更するたびに増やす
+			std::atomic<uint64> AdaptiveConcurrencyVersion = 0;
+
+			/// <summary>
+			/// 帯域を制限するためのトークンバケット
+			/// 使った分を後から差し引くため、残量は負になることがあり、負の間は通信を一時停止します。
+			/// </summary>
+			class TokenBucket
+			{
+			private:
+
+				int64 m_bytesPerSec = 0;
+
+				double m_tokens = 0.0;
+
+				// 一度に使える最大の量（0.1 秒分）
+				[[nodiscard]] double capacity() const noexcept
+				{
+					return Max(m_bytesPerSec * 0.1, 16384.0);
+				}
+
+			public:
+
+				void setRate(const int64 bytesPerSec) noexcept
+				{
+					if (bytesPerSec == m_bytesPerSec)
+					{
+						return;
+					}
+
+					m_bytesPerSec = Max<int64>(bytesPerSec, 0);
+					m_tokens = Min(m_tokens, capacity());
+				}
+
+				[[nodiscard]] bool isLimited() const noexcept
+				{
+					return (m_bytesPerSec != 0);
+				}
+
+				void refill(const double elapsedSec) noexcept
+				{
+					if (isLimited())
+					{
+						m_tokens = Min(m_tokens + (m_bytesPerSec * elapsedSec), capacity());
+					}
+				}
+
+				void consume(const int64 size) noexcept
+				{
+					if (isLimited())
+					{
+						m_tokens -= size;
+					}
+				}
+
+				[[nodiscard]] bool isExhausted() const noexcept
+				{
+					return (isLimited() && (m_tokens < 0.0));
+				}
+
+				/// <summary>
+				/// 残量が 0 以上に戻るまでの時間（ミリ秒）
+				/// </summary>
+				[[nodiscard]] int32 refillMillisec() const noexcept
+				{
+					if (!isExhausted())
+					{
+						return 0;
+					}
+
+					return static_cast<int32>(std::ceil((-m_tokens * 1000.0) / m_bytesPerSec));
+				}
+			};
+
+			/// <summary>
+			/// 受信と送信のトークンバケット
+			/// </summary>
+			struct BandwidthBuckets
+			{
+				TokenBucket recv;
+
+				TokenBucket send;
+
+				void setLimit(const BandwidthLimit& limit) noexcept
+				{
+					recv.setRate(limit.maxRecvBytesPerSec);
+					send.setRate(limit.maxSendBytesPerSec);
+				}
+
+				void refill(const double elapsedSec) noexcept
+				{
+					recv.refill(elapsedSec);
+					send.refill(elapsedSec);
+				}
+
+				[[nodiscard]] int32 refillMillisec() const noexcept
+				{
+					return Max(recv.refillMillisec(), send.refillMillisec());
+				}
+			};
+
+			/// <summary>
+			/// HTTPAdaptiveConcurrency に従って、ホストの同時に実行する通信の数の上限を調整します。
+			/// </summary>
+			class ConcurrencyLimiter
+			{
+			private:
+
+				// 直近と長期の TTFB の指数移動平均の、おおよそのサンプル数
+				static constexpr double ShortWindow = 10.0;
+
+				static constexpr double LongWindow = 100.0;
+
+				double m_limit = 1.0;
+
+				double m_shortRttMicrosec = 0.0;
+
+				double m_longRttMicrosec = 0.0;
+
+				// 最後に失敗で上限を下げた時刻
+				int64 m_droppedMicrosec = 0;
+
+				// 最後に上限を参照した時刻
+				int64 m_usedMicrosec = 0;
+
+			public:
+
+				explicit ConcurrencyLimiter(const double initialLimit) noexcept
+					: m_limit(Max(initialLimit, 1.0)) {}
+
+				[[nodiscard]] size_t limit() const noexcept
+				{
+					return static_cast<size_t>(m_limit);
+				}
+
+				[[nodiscard]] int64 usedMicrosec() const noexcept
+				{
+					return m_usedMicrosec;
+				}
+
+				void touch(const int64 nowMicrosec) noexcept
+				{
+					m_usedMicrosec = nowMicrosec;
+				}
+
+				/// <summary>
+				/// 成功した通信の TTFB から上限を調整します。
+				/// </summary>
+				void onSample(const int64 rttMicrosec, const size_t inFlight, const HTTPAdaptiveConcurrency& settings, const size_t maxLimit) noexcept
+				{
+					const double rtt = static_cast<double>(Max<int64>(rttMicrosec, 1));
+
+					if (m_longRttMicrosec == 0.0)
+					{
+						m_shortRttMicrosec = m_longRttMicrosec = rtt;
+					}
+					else
+					{
+						m_shortRttMicrosec += ((rtt - m_shortRttMicrosec) * (2.0 / (ShortWindow + 1.0)));
+						m_longRttMicrosec += ((rtt - m_longRttMicrosec) * (2.0 / (LongWindow + 1.0)));
+
+						// 混雑が解消した後は、長期の平均を早く下げる
+						if (m_longRttMicrosec > (m_shortRttMicrosec * 2.0))
+						{
+							m_longRttMicrosec *= 0.95;
+						}
+					}
+
+					// 上限の半分も使っていない場合、上限を上げる根拠にならない
+					if ((inFlight * 2) < m_limit)
+					{
+						return;
+					}
+
+					const double gradient = Clamp((settings.tolerance * m_longRttMicrosec / m_shortRttMicrosec), 0.5, 1.0);
+					const double newLimit = ((m_limit * gradient) + std::sqrt(m_limit));
+
+					// 上限の数だけ通信が終わるごとに、smoothing の割合だけ近づける
+					const double smoothing = (Clamp(settings.smoothing, 0.0, 1.0) / m_limit);
+
+					setLimit((m_limit * (1.0 - smoothing)) + (newLimit * smoothing), settings, maxLimit);
+				}
+
+				/// <summary>
+				/// 混雑による失敗（429, 503、タイムアウトなど）があった場合に上限を下げます。
+				/// </summary>
+				void onDrop(const int64 nowMicrosec, const HTTPAdaptiveConcurrency& settings, const size_t maxLimit) noexcept
+				{
+					// 同時に失敗した通信で何度も下げないよう、直近の TTFB の間は 1 回だけ下げる
+					if (m_droppedMicrosec && ((nowMicrosec - m_droppedMicrosec) < static_cast<int64>(m_shortRttMicrosec)))
+					{
+						return;
+					}
+
+					m_droppedMicrosec = nowMicrosec;
+					setLimit((m_limit * Clamp(settings.backoffRatio, 0.0, 1.0)), settings, maxLimit);
+				}
+
+				void setLimit(const double limit, const HTTPAdaptiveConcurrency& settings, const size_t maxLimit) noexcept
+				{
+					const double minLimit = static_cast<double>(Max<size_t>(settings.minLimit, 1));
+
+					m_limit = Clamp(limit, minLimit, Max(static_cast<double>(maxLimit), minLimit));
+				}
+			};
+
+			/// <summary>
+			/// ミラーのホストごとの受信の速度と失敗の割合の指数移動平均
+			/// </summary>
+			struct OriginStats
+			{
+				// 受信の速度（バイト/秒）。0 の場合はまだ測っていない
+				double bytesPerSec = 0.0;
+
+				double errorRate = 0.0;
+
+				void addThroughput(const double sample) noexcept
+				{
+					bytesPerSec = ((bytesPerSec == 0.0) ? sample : (bytesPerSec + ((sample - bytesPerSec) * 0.3)));
+				}
+
+				void addResult(const bool failed) noexcept
+				{
+					errorRate += (((failed ? 1.0 : 0.0) - errorRate) * 0.2);
+				}
+
+				/// <summary>
+				/// ミラーを選ぶときの評価値。まだ使ったことのないミラーは試すために高くする
+				/// </summary>
+				[[nodiscard]] double score() const noexcept
+				{
+					if ((bytesPerSec == 0.0) && (errorRate == 0.0))
+					{
+						return 1e18;
+					}
+
+					return (bytesPerSec * (1.0 - errorRate));
+				}
+			};
+
+			// 受信の速度の記録に使う、1 回の通信で受信した最小のバイト数
+			constexpr int64 MinThroughputSampleBytes = (64 << 10);
+
+			constexpr size_t PriorityCount = 3;
+
+			[[nodiscard]] constexpr size_t PriorityIndex(const HTTPPriority priority) noexcept
+			{
+				return static_cast<size_t>(priority);
+			}
+
+			/// <summary>
+			/// HTTP/2 のストリームの重み（1 から 256、既定値は 16）
+			/// </summary>
+			[[nodiscard]] constexpr long StreamWeight(const HTTPPriority priority) noexcept
+			{
+				switch (priority)
+				{
+				case HTTPPriority::Interactive:
+					return 256;
+				case HTTPPriority::Background:
+					return 1;
+				default:
+					return 16;
+				}
+			}
+
+			/// <summary>
+			/// 読み込んだ libcurl が Unix ドメインソケットに対応しているかを返します。
+			/// 同梱の Windows 版 libcurl 7.65.1 は対応しておらず、CURLOPT_UNIX_SOCKET_PATH を設定しても TCP で接続してしまいます。
+			/// </summary>
+			[[nodiscard]] bool SupportsUnixSockets()
+			{
+				static const bool supported = ((::curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_UNIX_SOCKETS) != 0);
+
+				return supported;
+			}
+
+			// 再利用のために保持する easy ハンドルの最大数
+			constexpr size_t MaxIdleHandles = 64;
+
+			// 通信の無くなったホストの、HTTPAdaptiveConcurrency で調整した上限を保持する時間
+			constexpr int64 IdleLimiterMicrosec = (60 * 1'000'000);
+
+			// 通信を控えていた間に溜められるヘッジの数
+			constexpr double MaxHedgeBurst = 10.0;
+
+			// WakeupChannel を作れなかった場合に、キャンセルや新しい通信を確認する間隔
+			constexpr int WakeupPollMillisec = 10;
+
+			/// <summary>
+			/// curl_multi_wait で待機している HTTPEngine のスレッドを起こすためのソケットの組
+			/// libcurl 7.65.1 には curl_multi_wakeup が無いため、読み込み側を extra_fds として渡します。
+			/// </summary>
+			class WakeupChannel
+			{
+			private:
+
+				::curl_socket_t m_read = CURL_SOCKET_BAD;
+
+				::curl_socket_t m_write = CURL_SOCKET_BAD;
+
+				static void Close(const ::curl_socket_t socket)
+				{
+				# if SIV3D_PLATFORM(WINDOWS)
+					::closesocket(socket);
+				# else
+					::close(socket);
+				# endif
+				}
+
+			public:
+
+				WakeupChannel()
+				{
+				# if SIV3D_PLATFORM(WINDOWS)
+
+					// Windows には socketpair が無いため、ループバックの TCP 接続で代用する
+					const ::SOCKET listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+					if (listener == INVALID_SOCKET)
+					{
+						return;
+					}
+
+					::sockaddr_in address = {};
+					address.sin_family = AF_INET;
+					address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+					int addressLength = sizeof(address);
+
+					::SOCKET read = INVALID_SOCKET;
+					::SOCKET write = INVALID_SOCKET;
+
+					if ((::bind(listener, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) == 0)
+						&& (::listen(listener, 1) == 0)
+						&& (::getsockname(listener, reinterpret_cast<::sockaddr*>(&address), &addressLength) == 0))
+					{
+						write = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+						if ((write != INVALID_SOCKET)
+							&& (::connect(write, reinterpret_cast<const ::sockaddr*>(&address), sizeof(address)) == 0))
+						{
+							read = ::accept(listener, nullptr, nullptr);
+						}
+					}
+
+					::closesocket(listener);
+
+					// 途中で失敗した場合は、接続しかけた書き込み側も閉じる
+					if (read == INVALID_SOCKET)
+					{
+						if (write != INVALID_SOCKET)
+						{
+							::closesocket(write);
+						}
+
+						return;
+					}
+
+					u_long nonBlocking = 1;
+					::ioctlsocket(read, FIONBIO, &nonBlocking);
+					::ioctlsocket(write, FIONBIO, &nonBlocking);
+
+					m_read = read;
+					m_write = write;
+
+				# else
+
+					int sockets[2];
+
+					if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+					{
+						return;
+					}
+
+					for (const int socket : sockets)
+					{
+						::fcntl(socket, F_SETFL, (::fcntl(socket, F_GETFL) | O_NONBLOCK));
+						::fcntl(socket, F_SETFD, FD_CLOEXEC);
+					}
+
+					m_read = sockets[0];
+					m_write = sockets[1];
+
+				# endif
+				}
+
+				WakeupChannel(const WakeupChannel&) = delete;
+
+				WakeupChannel& operator =(const WakeupChannel&) = delete;
+
+				~WakeupChannel()
+				{
+					if (m_read != CURL_SOCKET_BAD)
+					{
+						Close(m_read);
+					}
+
+					if (m_write != CURL_SOCKET_BAD)
+					{
+						Close(m_write);
+					}
+				}
+
+				/// <summary>
+				/// ソケットを作れた場合 true を返します。false の場合、notify() では起こせません。
+				/// </summary>
+				[[nodiscard]] bool isValid() const noexcept
+				{
+					return (m_read != CURL_SOCKET_BAD);
+				}
+
+				[[nodiscard]] ::curl_socket_t socket() const noexcept
+				{
+					return m_read;
+				}
+
+				void notify()
+				{
+					if (!isValid())
+					{
+						return;
+					}
+
+					const char byte = 0;
+
+					// バッファが一杯の場合は、既に起こされることが決まっているので失敗してよい
+					::send(m_write, &byte, 1, 0);
+				}
+
+				void drain()
+				{
+					if (!isValid())
+					{
+						return;
+					}
+
+					char buffer[64];
+
+					while (::recv(m_read, buffer, sizeof(buffer), 0) > 0) {}
+				}
+			};
+
+			struct WriteContext
+			{
+				::CURL* curl = nullptr;
+
+				HTTPEngineTransfer* transfer = nullptr;
+
+				// 受信したデータの書き込み先。ヘッジした通信ではメモリに保持する
+				IHTTPFileSink* sink = nullptr;
+
+				HTTPDigester* digester = nullptr;
+
+				// 受信の帯域を制限するトークンバケット（全体・ホスト・この通信）
+				std::array<TokenBucket*, 3> recvBuckets = {};
+
+				// curl_easy_pause で設定中の値
+				int* pauseMask = nullptr;
+
+				bool sizeNotified = false;
+
+				// 最初のデータを受信した時点のステータスコード
+				int32 statusCode = 0;
+
+				// ヘッジ中で、どちらの通信を使うかまだ決まっていない。受信したバイト数と進捗は公開せずに以下に保持する
+				bool hedging = false;
+
+				size_t hedgingBytes = 0;
+
+				int64 hedgingDownloadNow = 0, hedgingDownloadTotal = 0, hedgingUploadNow = 0, hedgingUploadTotal = 0;
+			};
+
+			void StoreProgress(HTTPAtomicProgress& progress, const int64 dlTotal, const int64 dlNow, const int64 ulTotal, const int64 ulNow)
+			{
+				progress.downloadNowSize.store(dlNow, std::memory_order_relaxed);
+				progress.uploadNowSize.store(ulNow, std::memory_order_relaxed);
+
+				if (dlTotal != 0)
+				{
+					progress.downloadTotalSize.store(dlTotal, std::memory_order_relaxed);
+				}
+				if (ulTotal != 0)
+				{
+					progress.uploadTotalSize.store(ulTotal, std::memory_order_relaxed);
+				}
+			}
+
+			/// <summary>
+			/// ヘッジ中の 2 つの通信のうち、使う方に決まった通信が保持していた受信したバイト数と進捗を公開します。
+			/// </summary>
+			void CommitHedging(WriteContext& context)
+			{
+				if (!context.hedging)
+				{
+					return;
+				}
+
+				context.hedging = false;
+				context.transfer->metrics.addBytesReceived(context.hedgingBytes);
+				context.hedgingBytes = 0;
+
+				StoreProgress(context.transfer->progress, context.hedgingDownloadTotal, context.hedgingDownloadNow, context.hedgingUploadTotal, context.hedgingUploadNow);
+			}
+
+			/// <summary>
+			/// 受信したバイト数を帯域のトークンバケットから差し引きます。
+			/// 上限に達している場合は、トークンが溜まるまで受信を一時停止するため false を返します（データは libcurl が保持する）
+			/// </summary>
+			bool ConsumeRecvBandwidth(WriteContext& context, const size_t size)
+			{
+				for (const TokenBucket* bucket : context.recvBuckets)
+				{
+					if (bucket->isExhausted())
+					{
+						*context.pauseMask |= CURLPAUSE_RECV;
+						return false;
+					}
+				}
+
+				for (TokenBucket* bucket : context.recvBuckets)
+				{
+					bucket->consume(static_cast<int64>(size));
+				}
+
+				return true;
+			}
+
+			size_t CallbackWrite(char* ptr, size_t size, size_t nmemb, WriteContext* context)
+			{
+				const size_t size_bytes = (size * nmemb);
+				IHTTPFileSink& sink = *context->sink;
+
+				if (!ConsumeRecvBandwidth(*context, size_bytes))
+				{
+					return CURL_WRITEFUNC_PAUSE;
+				}
+
+				// 最初のデータを受信した時点でレスポンスヘッダーは揃っている
+				if (!context->sizeNotified)
+				{
+					context->sizeNotified = true;
+
+					long statusCode = 0;
+					::curl_easy_getinfo(context->curl, ::CURLINFO_RESPONSE_CODE, &statusCode);
+					context->statusCode = static_cast<int32>(statusCode);
+					sink.beginBody(context->statusCode);
+
+					::curl_off_t contentLength = -1;
+
+					if ((::curl_easy_getinfo(context->curl, ::CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength) == ::CURLE_OK)
+						&& (0 < contentLength))
+					{
+						sink.preallocate(static_cast<int64>(contentLength));
+					}
+				}
+
+				if (context->digester)
+				{
+					context->digester->update(ptr, size_bytes);
+				}
+
+				if (context->hedging)
+				{
+					context->hedgingBytes += size_bytes;
+				}
+				else
+				{
+					context->transfer->metrics.addBytesReceived(size_bytes);
+				}
+
+				return static_cast<size_t>(sink.write(static_cast<const void*>(ptr), size_bytes));
+			}
+
+			/// <summary>
+			/// multipart/form-data の本文。各項目のデータは、libcurl が送信するときに少しずつ読み込みます。
+			/// 再試行のたびに作り直し、ファイルは開き直し、IReader は先頭に戻します。
+			/// </summary>
+			class FormUpload
+			{
+			private:
+
+				struct PartSource
+				{
+					std::shared_ptr<const Array<uint8>> data;
+
+					size_t dataPos = 0;
+
+					std::unique_ptr<BinaryReader> file;
+
+					// file か HTTPForm::Part::reader
+					IReader* reader = nullptr;
+				};
+
+				::curl_mime* m_mime = nullptr;
+
+				// libcurl に渡したアドレスが変わらないように deque で保持する
+				std::deque<PartSource> m_sources;
+
+				bool m_ready = true;
+
+				static size_t CallbackRead(char* buffer, size_t size, size_t nitems, void* arg)
+				{
+					PartSource& source = *static_cast<PartSource*>(arg);
+					const size_t capacity = (size * nitems);
+
+					if (source.reader)
+					{
+						const int64 readSize = source.reader->read(buffer, static_cast<int64>(capacity));
+						return ((readSize < 0) ? CURL_READFUNC_ABORT : static_cast<size_t>(readSize));
+					}
+
+					const size_t readSize = Min(capacity, (source.data->size() - source.dataPos));
+					std::memcpy(buffer, (source.data->data() + source.dataPos), readSize);
+					source.dataPos += readSize;
+
+					return readSize;
+				}
+
+				// リダイレクトや認証で本文を送り直すときに呼ばれる
+				static int CallbackSeek(void* arg, ::curl_off_t offset, int origin)
+				{
+					PartSource& source = *static_cast<PartSource*>(arg);
+
+					if (origin != SEEK_SET)
+					{
+						return CURL_SEEKFUNC_CANTSEEK;
+					}
+
+					if (source.reader)
+					{
+						return (source.reader->setPos(static_cast<int64>(offset)) ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL);
+					}
+
+					if (source.data->size() < static_cast<size_t>(offset))
+					{
+						return CURL_SEEKFUNC_FAIL;
+					}
+
+					source.dataPos = static_cast<size_t>(offset);
+					return CURL_SEEKFUNC_OK;
+				}
+
+			public:
+
+				FormUpload(::CURL* curl, const HTTPForm& form)
+					: m_mime(::curl_mime_init(curl))
+				{
+					for (const auto& part : form.parts())
+					{
+						PartSource& source = m_sources.emplace_back();
+
+						if (!part.path.isEmpty())
+						{
+							source.file = std::make_unique<BinaryReader>(part.path);
+
+							if (!source.file->isOpen())
+							{
+								LOG_FAIL(U"Failed to open the form file `{}`"_fmt(part.path));
+								m_ready = false;
+								return;
+							}
+
+							source.reader = source.file.get();
+						}
+						else if (part.reader)
+						{
+							source.reader = part.reader.get();
+							source.reader->setPos(0);
+						}
+						else
+						{
+							source.data = (part.data ? part.data : std::make_shared<const Array<uint8>>());
+						}
+
+						const int64 size = (source.reader ? source.reader->size() : static_cast<int64>(source.data->size()));
+
+						::curl_mimepart* mimePart = ::curl_mime_addpart(m_mime);
+						::curl_mime_name(mimePart, part.name.toUTF8().c_str());
+
+						if (!part.fileName.isEmpty())
+						{
+							::curl_mime_filename(mimePart, part.fileName.toUTF8().c_str());
+						}
+
+						if (!part.contentType.isEmpty())
+						{
+							::curl_mime_type(mimePart, part.contentType.toUTF8().c_str());
+						}
+
+						::curl_mime_data_cb(mimePart, static_cast<::curl_off_t>(size), CallbackRead, CallbackSeek, nullptr, &source);
+					}
+				}
+
+				FormUpload(const FormUpload&) = delete;
+
+				FormUpload& operator =(const FormUpload&) = delete;
+
+				~FormUpload()
+				{
+					::curl_mime_free(m_mime);
+				}
+
+				/// <summary>
+				/// すべての項目のデータを読み込めるかを返します
+				/// </summary>
+				[[nodiscard]] bool isReady() const noexcept
+				{
+					return m_ready;
+				}
+
+				[[nodiscard]] ::curl_mime* mime() const noexcept
+				{
+					return m_mime;
+				}
+			};
+
+			int XferInfo(WriteContext* context, curl_off_t dlTotal, curl_off_t dlNow, curl_off_t ulTotal, curl_off_t ulNow)
+			{
+				if (context->hedging)
+				{
+					context->hedgingDownloadNow = static_cast<int64>(dlNow);
+					context->hedgingUploadNow = static_cast<int64>(ulNow);
+
+					if (dlTotal != 0L)
+					{
+						context->hedgingDownloadTotal = static_cast<int64>(dlTotal);
+					}
+					if (ulTotal != 0L)
+					{
+						context->hedgingUploadTotal = static_cast<int64>(ulTotal);
+					}
+				}
+				else
+				{
+					StoreProgress(context->transfer->progress, static_cast<int64>(dlTotal), static_cast<int64>(dlNow), static_cast<int64>(ulTotal), static_cast<int64>(ulNow));
+				}
+
+				if (context->transfer->isCancelRequested())
+				{
+					return 1;
+				}
+
+				return 0;
+			}
+
+			HTTPTransferInfo GetTransferInfo(::CURL* curl)
+			{
+				::curl_off_t nameLookup = 0, connect = 0, appConnect = 0, startTransfer = 0, total = 0, uploaded = 0;
+				long connects = 0;
+
+				::curl_easy_getinfo(curl, ::CURLINFO_NAMELOOKUP_TIME_T, &nameLookup);
+				::curl_easy_getinfo(curl, ::CURLINFO_CONNECT_TIME_T, &connect);
+				::curl_easy_getinfo(curl, ::CURLINFO_APPCONNECT_TIME_T, &appConnect);
+				::curl_easy_getinfo(curl, ::CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+				::curl_easy_getinfo(curl, ::CURLINFO_TOTAL_TIME_T, &total);
+				::curl_easy_getinfo(curl, ::CURLINFO_SIZE_UPLOAD_T, &uploaded);
+				::curl_easy_getinfo(curl, ::CURLINFO_NUM_CONNECTS, &connects);
+
+				HTTPTransferInfo info;
+				info.totalMicrosec = static_cast<int64>(total);
+				info.bytesSent = static_cast<int64>(uploaded);
+				info.newConnections = connects;
+
+				// 再利用した接続では、名前解決と接続の時間は 0 になる
+				if (connects > 0)
+				{
+					info.dnsMicrosec = static_cast<int64>(nameLookup);
+					info.connectMicrosec = static_cast<int64>(connect - nameLookup);
+
+					if (appConnect > 0)
+					{
+						info.tlsMicrosec = static_cast<int64>(appConnect - connect);
+					}
+				}
+
+				if (startTransfer > 0)
+				{
+					info.ttfbMicrosec = static_cast<int64>(startTransfer);
+				}
+
+				return info;
+			}
+
+			/// <summary>
+			/// HTTPRetryPolicy で再試行する libcurl のエラーかを返します。
+			/// </summary>
+			[[nodiscard]] bool IsRetryableError(const ::CURLcode result, const HTTPRetryPolicy& policy)
+			{
+				switch (result)
+				{
+				case ::CURLE_OPERATION_TIMEDOUT:
+					return policy.retryOnTimeout;
+				case ::CURLE_COULDNT_RESOLVE_HOST:
+				case ::CURLE_COULDNT_CONNECT:
+				case ::CURLE_SSL_CONNECT_ERROR:
+				case ::CURLE_SEND_ERROR:
+				case ::CURLE_RECV_ERROR:
+				case ::CURLE_GOT_NOTHING:
+				case ::CURLE_PARTIAL_FILE:
+				case ::CURLE_HTTP2:
+				case ::CURLE_HTTP2_STREAM:
+					return policy.retryOnTransferError;
+				default:
+					return false;
+				}
+			}
+
+			/// <summary>
+			/// 最後のレスポンスのヘッダーから、指定した名前（小文字）のフィールドの値を探します。
+			/// </summary>
+			[[nodiscard]] Optional<String> FindResponseHeader(const String& headerString, const StringView name)
+			{
+				const String prefix = (String(name) + U':');
+				Optional<String> value;
+
+				for (const auto& line : headerString.split(U'\n'))
+				{
+					// リダイレクトなどで複数のレスポンスが含まれる場合は、最後のものだけを見る
+					if (line.starts_with(U"HTTP/"))
+					{
+						value.reset();
+					}
+					else if (line.lowercased().starts_with(prefix))
+					{
+						value = line.substr(prefix.size()).trimmed();
+					}
+				}
+
+				return value;
+			}
+
+			/// <summary>
+			/// 最後のレスポンスの Retry-After ヘッダー（秒数または HTTP-date）から、待ち時間（秒）を求めます。
+			/// libcurl 7.65.1 には CURLINFO_RETRY_AFTER が無いため、ヘッダーを直接読みます。
+			/// int64 に収まらない秒数は、int64 の最大値を返します。
+			/// </summary>
+			[[nodiscard]] Optional<int64> ParseRetryAfter(const String& headerString)
+			{
+				const Optional<String> value = FindResponseHeader(headerString, U"retry-after");
+
+				if (!value || value->isEmpty())
+				{
+					return none;
+				}
+
+				if (std::all_of(value->begin(), value->end(), [](const char32 ch) { return (U'0' <= ch) && (ch <= U'9'); }))
+				{
+					const int64 seconds = ParseOr<int64>(*value, -1);
+
+					return ((0 <= seconds) ? seconds : std::numeric_limits<int64>::max());
+				}
+
+				const std::time_t date = ::curl_getdate(value->narrow().c_str(), nullptr);
+
+				if (date == -1)
+				{
+					return none;
+				}
+
+				return Max<int64>(static_cast<int64>(date - std::time(nullptr)), 0);
+			}
+
+			/// <summary>
+			/// 最後のレスポンスの Content-Range ヘッダー（"bytes 100-199/1000"）から、区間の先頭とファイル全体のサイズ（不明な場合は -1）を求めます。
+			/// </summary>
+			[[nodiscard]] Optional<std::pair<int64, int64>> ParseContentRange(const String& headerString)
+			{
+				const Optional<String> value = FindResponseHeader(headerString, U"content-range");
+
+				if (!value || !value->lowercased().starts_with(U"bytes "))
+				{
+					return none;
+				}
+
+				const size_t dash = value->indexOf(U'-');
+				const size_t slash = value->indexOf(U'/');
+
+				if ((dash == String::npos) || (slash == String::npos) || (slash < dash))
+				{
+					return none;
+				}
+
+				const int64 begin = ParseOr<int64>(value->substr(6, (dash - 6)).trimmed(), -1);
+
+				if (begin < 0)
+				{
+					return none;
+				}
+
+				const String total = value->substr(slash + 1).trimmed();
+
+				return std::make_pair(begin, ((total == U"*") ? int64{ -1 } : ParseOr<int64>(total, -1)));
+			}
+
+			/// <summary>
+			/// ミラーからのダウンロードで、1 つのミラーから受信するファイルの区間
+			/// </summary>
+			struct MirrorSegment
+			{
+				int64 begin = 0;
+
+				// 区間の終わり（この位置を含まない）。不明な場合は -1
+				int64 end = -1;
+
+				int64 received = 0;
+
+				// 受信している easy ハンドル
+				::CURL* curl = nullptr;
+
+				size_t mirrorIndex = 0;
+
+				[[nodiscard]] int64 position() const noexcept
+				{
+					return (begin + received);
+				}
+
+				[[nodiscard]] bool isCompleted() const noexcept
+				{
+					return ((0 <= end) && (end <= position()));
+				}
+			};
+
+			/// <summary>
+			/// HTTPEngine のスレッドだけが使う、ミラーからのダウンロードの状態
+			/// </summary>
+			struct MirrorDownload
+			{
+				Array<MirrorSegment> segments;
+
+				// 失敗したミラー
+				Array<bool> failed;
+
+				// ファイル全体のサイズ。不明な場合は -1
+				int64 totalSize = -1;
+
+				// 最後に受け入れたファイル全体のレスポンスのヘッダー。HTTPResponse はこれから作る
+				String header;
+
+				// 区間に分けない場合、ミラーを切り替えても続けて計算するハッシュ値
+				std::unique_ptr<HTTPDigester> digester;
+
+				// 書き込み先の現在の位置
+				int64 sinkPos = 0;
+
+				int64 receivedSize = 0;
+
+				// 実行中の easy ハンドルの数
+				size_t running = 0;
+
+				bool preallocated = false;
+
+				// サーバーが Range に対応していて、区間に分けられることが分かった
+				bool splitRequested = false;
+
+				bool split = false;
+
+				// 失敗が確定した場合、その結果
+				Optional<::CURLcode> failedResult;
+			};
+
+			/// <summary>
+			/// HTTPEngine のスレッドだけが使う、実行中の通信の状態
+			/// </summary>
+			struct ActiveTransfer
+			{
+				std::shared_ptr<HTTPEngineTransfer> transfer;
+
+				::CURL* curl = nullptr;
+
+				::curl_slist* headerList = nullptr;
+
+				std::string url;
+
+				String headerString;
+
+				std::unique_ptr<HTTPDigester> digester;
+
+				WriteContext writeContext;
+
+				int64 performBegin = 0;
+
+				std::shared_ptr<BandwidthBuckets> hostBandwidth;
+
+				// この通信の受信の帯域の上限
+				TokenBucket recvBandwidth;
+
+				// 送信の帯域の集計に使う、前回までに送信したバイト数
+				int64 uploadedSize = 0;
+
+				// CURLOPT_MAX_SEND_SPEED_LARGE で設定済みのこの通信の送信の帯域の上限
+				int64 maxSendBytesPerSec = 0;
+
+				// curl_easy_pause で設定中の値
+				int pauseMask = CURLPAUSE_CONT;
+
+				::CURLcode result = ::CURLE_OK;
+
+				HTTPTransferInfo info;
+
+				// 再試行する場合、再試行する時刻
+				int64 retryAtMicrosec = 0;
+
+				// ヘッジを開始する時刻。ヘッジしない場合は 0
+				int64 hedgeAtMicrosec = 0;
+
+				// ヘッジした通信、またはヘッジされた元の通信。両方が実行中の間だけ設定される
+				::CURL* peer = nullptr;
+
+				// ヘッジした通信で、元の通信の枠（同時に実行する通信の数）をまだ引き継いでいない
+				bool isHedge = false;
+
+				// ヘッジした通信の場合、受信したデータ。使われた場合は完了後に元の通信の書き込み先に書き込む
+				std::unique_ptr<MemoryFileSink> hedgeSink;
+
+				// フォームを送る場合、送信する本文。easy ハンドルから外した後に破棄する
+				std::unique_ptr<FormUpload> form;
+
+				// ミラーからのダウンロードの場合、その状態と、受信している区間とミラー
+				MirrorDownload* mirror = nullptr;
+
+				size_t segmentIndex = 0;
+
+				size_t mirrorIndex = 0;
+
+				// ミラーのレスポンスが使えない（エラーのステータスコードや、要求と異なる区間）ため中断した
+				bool rejected = false;
+
+				// 区間の終わりまで受信したため中断した
+				bool segmentFinished = false;
+
+				int64 startMicrosec = 0;
+
+				int64 receivedSize = 0;
+
+				// 受信の速度を測っている期間の開始時刻と、その間に受信したバイト数
+				int64 rateWindowBeginMicrosec = 0;
+
+				int64 rateWindowBytes = 0;
+			};
+
+			/// <summary>
+			/// ミラーからの最初のレスポンスを確認し、ファイル全体のサイズと区間の終わりを確定させます。
+			/// 使えないレスポンスの場合は false を返します。
+			/// </summary>
+			bool AcceptMirrorResponse(ActiveTransfer& active)
+			{
+				const HTTPEngineTransfer& transfer = *active.transfer;
+				MirrorDownload& mirror = *active.mirror;
+				MirrorSegment& segment = mirror.segments[active.segmentIndex];
+
+				long statusCode = 0;
+				::curl_easy_getinfo(active.curl, ::CURLINFO_RESPONSE_CODE, &statusCode);
+
+				if (statusCode == static_cast<long>(HTTPResponseStatusCode::OK))
+				{
+					::curl_off_t contentLength = -1;
+					::curl_easy_getinfo(active.curl, ::CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+
+					// 他のミラーと異なるファイル
+					if ((0 <= mirror.totalSize) && (0 <= contentLength) && (contentLength != mirror.totalSize))
+					{
+						return false;
+					}
+
+					// Range を無視してファイル全体を送ってきた。区間に分けている場合と、書き込み先を先頭に戻せない場合は使えない
+					if (segment.position() != 0)
+					{
+						if (mirror.split || !transfer.sink->supportsRandomAccess())
+						{
+							return false;
+						}
+
+						mirror.receivedSize -= segment.received;
+						segment.received = 0;
+						mirror.digester = std::make_unique<HTTPDigester>(transfer.options.digest);
+					}
+
+					if (0 <= contentLength)
+					{
+						mirror.totalSize = static_cast<int64>(contentLength);
+					}
+
+					mirror.header = active.headerString;
+
+					const HTTPMirrorPolicy& policy = transfer.options.mirror;
+					const bool acceptRanges = (FindResponseHeader(active.headerString, U"accept-ranges").value_or(U"").lowercased() == U"bytes");
+
+					if (!mirror.split && acceptRanges && (1 < policy.parallelSegments) && !mirror.digester->isEnabled() && (0 < mirror.totalSize)
+						&& transfer.sink->supportsRandomAccess())
+					{
+						mirror.splitRequested = true;
+					}
+				}
+				else if (statusCode == static_cast<long>(HTTPResponseStatusCode::PartialContent))
+				{
+					const auto range = ParseContentRange(active.headerString);
+
+					if (!range || (range->first != segment.position()))
+					{
+						return false;
+					}
+
+					if (0 <= range->second)
+					{
+						if ((0 <= mirror.totalSize) && (range->second != mirror.totalSize))
+						{
+							return false;
+						}
+
+						mirror.totalSize = range->second;
+					}
+				}
+				else
+				{
+					return false;
+				}
+
+				if ((segment.end < 0) && (0 <= mirror.totalSize))
+				{
+					segment.end = mirror.totalSize;
+				}
+
+				if (!mirror.preallocated && (0 < mirror.totalSize))
+				{
+					mirror.preallocated = true;
+					transfer.sink->preallocate(mirror.totalSize);
+				}
+
+				return true;
+			}
+
+			/// <summary>
+			/// ミラーからのダウンロードの CURLOPT_WRITEFUNCTION。受信したデータを、区間の位置に書き込みます。
+			/// </summary>
+			size_t CallbackWriteMirror(char* ptr, size_t size, size_t nmemb, ActiveTransfer* active)
+			{
+				const size_t size_bytes = (size * nmemb);
+				HTTPEngineTransfer& transfer = *active->transfer;
+				MirrorDownload& mirror = *active->mirror;
+				IHTTPFileSink& sink = *transfer.sink;
+
+				if (!ConsumeRecvBandwidth(active->writeContext, size_bytes))
+				{
+					return CURL_WRITEFUNC_PAUSE;
+				}
+
+				if (!active->writeContext.sizeNotified)
+				{
+					active->writeContext.sizeNotified = true;
+
+					if (!AcceptMirrorResponse(*active))
+					{
+						active->rejected = true;
+						return 0;
+					}
+				}
+
+				MirrorSegment& segment = mirror.segments[active->segmentIndex];
+
+				// 区間の終わりを超える分は、他の区間で受信する
+				size_t writeSize = size_bytes;
+
+				if (0 <= segment.end)
+				{
+					writeSize = static_cast<size_t>(Clamp<int64>((segment.end - segment.position()), 0, static_cast<int64>(size_bytes)));
+				}
+
+				if (writeSize != 0)
+				{
+					if (mirror.sinkPos != segment.position())
+					{
+						if (!sink.setPos(segment.position()))
+						{
+							return 0;
+						}
+
+						mirror.sinkPos = segment.position();
+					}
+
+					if (!mirror.split && mirror.digester->isEnabled())
+					{
+						mirror.digester->update(ptr, writeSize);
+					}
+
+					transfer.metrics.addBytesReceived(writeSize);
+
+					const int64 written = Max<int64>(sink.write(static_cast<const void*>(ptr), static_cast<int64>(writeSize)), 0);
+					mirror.sinkPos += written;
+					mirror.receivedSize += written;
+					segment.received += written;
+					active->receivedSize += written;
+					active->rateWindowBytes += written;
+
+					if (transfer.reportProgress)
+					{
+						transfer.progress.downloadNowSize.store(mirror.receivedSize, std::memory_order_relaxed);
+
+						if (0 <= mirror.totalSize)
+						{
+							transfer.progress.downloadTotalSize.store(mirror.totalSize, std::memory_order_relaxed);
+						}
+					}
+
+					if (written != static_cast<int64>(writeSize))
+					{
+						return 0;
+					}
+				}
+
+				if (writeSize != size_bytes)
+				{
+					active->segmentFinished = true;
+					return 0;
+				}
+
+				return size_bytes;
+			}
+
+			/// <summary>
+			/// 通信の結果を確認し、受信したデータを確定させるか破棄します。
+			/// </summary>
+			HTTPResponse FinishRequest(ActiveTransfer& active)
+			{
+				HTTPEngineTransfer& transfer = *active.transfer;
+				IHTTPFileSink& sink = *transfer.sink;
+
+				if (active.result != ::CURLE_OK)
+				{
+					LOG_FAIL(U"curl failed (CURLcode: {})"_fmt(active.result));
+					sink.discard();
+
+					switch (active.result)
+					{
+					case ::CURLE_WRITE_ERROR:
+						return HTTPResponse(HTTPError::FileWrite);
+					case ::CURLE_OPERATION_TIMEDOUT:
+						return HTTPResponse(HTTPError::TimedOut);
+					default:
+						return HTTPResponse(HTTPError::Transfer);
+					}
+				}
+
+				String digest;
+
+				if (active.digester->isEnabled())
+				{
+					digest = active.digester->finalize();
+
+					// 一致しない場合はファイルを確定させない
+					if (!transfer.options.expectedDigest.isEmpty() && !DigestEquals(digest, transfer.options.expectedDigest))
+					{
+						LOG_FAIL(U"Digest mismatch (expected: {}, actual: {})"_fmt(transfer.options.expectedDigest, digest));
+						sink.discard();
+						return HTTPResponse(HTTPError::DigestMismatch);
+					}
+				}
+
+				const int64 flushBegin = (transfer.trace.isEnabled() ? GetTraceMicrosec() : 0);
+
+				const bool committed = sink.commit();
+
+				transfer.trace.flushed(flushBegin);
+
+				if (!committed)
+				{
+					LOG_FAIL(U"Failed to write the received data");
+					return HTTPResponse(HTTPError::FileWrite);
+				}
+
+				return HTTPResponse(active.headerString, digest);
+			}
+
+			/// <summary>
+			/// 再試行する通信を HTTPEngine に戻します。HTTPEngine が終了中の場合は false を返します。
+			/// </summary>
+			bool ResubmitTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer);
+
+			/// <summary>
+			/// 待機中の通信を終了させます。
+			/// </summary>
+			void FinishPending(const std::shared_ptr<HTTPEngineTransfer>& transfer, const HTTPError error)
+			{
+				const HTTPResponse response(error);
+				const HTTPAsyncStatus status = GetResultStatus(response, transfer->isCancelRequested());
+
+				transfer->sink->discard();
+				transfer->metrics.finish(status, HTTPTransferInfo{});
+				transfer->trace.finished(status);
+				transfer->finish(response, status);
+			}
+
+			/// <summary>
+			/// 終わった通信の後処理を行い、結果を設定するか再試行します。
+			/// </summary>
+			void CompleteTransfer(ActiveTransfer& active)
+			{
+				HTTPEngineTransfer& transfer = *active.transfer;
+
+				transfer.trace.transferred(active.performBegin, active.info);
+
+				if (active.retryAtMicrosec)
+				{
+					// 受信したデータを捨て、新しい書き込み先で再試行する
+					transfer.sink->discard();
+					transfer.sink = transfer.createSink();
+					transfer.retryAtMicrosec = active.retryAtMicrosec;
+					transfer.metrics.retried();
+
+					if (ResubmitTransfer(active.transfer))
+					{
+						return;
+					}
+
+					transfer.requestCancel();
+					active.result = ::CURLE_ABORTED_BY_CALLBACK;
+				}
+				else if (active.hedgeSink && (active.result == ::CURLE_OK))
+				{
+					// ヘッジした通信が使われた。元の通信の書き込み先を作り直し、メモリに保持したデータを書き込む
+					const Array<uint8>& data = active.hedgeSink->data();
+
+					transfer.sink->discard();
+					transfer.sink = transfer.createSink();
+
+					if (!transfer.sink->isOpen())
+					{
+						active.result = ::CURLE_WRITE_ERROR;
+					}
+					else if (!data.isEmpty())
+					{
+						transfer.sink->beginBody(active.writeContext.statusCode);
+						transfer.sink->preallocate(static_cast<int64>(data.size()));
+
+						if (transfer.sink->write(data.data(), static_cast<int64>(data.size())) != static_cast<int64>(data.size()))
+						{
+							active.result = ::CURLE_WRITE_ERROR;
+						}
+					}
+				}
+
+				const HTTPResponse response = FinishRequest(active);
+				const HTTPAsyncStatus status = GetResultStatus(response, transfer.isCancelRequested());
+
+				transfer.metrics.finish(status, active.info);
+				transfer.trace.finished(status);
+				transfer.finish(response, status);
+			}
+
+			/// <summary>
+			/// 終わった通信の後処理（ファイルの確定やディスクへの書き出し）を行うスレッド
+			/// 書き出しの待ち時間で、HTTPEngine のスレッドが他の通信を止めないようにします。
+			/// 開始前に終わった通信の継続も、HTTPEngine のスレッドではなくこのスレッドで実行します。
+			/// </summary>
+			class CompletionWorker
+			{
+			private:
+
+				struct Job
+				{
+					std::unique_ptr<ActiveTransfer> active;
+
+					// active が無い場合は、開始前に終わった通信とそのエラー
+					std::shared_ptr<HTTPEngineTransfer> pending;
+
+					HTTPError error = HTTPError::None;
+				};
+
+				std::mutex m_mutex;
+
+				std::condition_variable m_condition;
+
+				std::deque<Job> m_queue;
+
+				bool m_quit = false;
+
+				std::thread m_thread;
+
+				void run()
+				{
+					for (;;)
+					{
+						Job job;
+						{
+							std::unique_lock lock(m_mutex);
+
+							m_condition.wait(lock, [this]() { return (m_quit || !m_queue.empty()); });
+
+							if (m_queue.empty())
+							{
+								return;
+							}
+
+							job = std::move(m_queue.front());
+							m_queue.pop_front();
+						}
+
+						if (job.active)
+						{
+							CompleteTransfer(*job.active);
+						}
+						else
+						{
+							FinishPending(job.pending, job.error);
+						}
+					}
+				}
+
+				void enqueue(Job&& job)
+				{
+					{
+						std::lock_guard lock(m_mutex);
+						m_queue.push_back(std::move(job));
+					}
+
+					m_condition.notify_one();
+				}
+
+			public:
+
+				CompletionWorker()
+					: m_thread(&CompletionWorker::run, this) {}
+
+				~CompletionWorker()
+				{
+					stop();
+				}
+
+				/// <summary>
+				/// 残っている後処理をすべて終えてから、スレッドを終了します。
+				/// </summary>
+				void stop()
+				{
+					if (!m_thread.joinable())
+					{
+						return;
+					}
+
+					{
+						std::lock_guard lock(m_mutex);
+						m_quit = true;
+					}
+
+					m_condition.notify_one();
+					m_thread.join();
+				}
+
+				void push(std::unique_ptr<ActiveTransfer>&& active)
+				{
+					// 同期 API の通信は、このスレッドが同期 API で待っている場合があるため、待っているスレッドで後処理する
+					if (active->transfer->synchronous)
+					{
+						const std::shared_ptr<HTTPEngineTransfer> transfer = active->transfer;
+						transfer->postCompletion([active = std::shared_ptr<ActiveTransfer>(std::move(active))]() { CompleteTransfer(*active); });
+						return;
+					}
+
+					enqueue(Job{ std::move(active), nullptr, HTTPError::None });
+				}
+
+				/// <summary>
+				/// 開始前に終わった通信を終了させます。
+				/// </summary>
+				void finish(const std::shared_ptr<HTTPEngineTransfer>& transfer, const HTTPError error)
+				{
+					// 同期 API の通信には継続が無いので、すぐに終了させる
+					if (transfer->synchronous)
+					{
+						FinishPending(transfer, error);
+						return;
+					}
+
+					enqueue(Job{ nullptr, transfer, error });
+				}
+			};
+
+			class HTTPEngine
+			{
+			private:
+
+				struct HostQueue
+				{
+					// 優先度ごとの待機中の通信
+					std::array<std::deque<std::shared_ptr<HTTPEngineTransfer>>, PriorityCount> pending;
+
+					size_t active = 0;
+
+					// active のうち Background の通信の数
+					size_t activeBackground = 0;
+
+					// 上限に数えない実行中の通信（HTTPEngineTransfer::bypassLimits）の数
+					size_t bypassed = 0;
+
+					std::shared_ptr<BandwidthBuckets> bandwidth = std::make_shared<BandwidthBuckets>();
+
+					[[nodiscard]] bool hasPending() const noexcept
+					{
+						return std::any_of(pending.begin(), pending.end(), [](const auto& queue) { return !queue.empty(); });
+					}
+				};
+
+				::CURLM* m_multi = nullptr;
+
+				WakeupChannel m_wakeup;
+
+				std::mutex m_incomingMutex;
+
+				Array<std::shared_ptr<HTTPEngineTransfer>> m_incoming;
+
+				bool m_quit = false;
+
+				// 以下は HTTPEngine のスレッドだけが使う
+
+				HashTable<String, HostQueue> m_hosts;
+
+				// 優先度ごとの、待機中の通信があるホスト（ラウンドロビンの順）
+				std::array<std::deque<String>, PriorityCount> m_hostOrder;
+
+				// 優先度ごとの実行中の通信の数（bypassLimits の通信を除く）
+				std::array<size_t, PriorityCount> m_activeCount = {};
+
+				BandwidthBuckets m_bandwidth;
+
+				HashTable<String, BandwidthLimit> m_hostBandwidthLimits;
+
+				uint64 m_hostBandwidthLimitsVersion = 0;
+
+				int64 m_bandwidthUpdatedMicrosec = 0;
+
+				HashTable<::CURL*, std::unique_ptr<ActiveTransfer>> m_active;
+
+				Array<::CURL*> m_idleHandles;
+
+				// 再試行を待っている通信（再試行する時刻の順）
+				std::multimap<int64, std::shared_ptr<HTTPEngineTransfer>> m_delayed;
+
+				std::mt19937_64 m_random{ std::random_device{}() };
+
+				HTTPAdaptiveConcurrency m_adaptiveConcurrency;
+
+				uint64 m_adaptiveConcurrencyVersion = 0;
+
+				// HTTPAdaptiveConcurrency で調整している、ホストごとの上限
+				HashTable<String, ConcurrencyLimiter> m_concurrencyLimiters;
+
+				// 最後に m_concurrencyLimiters から使われていない上限を取り除いた時刻
+				int64 m_limitersPrunedMicrosec = 0;
+
+				// ミラーからのダウンロードの状態
+				HashTable<HTTPEngineTransfer*, std::unique_ptr<MirrorDownload>> m_mirrorDownloads;
+
+				// ミラーのホストごとの受信の速度と失敗の割合
+				HashTable<String, OriginStats> m_origins;
+
+				// 待機中の通信のうち、最も早い期限（GetEngineMicrosec() の値）。無い場合は 0
+				int64 m_pendingDeadlineMicrosec = 0;
+
+				// ヘッジできる残りの回数。ヘッジできる通信を開始するたびに HTTPHedgePolicy::maxHedgeRatio ずつ増える
+				double m_hedgeBudget = 0.0;
+
+				CompletionWorker m_completion;
+
+				std::thread m_thread;
+
+				::CURL* acquireHandle()
+				{
+					if (m_idleHandles.isEmpty())
+					{
+						return ::curl_easy_init();
+					}
+
+					::CURL* curl = m_idleHandles.back();
+					m_idleHandles.pop_back();
+					return curl;
+				}
+
+				void releaseHandle(::CURL* curl)
+				{
+					if (m_idleHandles.size() < MaxIdleHandles)
+					{
+						::curl_easy_reset(curl);
+						m_idleHandles.push_back(curl);
+					}
+					else
+					{
+						::curl_easy_cleanup(curl);
+					}
+				}
+
+				void enqueue(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+				{
+					if (transfer->retryAtMicrosec > GetEngineMicrosec())
+					{
+						m_delayed.emplace(transfer->retryAtMicrosec, transfer);
+						return;
+					}
+
+					transfer->retryAtMicrosec = 0;
+
+					const size_t priority = PriorityIndex(transfer->options.priority);
+
+					auto it = m_hosts.find(transfer->host);
+
+					if (it == m_hosts.end())
+					{
+						it = m_hosts.emplace(transfer->host, HostQueue{}).first;
+
+						if (auto limit = m_hostBandwidthLimits.find(transfer->host); limit != m_hostBandwidthLimits.end())
+						{
+							it->second.bandwidth->setLimit(limit->second);
+						}
+					}
+
+					HostQueue& queue = it->second;
+
+					// 上限に数えない通信は、待機させずにすぐ開始する
+					if (transfer->bypassLimits)
+					{
+						++queue.bypassed;
+
+						if (!start(transfer, queue.bandwidth))
+						{
+							releaseHost(*transfer);
+						}
+
+						return;
+					}
+
+					if (queue.pending[priority].empty())
+					{
+						m_hostOrder[priority].push_back(transfer->host);
+					}
+
+					queue.pending[priority].push_back(transfer);
+				}
+
+				void releaseHost(const HTTPEngineTransfer& transfer)
+				{
+					auto it = m_hosts.find(transfer.host);
+
+					if (it == m_hosts.end())
+					{
+						return;
+					}
+
+					HostQueue& queue = it->second;
+
+					if (transfer.bypassLimits)
+					{
+						--queue.bypassed;
+					}
+					else
+					{
+						if (transfer.options.priority == HTTPPriority::Background)
+						{
+							--queue.activeBackground;
+						}
+
+						--queue.active;
+					}
+
+					if ((queue.active == 0) && (queue.bypassed == 0) && !queue.hasPending())
+					{
+						m_hosts.erase(it);
+						pruneConcurrencyLimiters();
+					}
+				}
+
+				bool start(const std::shared_ptr<HTTPEngineTransfer>& transfer, const std::shared_ptr<BandwidthBuckets>& hostBandwidth)
+				{
+					HTTPEngineTransfer& t = *transfer;
+
+					++t.attempts;
+					t.metrics.dispatched();
+					t.trace.started();
+
+					if (!t.sink->isOpen())
+					{
+						m_completion.finish(transfer, HTTPError::FileOpen);
+						return false;
+					}
+
+					// 開始を待っている間に期限を過ぎた
+					const int64 remainingMicrosec = (t.deadlineMicrosec - GetEngineMicrosec());
+
+					if (t.deadlineMicrosec && (remainingMicrosec <= 0))
+					{
+						m_completion.finish(transfer, HTTPError::TimedOut);
+						return false;
+					}
+
+					// TCP で URL のホストに接続してしまわないよう、開始する前に失敗させる
+					if (!t.options.unixSocketPath.isEmpty() && !SupportsUnixSockets())
+					{
+						LOG_FAIL(U"This libcurl does not support Unix domain sockets: {}"_fmt(t.options.unixSocketPath));
+						m_completion.finish(transfer, HTTPError::Transfer);
+						return false;
+					}
+
+					::CURL* curl = acquireHandle();
+
+					if (!curl)
+					{
+						m_completion.finish(transfer, HTTPError::Transfer);
+						return false;
+					}
+
+					if (!t.mirrors.isEmpty())
+					{
+						auto mirror = std::make_unique<MirrorDownload>();
+						mirror->segments.push_back(MirrorSegment{});
+						mirror->failed.resize(t.mirrors.size(), false);
+						mirror->digester = std::make_unique<HTTPDigester>(t.options.digest);
+
+						const size_t mirrorIndex = selectMirror(t, *mirror, none).value_or(0);
+						auto active = setup(transfer, curl, t.mirrors[mirrorIndex], *t.sink, hostBandwidth);
+						configureMirror(*active, *mirror, 0, mirrorIndex);
+
+						if (::curl_multi_add_handle(m_multi, curl) != ::CURLM_OK)
+						{
+							::curl_slist_free_all(active->headerList);
+							releaseHandle(curl);
+							m_completion.finish(transfer, HTTPError::Transfer);
+							return false;
+						}
+
+						m_mirrorDownloads[&t] = std::move(mirror);
+						m_active.emplace(curl, std::move(active));
+
+						if (!t.bypassLimits)
+						{
+							++m_activeCount[PriorityIndex(t.options.priority)];
+						}
+
+						return true;
+					}
+
+					auto active = setup(transfer, curl, t.url, *t.sink, hostBandwidth);
+
+					if (active->form && !active->form->isReady())
+					{
+						// easy ハンドルが本文を参照しなくなってから破棄する
+						::curl_slist_free_all(active->headerList);
+						releaseHandle(curl);
+						active.reset();
+						m_completion.finish(transfer, HTTPError::FileOpen);
+						return false;
+					}
+
+					if (IsHedgeable(t))
+					{
+						m_hedgeBudget = Min((m_hedgeBudget + Max(t.options.hedge.maxHedgeRatio, 0.0)), MaxHedgeBurst);
+						active->hedgeAtMicrosec = (GetEngineMicrosec() + getHedgeDelay(t));
+					}
+
+					if (::curl_multi_add_handle(m_multi, curl) != ::CURLM_OK)
+					{
+						::curl_slist_free_all(active->headerList);
+						releaseHandle(curl);
+						m_completion.finish(transfer, HTTPError::Transfer);
+						return false;
+					}
+
+					m_active.emplace(curl, std::move(active));
+
+					if (!t.bypassLimits)
+					{
+						++m_activeCount[PriorityIndex(t.options.priority)];
+					}
+
+					return true;
+				}
+
+				/// <summary>
+				/// easy ハンドルに通信の設定を行います。
+				/// </summary>
+				std::unique_ptr<ActiveTransfer> setup(const std::shared_ptr<HTTPEngineTransfer>& transfer, ::CURL* curl, const URLView url,
+					IHTTPFileSink& sink, const std::shared_ptr<BandwidthBuckets>& hostBandwidth)
+				{
+					HTTPEngineTransfer& t = *transfer;
+					const int64 remainingMicrosec = (t.deadlineMicrosec - GetEngineMicrosec());
+
+					auto active = std::make_unique<ActiveTransfer>();
+					active->transfer = transfer;
+					active->curl = curl;
+					active->url = Unicode::ToUTF8(url);
+					active->digester = std::make_unique<HTTPDigester>(t.options.digest);
+
+					// ヘッダの追加
+					for (auto [f, s] : t.header)
+					{
+						const std::string text = U"{}: {}"_fmt(f, s).toUTF8();
+						active->headerList = ::curl_slist_append(active->headerList, text.c_str());
+					}
+
+					::curl_easy_setopt(curl, ::CURLOPT_HTTPHEADER, active->headerList);
+					::curl_easy_setopt(curl, ::CURLOPT_URL, active->url.c_str());
+					::curl_easy_setopt(curl, ::CURLOPT_NOSIGNAL, 1L);
+					::curl_easy_setopt(curl, ::CURLOPT_PRIVATE, active.get());
+					::curl_easy_setopt(curl, ::CURLOPT_STREAM_WEIGHT, StreamWeight(t.options.priority));
+
+					// 制限時間
+					if (t.deadlineMicrosec)
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_TIMEOUT_MS, static_cast<long>(Max<int64>((remainingMicrosec / 1000), 1)));
+					}
+
+					if (t.options.connectTimeout.count() > 0)
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(t.options.connectTimeout.count()));
+					}
+
+					if ((t.options.lowSpeedBytesPerSec > 0) && (t.options.lowSpeedTime.count() > 0))
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(t.options.lowSpeedBytesPerSec));
+						::curl_easy_setopt(curl, ::CURLOPT_LOW_SPEED_TIME, static_cast<long>(t.options.lowSpeedTime.count()));
+					}
+
+					// libcurl は文字列をコピーする
+					if (!t.options.unixSocketPath.isEmpty())
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_UNIX_SOCKET_PATH, t.options.unixSocketPath.toUTF8().c_str());
+					}
+
+					active->hostBandwidth = hostBandwidth;
+					active->recvBandwidth.setRate(t.maxRecvBytesPerSec.load(std::memory_order_relaxed));
+					active->maxSendBytesPerSec = t.maxSendBytesPerSec.load(std::memory_order_relaxed);
+					::curl_easy_setopt(curl, ::CURLOPT_MAX_SEND_SPEED_LARGE, static_cast<::curl_off_t>(active->maxSendBytesPerSec));
+
+					// POST
+					if (t.form)
+					{
+						active->form = std::make_unique<FormUpload>(curl, *t.form);
+						::curl_easy_setopt(curl, ::CURLOPT_MIMEPOST, active->form->mime());
+					}
+					else if (t.post)
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_POST, 1L);
+						::curl_easy_setopt(curl, ::CURLOPT_POSTFIELDS, const_cast<char*>(static_cast<const char*>(t.postData)));
+						::curl_easy_setopt(curl, ::CURLOPT_POSTFIELDSIZE, static_cast<long>(t.postSize));
+					}
+
+					active->writeContext.curl = curl;
+					active->writeContext.transfer = &t;
+					active->writeContext.sink = &sink;
+					active->writeContext.digester = (active->digester->isEnabled() ? active->digester.get() : nullptr);
+					active->writeContext.recvBuckets = { &m_bandwidth.recv, &active->hostBandwidth->recv, &active->recvBandwidth };
+					active->writeContext.pauseMask = &active->pauseMask;
+
+					::curl_easy_setopt(curl, ::CURLOPT_WRITEFUNCTION, CallbackWrite);
+					::curl_easy_setopt(curl, ::CURLOPT_WRITEDATA, &active->writeContext);
+
+					if (t.reportProgress)
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_XFERINFOFUNCTION, XferInfo);
+						::curl_easy_setopt(curl, ::CURLOPT_XFERINFODATA, &active->writeContext);
+						::curl_easy_setopt(curl, ::CURLOPT_NOPROGRESS, 0L);
+					}
+
+					// レスポンスヘッダーの設定
+					::curl_easy_setopt(curl, ::CURLOPT_HEADERFUNCTION, HeaderCallback);
+					::curl_easy_setopt(curl, ::CURLOPT_HEADERDATA, &active->headerString);
+
+					if (t.options.autoFollowLocation)
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_FOLLOWLOCATION, 1L);
+					}
+
+					active->performBegin = (t.trace.isEnabled() ? GetTraceMicrosec() : 0);
+
+					return active;
+				}
+
+				[[nodiscard]] static bool IsHedgeable(const HTTPEngineTransfer& transfer)
+				{
+					return (transfer.options.hedge.enabled && !transfer.post && transfer.mirrors.isEmpty() && !transfer.sink->isStreaming());
+				}
+
+				/// <summary>
+				/// ホストの TTFB の分布から、ヘッジするまでの待ち時間（マイクロ秒）を求めます。
+				/// </summary>
+				[[nodiscard]] static int64 getHedgeDelay(const HTTPEngineTransfer& transfer)
+				{
+					const HTTPHedgePolicy& policy = transfer.options.hedge;
+					const HTTPLatencyHistogram ttfb = transfer.metrics.loadHostTTFB();
+
+					if (ttfb.count >= policy.minSamples)
+					{
+						if (const auto percentileMs = ttfb.percentileMs(Clamp(policy.percentile, 0.0, 1.0)))
+						{
+							return static_cast<int64>(Max(*percentileMs, static_cast<double>(policy.minDelay.count())) * 1000);
+						}
+					}
+
+					return (policy.fallbackDelay.count() * 1000);
+				}
+
+				/// <summary>
+				/// 実行中の通信と同じ通信を、別の接続またはミラーで開始します。
+				/// 本文はメモリに保持し、先に応答した方を使います。
+				/// </summary>
+				void startHedge(ActiveTransfer& primary)
+				{
+					HTTPEngineTransfer& t = *primary.transfer;
+					const HTTPHedgePolicy& policy = t.options.hedge;
+
+					::CURL* curl = acquireHandle();
+
+					if (!curl)
+					{
+						return;
+					}
+
+					const URLView url = (policy.mirrors.isEmpty() ? URLView(t.url)
+						: URLView(policy.mirrors[std::uniform_int_distribution<size_t>(0, (policy.mirrors.size() - 1))(m_random)]));
+
+					auto sink = std::make_unique<MemoryFileSink>();
+					auto hedge = setup(primary.transfer, curl, url, *sink, primary.hostBandwidth);
+					hedge->hedgeSink = std::move(sink);
+					hedge->isHedge = true;
+					hedge->peer = primary.curl;
+					hedge->writeContext.hedging = true;
+
+					// 同じ URL の場合、応答の遅い接続に HTTP/2 で多重化されないように新しい接続を使う
+					if (policy.mirrors.isEmpty())
+					{
+						::curl_easy_setopt(curl, ::CURLOPT_FRESH_CONNECT, 1L);
+					}
+
+					if (::curl_multi_add_handle(m_multi, curl) != ::CURLM_OK)
+					{
+						::curl_slist_free_all(hedge->headerList);
+						releaseHandle(curl);
+						return;
+					}
+
+					primary.peer = curl;
+					primary.writeContext.hedging = true;
+					m_active.emplace(curl, std::move(hedge));
+					t.metrics.hedged();
+				}
+
+				/// <summary>
+				/// 実行中の通信を、結果を返さずに取り除きます。
+				/// </summary>
+				std::unique_ptr<ActiveTransfer> detach(::CURL* curl)
+				{
+					auto it = m_active.find(curl);
+
+					if (it == m_active.end())
+					{
+						return nullptr;
+					}
+
+					std::unique_ptr<ActiveTransfer> active = std::move(it->second);
+					m_active.erase(it);
+
+					::curl_multi_remove_handle(m_multi, curl);
+					::curl_slist_free_all(active->headerList);
+					active->headerList = nullptr;
+					active->curl = nullptr;
+					releaseHandle(curl);
+
+					return active;
+				}
+
+				/// <summary>
+				/// ヘッジした 2 つの通信のうち、使わない方を破棄します。
+				/// 破棄するのが元の通信の場合、ヘッジした通信が元の通信の枠を引き継ぎます。
+				/// 受信したバイト数と進捗は、残した方の値だけを公開します。
+				/// </summary>
+				void abandon(::CURL* curl)
+				{
+					const std::unique_ptr<ActiveTransfer> loser = detach(curl);
+
+					if (!loser)
+					{
+						return;
+					}
+
+					if (auto winner = m_active.find(loser->peer); winner != m_active.end())
+					{
+						winner->second->peer = nullptr;
+						CommitHedging(winner->second->writeContext);
+
+						if (!loser->isHedge)
+						{
+							winner->second->isHedge = false;
+							winner->second->transfer->metrics.hedgeWon();
+						}
+					}
+				}
+
+				/// <summary>
+				/// 失敗していないミラーのうち、受信の速度と失敗の割合から最も良いものを選びます。
+				/// まだ使ったことのないミラーを優先し、他の区間で受信中のミラーは避けます。
+				/// </summary>
+				[[nodiscard]] Optional<size_t> selectMirror(const HTTPEngineTransfer& transfer, const MirrorDownload& mirror, const Optional<size_t> exclude) const
+				{
+					Optional<size_t> best;
+					double bestScore = -1.0;
+
+					for (size_t i = 0; i < transfer.mirrors.size(); ++i)
+					{
+						if (mirror.failed[i] || (exclude && (*exclude == i)))
+						{
+							continue;
+						}
+
+						const auto stats = m_origins.find(String(GetURLHost(transfer.mirrors[i])));
+						const double score = ((stats != m_origins.end()) ? stats->second.score() : OriginStats{}.score());
+						const size_t users = std::count_if(mirror.segments.begin(), mirror.segments.end(),
+							[i](const MirrorSegment& segment) { return (segment.curl && (segment.mirrorIndex == i)); });
+
+						if (const double adjusted = (score / (1.0 + users)); bestScore < adjusted)
+						{
+							best = i;
+							bestScore = adjusted;
+						}
+					}
+
+					return best;
+				}
+
+				/// <summary>
+				/// easy ハンドルに、ミラーからのダウンロードの区間を受信する設定を行います。
+				/// </summary>
+				void configureMirror(ActiveTransfer& active, MirrorDownload& mirror, const size_t segmentIndex, const size_t mirrorIndex)
+				{
+					MirrorSegment& segment = mirror.segments[segmentIndex];
+
+					active.mirror = &mirror;
+					active.segmentIndex = segmentIndex;
+					active.mirrorIndex = mirrorIndex;
+					active.startMicrosec = active.rateWindowBeginMicrosec = GetEngineMicrosec();
+
+					segment.curl = active.curl;
+					segment.mirrorIndex = mirrorIndex;
+
+					// 受信済みの位置から
+					if (0 < segment.position())
+					{
+						const std::string range = ((segment.end < 0) ? U"{}-"_fmt(segment.position()) : U"{}-{}"_fmt(segment.position(), (segment.end - 1))).toUTF8();
+						::curl_easy_setopt(active.curl, ::CURLOPT_RANGE, range.c_str());
+					}
+
+					// 進行状況は、すべての区間の合計を CallbackWriteMirror で更新する
+					::curl_easy_setopt(active.curl, ::CURLOPT_NOPROGRESS, 1L);
+					::curl_easy_setopt(active.curl, ::CURLOPT_WRITEFUNCTION, CallbackWriteMirror);
+					::curl_easy_setopt(active.curl, ::CURLOPT_WRITEDATA, &active);
+
+					++mirror.running;
+				}
+
+				/// <summary>
+				/// ミラーからのダウンロードの区間を、指定したミラーから受信する通信を開始します。
+				/// 元の通信の枠（同時に実行する通信の数）は、ミラーからのダウンロード全体で 1 つです。
+				/// </summary>
+				bool startSegment(const std::shared_ptr<HTTPEngineTransfer>& transfer, MirrorDownload& mirror, const size_t segmentIndex, const size_t mirrorIndex,
+					const std::shared_ptr<BandwidthBuckets>& hostBandwidth)
+				{
+					::CURL* curl = acquireHandle();
+
+					if (!curl)
+					{
+						return false;
+					}
+
+					auto active = setup(transfer, curl, transfer->mirrors[mirrorIndex], *transfer->sink, hostBandwidth);
+					configureMirror(*active, mirror, segmentIndex, mirrorIndex);
+
+					if (::curl_multi_add_handle(m_multi, curl) != ::CURLM_OK)
+					{
+						::curl_slist_free_all(active->headerList);
+						releaseHandle(curl);
+						mirror.segments[segmentIndex].curl = nullptr;
+						--mirror.running;
+						return false;
+					}
+
+					m_active.emplace(curl, std::move(active));
+					return true;
+				}
+
+				/// <summary>
+				/// ミラーのホストの受信の速度と失敗の割合を記録します。
+				/// </summary>
+				void recordOrigin(const ActiveTransfer& active, const bool failed)
+				{
+					OriginStats& stats = m_origins[String(GetURLHost(active.transfer->mirrors[active.mirrorIndex]))];
+					stats.addResult(failed);
+
+					const int64 elapsedMicrosec = (GetEngineMicrosec() - active.startMicrosec);
+
+					if ((MinThroughputSampleBytes <= active.receivedSize) && (0 < elapsedMicrosec))
+					{
+						stats.addThroughput(active.receivedSize * 1'000'000.0 / elapsedMicrosec);
+					}
+				}
+
+				/// <summary>
+				/// ミラーからのダウンロードの区間の通信が終わったときに呼びます。
+				/// 失敗した場合は別のミラーで続け、すべての区間の通信が終わった場合だけ、全体の結果を返します。
+				/// </summary>
+				Optional<::CURLcode> completeMirror(ActiveTransfer& active, const ::CURLcode result)
+				{
+					HTTPEngineTransfer& transfer = *active.transfer;
+					MirrorDownload& mirror = *active.mirror;
+					MirrorSegment& segment = mirror.segments[active.segmentIndex];
+					const bool canceled = transfer.isCancelRequested();
+
+					segment.curl = nullptr;
+					--mirror.running;
+
+					// 長さが不明なレスポンスは、正常に終わった位置がファイルの終わり
+					if ((result == ::CURLE_OK) && !active.rejected && (segment.end < 0))
+					{
+						segment.end = segment.position();
+					}
+
+					const bool succeeded = ((active.segmentFinished || ((result == ::CURLE_OK) && !active.rejected)) && segment.isCompleted());
+
+					if (!canceled)
+					{
+						recordOrigin(active, !succeeded);
+					}
+
+					if (!succeeded && !canceled && !mirror.failedResult)
+					{
+						mirror.failed[active.mirrorIndex] = true;
+
+						if (const auto next = selectMirror(transfer, mirror, none);
+							next && startSegment(active.transfer, mirror, active.segmentIndex, *next, active.hostBandwidth))
+						{
+							transfer.metrics.mirrorSwitched();
+							return none;
+						}
+
+						mirror.failedResult = (active.rejected ? ::CURLE_HTTP_RETURNED_ERROR : ((result == ::CURLE_OK) ? ::CURLE_PARTIAL_FILE : result));
+
+						// すべてのミラーが失敗した。他の区間も中断する
+						for (auto& other : mirror.segments)
+						{
+							if (other.curl)
+							{
+								detach(other.curl);
+								other.curl = nullptr;
+								--mirror.running;
+							}
+						}
+					}
+
+					if (mirror.running != 0)
+					{
+						return none;
+					}
+
+					::CURLcode finalResult = ::CURLE_OK;
+
+					if (canceled)
+					{
+						finalResult = ::CURLE_ABORTED_BY_CALLBACK;
+					}
+					else if (mirror.failedResult)
+					{
+						finalResult = *mirror.failedResult;
+					}
+					else if (!std::all_of(mirror.segments.begin(), mirror.segments.end(), [](const MirrorSegment& s) { return s.isCompleted(); }))
+					{
+						finalResult = ::CURLE_PARTIAL_FILE;
+					}
+
+					if (!mirror.header.isEmpty())
+					{
+						active.headerString = mirror.header;
+					}
+
+					active.digester = std::move(mirror.digester);
+					active.mirror = nullptr;
+					m_mirrorDownloads.erase(&transfer);
+
+					return finalResult;
+				}
+
+				/// <summary>
+				/// サイズが分かったファイルを区間に分け、残りの区間を他のミラーから同時に受信します。
+				/// </summary>
+				void splitMirror(MirrorDownload& mirror)
+				{
+					::CURL* const firstCurl = mirror.segments.front().curl;
+
+					if (mirror.split || (mirror.segments.size() != 1) || !firstCurl)
+					{
+						return;
+					}
+
+					const ActiveTransfer& first = *m_active.find(firstCurl)->second;
+					const std::shared_ptr<HTTPEngineTransfer> transfer = first.transfer;
+					const std::shared_ptr<BandwidthBuckets> hostBandwidth = first.hostBandwidth;
+					const HTTPMirrorPolicy& policy = transfer->options.mirror;
+
+					const int64 from = mirror.segments.front().position();
+					const int64 remaining = (mirror.totalSize - from);
+					const size_t count = static_cast<size_t>(Clamp<int64>((remaining / Max<int64>(policy.minSegmentSize, 1)), 1, static_cast<int64>(policy.parallelSegments)));
+
+					if (count < 2)
+					{
+						return;
+					}
+
+					const int64 segmentSize = (remaining / static_cast<int64>(count));
+
+					mirror.split = true;
+					mirror.segments.front().end = (from + segmentSize);
+
+					for (size_t i = 1; i < count; ++i)
+					{
+						MirrorSegment segment;
+						segment.begin = (from + (segmentSize * static_cast<int64>(i)));
+						segment.end = (((i + 1) == count) ? mirror.totalSize : (segment.begin + segmentSize));
+						mirror.segments.push_back(segment);
+
+						const auto next = selectMirror(*transfer, mirror, none);
+
+						if (!next || !startSegment(transfer, mirror, (mirror.segments.size() - 1), *next, hostBandwidth))
+						{
+							// 開始できなかった区間は、1 つ前の区間で受信する
+							mirror.segments.pop_back();
+							mirror.segments.back().end = mirror.totalSize;
+							break;
+						}
+					}
+				}
+
+				/// <summary>
+				/// 受信の速度が HTTPMirrorPolicy::minBytesPerSec を下回ったミラーを、受信済みの位置から別のミラーに切り替えます。
+				/// </summary>
+				void switchMirror(::CURL* curl)
+				{
+					ActiveTransfer& active = *m_active.find(curl)->second;
+					MirrorDownload& mirror = *active.mirror;
+					const auto next = selectMirror(*active.transfer, mirror, active.mirrorIndex);
+
+					if (!next)
+					{
+						return;
+					}
+
+					recordOrigin(active, false);
+
+					// 切り替え先も同じように遅いことが分かっている場合は、切り替えない
+					const auto current = m_origins.find(String(GetURLHost(active.transfer->mirrors[active.mirrorIndex])));
+					const auto candidate = m_origins.find(String(GetURLHost(active.transfer->mirrors[*next])));
+
+					if ((current != m_origins.end()) && (candidate != m_origins.end()) && (candidate->second.score() <= current->second.score()))
+					{
+						return;
+					}
+
+					// 新しい通信を開始できた場合だけ、遅い通信を取り除く
+					MirrorSegment& segment = mirror.segments[active.segmentIndex];
+					segment.curl = nullptr;
+					--mirror.running;
+
+					if (!startSegment(active.transfer, mirror, active.segmentIndex, *next, active.hostBandwidth))
+					{
+						segment.curl = curl;
+						segment.mirrorIndex = active.mirrorIndex;
+						++mirror.running;
+						return;
+					}
+
+					active.transfer->metrics.mirrorSwitched();
+					detach(curl);
+				}
+
+				/// <summary>
+				/// ミラーからのダウンロードで、区間に分けられるようになったものを分け、遅いミラーを切り替えます。
+				/// </summary>
+				void updateMirrors()
+				{
+					if (m_mirrorDownloads.empty())
+					{
+						return;
+					}
+
+					for (auto& [transfer, mirror] : m_mirrorDownloads)
+					{
+						if (mirror->splitRequested)
+						{
+							mirror->splitRequested = false;
+							splitMirror(*mirror);
+						}
+					}
+
+					const int64 now = GetEngineMicrosec();
+					Array<::CURL*> slow;
+
+					for (auto& [curl, active] : m_active)
+					{
+						if (!active->mirror)
+						{
+							continue;
+						}
+
+						const HTTPMirrorPolicy& policy = active->transfer->options.mirror;
+
+						// 帯域の上限などで一時停止している間は測らない
+						if ((policy.minBytesPerSec <= 0) || (active->pauseMask != CURLPAUSE_CONT))
+						{
+							active->rateWindowBeginMicrosec = now;
+							active->rateWindowBytes = 0;
+							continue;
+						}
+
+						const int64 elapsedMicrosec = (now - active->rateWindowBeginMicrosec);
+
+						if (elapsedMicrosec < (policy.slowTime.count() * 1000))
+						{
+							continue;
+						}
+
+						if ((active->rateWindowBytes * 1'000'000 / Max<int64>(elapsedMicrosec, 1)) < policy.minBytesPerSec)
+						{
+							slow.push_back(curl);
+						}
+
+						active->rateWindowBeginMicrosec = now;
+						active->rateWindowBytes = 0;
+					}
+
+					for (::CURL* curl : slow)
+					{
+						switchMirror(curl);
+					}
+				}
+
+				/// <summary>
+				/// 最初のバイトが遅い通信をヘッジし、ヘッジ中の 2 つの通信のうち先に応答した方を残します。
+				/// </summary>
+				void updateHedges()
+				{
+					const int64 now = GetEngineMicrosec();
+
+					Array<::CURL*> losers;
+					Array<::CURL*> slow;
+
+					for (const auto& [curl, active] : m_active)
+					{
+						if (active->isHedge)
+						{
+							continue;
+						}
+
+						if (active->peer)
+						{
+							const ActiveTransfer& hedge = *m_active.find(active->peer)->second;
+
+							if (!active->headerString.isEmpty())
+							{
+								losers.push_back(active->peer);
+							}
+							else if (!hedge.headerString.isEmpty())
+							{
+								losers.push_back(curl);
+							}
+						}
+						else if (active->hedgeAtMicrosec && (active->hedgeAtMicrosec <= now))
+						{
+							active->hedgeAtMicrosec = 0;
+
+							if (active->headerString.isEmpty() && !active->transfer->isCancelRequested())
+							{
+								slow.push_back(curl);
+							}
+						}
+						else if (!active->headerString.isEmpty())
+						{
+							active->hedgeAtMicrosec = 0;
+						}
+					}
+
+					for (::CURL* curl : losers)
+					{
+						abandon(curl);
+					}
+
+					for (::CURL* curl : slow)
+					{
+						// ヘッジの割合の上限
+						if (m_hedgeBudget < 1.0)
+						{
+							break;
+						}
+
+						m_hedgeBudget -= 1.0;
+						startHedge(*m_active[curl]);
+					}
+				}
+
+				/// <summary>
+				/// 次にヘッジする時刻。無い場合は 0
+				/// </summary>
+				[[nodiscard]] int64 nextHedgeMicrosec() const
+				{
+					int64 result = 0;
+
+					for (const auto& [curl, active] : m_active)
+					{
+						if (active->hedgeAtMicrosec && ((result == 0) || (active->hedgeAtMicrosec < result)))
+						{
+							result = active->hedgeAtMicrosec;
+						}
+					}
+
+					return result;
+				}
+
+				[[nodiscard]] bool hasInteractive() const
+				{
+					constexpr size_t interactive = PriorityIndex(HTTPPriority::Interactive);
+
+					return ((m_activeCount[interactive] != 0) || !m_hostOrder[interactive].empty());
+				}
+
+				[[nodiscard]] bool shouldPauseBackground() const
+				{
+					return (PauseBackgroundWhileInteractive.load(std::memory_order_relaxed) && hasInteractive());
+				}
+
+				/// <summary>
+				/// 全体の上限に数える実行中の通信の数。ヘッジやミラーの区間の easy ハンドルは数えず、元の通信の 1 つだけを数えます。
+				/// </summary>
+				[[nodiscard]] size_t activeTransfers() const
+				{
+					size_t result = 0;
+
+					for (const size_t count : m_activeCount)
+					{
+						result += count;
+					}
+
+					return result;
+				}
+
+				/// <summary>
+				/// 上限に達するまで、優先度の高い順に、待機中の通信があるホストを順番に 1 つずつ選んで開始します。
+				/// Background の通信を一時停止する間は、その通信を上限に数えません。
+				/// 上限が Background の通信で埋まっていても、待機中の Interactive の通信を開始できます。
+				/// </summary>
+				void dispatch()
+				{
+					const size_t maxTransfers = Max<size_t>(MaxTransfers.load(std::memory_order_relaxed), 1);
+					const size_t maxTransfersPerHost = Max<size_t>(MaxTransfersPerHost.load(std::memory_order_relaxed), 1);
+					const bool pauseBackground = shouldPauseBackground();
+					const size_t pausedTransfers = (pauseBackground ? m_activeCount[PriorityIndex(HTTPPriority::Background)] : 0);
+
+					for (size_t priority = 0; priority < PriorityCount; ++priority)
+					{
+						if ((priority == PriorityIndex(HTTPPriority::Background)) && pauseBackground)
+						{
+							break;
+						}
+
+						std::deque<String>& hostOrder = m_hostOrder[priority];
+
+						// 上限に達しているために飛ばしたホストの数
+						size_t skipped = 0;
+
+						while (((activeTransfers() - pausedTransfers) < maxTransfers) && (skipped < hostOrder.size()))
+						{
+							const String host = std::move(hostOrder.front());
+							hostOrder.pop_front();
+
+							HostQueue& queue = m_hosts[host];
+							auto& pending = queue.pending[priority];
+
+							if (pending.empty())
+							{
+								continue;
+							}
+
+							const size_t hostActive = (queue.active - (pauseBackground ? queue.activeBackground : 0));
+
+							if (hostActive >= getHostLimit(host, maxTransfersPerHost))
+							{
+								hostOrder.push_back(host);
+								++skipped;
+								continue;
+							}
+
+							const std::shared_ptr<HTTPEngineTransfer> transfer = std::move(pending.front());
+							pending.pop_front();
+							++queue.active;
+							skipped = 0;
+
+							if (priority == PriorityIndex(HTTPPriority::Background))
+							{
+								++queue.activeBackground;
+							}
+
+							if (!pending.empty())
+							{
+								hostOrder.push_back(host);
+							}
+
+							if (!start(transfer, queue.bandwidth))
+							{
+								releaseHost(*transfer);
+							}
+						}
+					}
+				}
+
+				/// <summary>
+				/// HTTPAdaptiveConcurrency の変更を反映します。変更した場合、調整した上限はすべて初期値に戻します。
+				/// </summary>
+				void updateAdaptiveConcurrency()
+				{
+					const uint64 version = AdaptiveConcurrencyVersion.load(std::memory_order_acquire);
+
+					if (version == m_adaptiveConcurrencyVersion)
+					{
+						return;
+					}
+
+					{
+						std::lock_guard lock(AdaptiveConcurrencyMutex);
+						m_adaptiveConcurrency = AdaptiveConcurrency;
+					}
+
+					m_adaptiveConcurrencyVersion = version;
+
+					for (const auto& [host, limiter] : m_concurrencyLimiters)
+					{
+						SetHostConcurrencyLimit(host, 0);
+					}
+
+					m_concurrencyLimiters.clear();
+				}
+
+				ConcurrencyLimiter& getConcurrencyLimiter(const String& host, const size_t maxTransfersPerHost)
+				{
+					auto it = m_concurrencyLimiters.find(host);
+
+					if (it == m_concurrencyLimiters.end())
+					{
+						ConcurrencyLimiter limiter{ static_cast<double>(m_adaptiveConcurrency.initialLimit) };
+						limiter.setLimit(static_cast<double>(m_adaptiveConcurrency.initialLimit), m_adaptiveConcurrency, maxTransfersPerHost);
+
+						it = m_concurrencyLimiters.emplace(host, limiter).first;
+						SetHostConcurrencyLimit(host, static_cast<int64>(limiter.limit()));
+					}
+
+					it->second.touch(GetEngineMicrosec());
+
+					return it->second;
+				}
+
+				/// <summary>
+				/// 通信の無いまま IdleLimiterMicrosec 以上使われていないホストの上限を破棄します。
+				/// 続けて通信するホストは調整した上限を保ち、多数のホストに通信した場合も m_concurrencyLimiters が増え続けないようにします。
+				/// </summary>
+				void pruneConcurrencyLimiters()
+				{
+					const int64 now = GetEngineMicrosec();
+
+					if ((now - m_limitersPrunedMicrosec) < IdleLimiterMicrosec)
+					{
+						return;
+					}
+
+					m_limitersPrunedMicrosec = now;
+
+					for (auto it = m_concurrencyLimiters.begin(); it != m_concurrencyLimiters.end();)
+					{
+						if ((m_hosts.find(it->first) == m_hosts.end()) && (IdleLimiterMicrosec <= (now - it->second.usedMicrosec())))
+						{
+							SetHostConcurrencyLimit(it->first, 0);
+							it = m_concurrencyLimiters.erase(it);
+						}
+						else
+						{
+							++it;
+						}
+					}
+				}
+
+				/// <summary>
+				/// ホストの同時に実行する通信の数の上限
+				/// </summary>
+				[[nodiscard]] size_t getHostLimit(const String& host, const size_t maxTransfersPerHost)
+				{
+					if (!m_adaptiveConcurrency.enabled)
+					{
+						return maxTransfersPerHost;
+					}
+
+					return Min(getConcurrencyLimiter(host, maxTransfersPerHost).limit(), maxTransfersPerHost);
+				}
+
+				/// <summary>
+				/// 終わった通信の TTFB と結果から、ホストの同時に実行する通信の数の上限を調整します。
+				/// </summary>
+				void updateConcurrencyLimit(const ActiveTransfer& active)
+				{
+					const String& host = active.transfer->host;
+					const size_t maxTransfersPerHost = Max<size_t>(MaxTransfersPerHost.load(std::memory_order_relaxed), 1);
+					const auto queue = m_hosts.find(host);
+
+					if (!m_adaptiveConcurrency.enabled || (queue == m_hosts.end()))
+					{
+						return;
+					}
+
+					bool congested = false;
+
+					switch (active.result)
+					{
+					case ::CURLE_OK:
+						{
+							long statusCode = 0;
+							::curl_easy_getinfo(active.curl, ::CURLINFO_RESPONSE_CODE, &statusCode);
+
+							congested = ((statusCode == static_cast<long>(HTTPResponseStatusCode::TooManyRequests))
+								|| (statusCode == static_cast<long>(HTTPResponseStatusCode::ServiceUnavailable)));
+							break;
+						}
+					case ::CURLE_OPERATION_TIMEDOUT:
+					case ::CURLE_COULDNT_CONNECT:
+					case ::CURLE_SEND_ERROR:
+					case ::CURLE_RECV_ERROR:
+					case ::CURLE_GOT_NOTHING:
+						congested = true;
+						break;
+					default:
+						// キャンセルやファイルの書き込みの失敗などは、混雑とは関係ない
+						return;
+					}
+
+					ConcurrencyLimiter& limiter = getConcurrencyLimiter(host, maxTransfersPerHost);
+					const size_t previous = limiter.limit();
+
+					if (congested)
+					{
+						limiter.onDrop(GetEngineMicrosec(), m_adaptiveConcurrency, maxTransfersPerHost);
+					}
+					else if (active.info.ttfbMicrosec > 0)
+					{
+						limiter.onSample(active.info.ttfbMicrosec, queue->second.active, m_adaptiveConcurrency, maxTransfersPerHost);
+					}
+
+					if (limiter.limit() != previous)
+					{
+						SetHostConcurrencyLimit(host, static_cast<int64>(limiter.limit()));
+					}
+				}
+
+				/// <summary>
+				/// 前回から送信したバイト数を、全体とホストのトークンバケットから差し引きます。
+				/// 受信したバイト数は CallbackWrite で差し引きます。
+				/// </summary>
+				void consumeSendBandwidth(ActiveTransfer& active)
+				{
+					::curl_off_t uploaded = 0;
+					::curl_easy_getinfo(active.curl, ::CURLINFO_SIZE_UPLOAD_T, &uploaded);
+
+					const int64 sendSize = (uploaded - active.uploadedSize);
+
+					if (sendSize <= 0)
+					{
+						return;
+					}
+
+					active.uploadedSize = uploaded;
+
+					m_bandwidth.send.consume(sendSize);
+					active.hostBandwidth->send.consume(sendSize);
+				}
+
+				/// <summary>
+				/// 帯域の上限の変更を反映し、トークンバケットを更新します。
+				/// </summary>
+				void updateBandwidth()
+				{
+					m_bandwidth.setLimit({ MaxRecvBytesPerSec.load(std::memory_order_relaxed), MaxSendBytesPerSec.load(std::memory_order_relaxed) });
+
+					if (const uint64 version = HostBandwidthLimitsVersion.load(std::memory_order_acquire);
+						version != m_hostBandwidthLimitsVersion)
+					{
+						{
+							std::lock_guard lock(HostBandwidthLimitsMutex);
+							m_hostBandwidthLimits = HostBandwidthLimits;
+						}
+
+						m_hostBandwidthLimitsVersion = version;
+
+						for (auto& [host, queue] : m_hosts)
+						{
+							const auto limit = m_hostBandwidthLimits.find(host);
+							queue.bandwidth->setLimit((limit != m_hostBandwidthLimits.end()) ? limit->second : BandwidthLimit{});
+						}
+					}
+
+					const int64 now = GetEngineMicrosec();
+					const double elapsedSec = ((m_bandwidthUpdatedMicrosec == 0) ? 0.0 : ((now - m_bandwidthUpdatedMicrosec) / 1'000'000.0));
+					m_bandwidthUpdatedMicrosec = now;
+
+					m_bandwidth.refill(elapsedSec);
+
+					for (auto& [host, queue] : m_hosts)
+					{
+						queue.bandwidth->refill(elapsedSec);
+					}
+
+					for (auto& [curl, active] : m_active)
+					{
+						HTTPEngineTransfer& transfer = *active->transfer;
+
+						active->recvBandwidth.setRate(transfer.maxRecvBytesPerSec.load(std::memory_order_relaxed));
+						active->recvBandwidth.refill(elapsedSec);
+
+						// 送信は CURLOPT_POSTFIELDS か CURLOPT_MIMEPOST で libcurl が直接行うため、通信ごとの上限は libcurl に任せる
+						if (const int64 maxSendBytesPerSec = transfer.maxSendBytesPerSec.load(std::memory_order_relaxed);
+							maxSendBytesPerSec != active->maxSendBytesPerSec)
+						{
+							active->maxSendBytesPerSec = maxSendBytesPerSec;
+							::curl_easy_setopt(curl, ::CURLOPT_MAX_SEND_SPEED_LARGE, static_cast<::curl_off_t>(maxSendBytesPerSec));
+						}
+
+						consumeSendBandwidth(*active);
+					}
+				}
+
+				/// <summary>
+				/// 優先度と帯域の状態に合わせて、実行中の通信を一時停止または再開します。
+				/// </summary>
+				void updatePause()
+				{
+					const bool pauseBackground = shouldPauseBackground();
+
+					for (auto& [curl, active] : m_active)
+					{
+						int pauseMask = CURLPAUSE_CONT;
+
+						if (pauseBackground && (active->transfer->options.priority == HTTPPriority::Background))
+						{
+							pauseMask = CURLPAUSE_ALL;
+						}
+
+						const bool recvExhausted = (m_bandwidth.recv.isExhausted()
+							|| active->hostBandwidth->recv.isExhausted() || active->recvBandwidth.isExhausted());
+						const bool sendExhausted = (m_bandwidth.send.isExhausted() || active->hostBandwidth->send.isExhausted());
+
+						if (recvExhausted)
+						{
+							pauseMask |= CURLPAUSE_RECV;
+						}
+
+						if (sendExhausted)
+						{
+							pauseMask |= CURLPAUSE_SEND;
+						}
+
+						if (pauseMask != active->pauseMask)
+						{
+							active->pauseMask = pauseMask;
+							::curl_easy_pause(curl, pauseMask);
+						}
+					}
+				}
+
+				/// <summary>
+				/// 帯域の上限で一時停止した通信を再開できるまでの時間（ミリ秒）
+				/// </summary>
+				[[nodiscard]] int32 bandwidthRefillMillisec() const
+				{
+					int32 result = m_bandwidth.refillMillisec();
+
+					for (const auto& [host, queue] : m_hosts)
+					{
+						result = Max(result, queue.bandwidth->refillMillisec());
+					}
+
+					for (const auto& [curl, active] : m_active)
+					{
+						result = Max(result, active->recvBandwidth.refillMillisec());
+					}
+
+					return result;
+				}
+
+				/// <summary>
+				/// HTTPRetryPolicy に従って再試行する場合は再試行する時刻を、しない場合は 0 を返します。
+				/// </summary>
+				int64 getRetryTime(const ActiveTransfer& active)
+				{
+					const HTTPEngineTransfer& transfer = *active.transfer;
+					const HTTPRetryPolicy& policy = transfer.options.retry;
+
+					if ((transfer.attempts >= policy.maxAttempts) || transfer.isCancelRequested())
+					{
+						return 0;
+					}
+
+					if (active.result == ::CURLE_OK)
+					{
+						long statusCode = 0;
+						::curl_easy_getinfo(active.curl, ::CURLINFO_RESPONSE_CODE, &statusCode);
+
+						if (!policy.retryableStatusCodes.includes(static_cast<HTTPResponseStatusCode>(statusCode)))
+						{
+							return 0;
+						}
+					}
+					else if (!IsRetryableError(active.result, policy))
+					{
+						return 0;
+					}
+
+					// 指数バックオフ
+					const double backoffMillisec = Min(policy.initialBackoff.count() * std::pow(policy.backoffMultiplier, (transfer.attempts - 1.0)),
+						static_cast<double>(policy.maxBackoff.count()));
+					int64 delayMicrosec = static_cast<int64>(backoffMillisec * 1000);
+
+					switch (policy.jitter)
+					{
+					case HTTPRetryJitter::Full:
+						delayMicrosec = std::uniform_int_distribution<int64>(0, delayMicrosec)(m_random);
+						break;
+					case HTTPRetryJitter::Equal:
+						delayMicrosec = ((delayMicrosec / 2) + std::uniform_int_distribution<int64>(0, (delayMicrosec / 2))(m_random));
+						break;
+					default:
+						break;
+					}
+
+					if (policy.honorRetryAfter && (active.result == ::CURLE_OK))
+					{
+						if (const auto retryAfterSec = ParseRetryAfter(active.headerString))
+						{
+							// maxBackoff より長く待つように指示された場合は、再試行せずにこのレスポンスを返す
+							if (*retryAfterSec > (policy.maxBackoff.count() / 1000))
+							{
+								return 0;
+							}
+
+							delayMicrosec = Max(delayMicrosec, (*retryAfterSec * 1'000'000));
+						}
+					}
+
+					const int64 retryAt = (GetEngineMicrosec() + delayMicrosec);
+
+					// 再試行しても期限に間に合わない
+					if (transfer.deadlineMicrosec && (transfer.deadlineMicrosec <= retryAt))
+					{
+						return 0;
+					}
+
+					return retryAt;
+				}
+
+				/// <summary>
+				/// 再試行する時刻になった通信を、待機中の通信に移します。
+				/// </summary>
+				void promoteDelayed()
+				{
+					const int64 now = GetEngineMicrosec();
+
+					while (!m_delayed.empty() && (m_delayed.begin()->first <= now))
+					{
+						const std::shared_ptr<HTTPEngineTransfer> transfer = std::move(m_delayed.begin()->second);
+						m_delayed.erase(m_delayed.begin());
+						enqueue(transfer);
+					}
+				}
+
+				void complete(::CURL* curl, ::CURLcode result)
+				{
+					auto it = m_active.find(curl);
+
+					if (it == m_active.end())
+					{
+						return;
+					}
+
+					// ヘッジ中の一方が終わった。応答の無いまま失敗した場合は、もう一方に任せる
+					if (::CURL* peer = it->second->peer)
+					{
+						if ((result != ::CURLE_OK) && it->second->headerString.isEmpty() && !it->second->transfer->isCancelRequested())
+						{
+							abandon(curl);
+							return;
+						}
+
+						abandon(peer);
+						it = m_active.find(curl);
+					}
+
+					// ミラーからのダウンロードは、すべての区間が終わったときに結果を返す
+					if (it->second->mirror)
+					{
+						const Optional<::CURLcode> mirrorResult = completeMirror(*it->second, result);
+
+						if (!mirrorResult)
+						{
+							detach(curl);
+							return;
+						}
+
+						result = *mirrorResult;
+						it = m_active.find(curl);
+					}
+
+					std::unique_ptr<ActiveTransfer> active = std::move(it->second);
+					m_active.erase(it);
+					consumeSendBandwidth(*active);
+
+					if (!active->transfer->bypassLimits)
+					{
+						--m_activeCount[PriorityIndex(active->transfer->options.priority)];
+					}
+
+					active->result = result;
+					active->info = GetTransferInfo(curl);
+					active->retryAtMicrosec = getRetryTime(*active);
+					updateConcurrencyLimit(*active);
+
+					::curl_multi_remove_handle(m_multi, curl);
+					::curl_slist_free_all(active->headerList);
+					active->headerList = nullptr;
+					active->curl = nullptr;
+					releaseHandle(curl);
+
+					releaseHost(*active->transfer);
+
+					m_completion.push(std::move(active));
+				}
+
+				/// <summary>
+				/// キャンセルが要求された通信と、開始を待っている間に期限を過ぎた通信を終了させます。
+				/// 実行中の通信の期限は、libcurl が CURLOPT_TIMEOUT_MS で処理します。
+				/// </summary>
+				void removeCanceled()
+				{
+					const int64 now = GetEngineMicrosec();
+					m_pendingDeadlineMicrosec = 0;
+
+					for (auto it = m_delayed.begin(); it != m_delayed.end();)
+					{
+						if (it->second->isCancelRequested())
+						{
+							m_completion.finish(it->second, HTTPError::Transfer);
+							it = m_delayed.erase(it);
+						}
+						else
+						{
+							++it;
+						}
+					}
+
+					for (auto hostIt = m_hosts.begin(); hostIt != m_hosts.end();)
+					{
+						const String& host = hostIt->first;
+						HostQueue& queue = hostIt->second;
+
+						for (size_t priority = 0; priority < PriorityCount; ++priority)
+						{
+							auto& pending = queue.pending[priority];
+
+							if (pending.empty())
+							{
+								continue;
+							}
+
+							for (auto it = pending.begin(); it != pending.end();)
+							{
+								if ((*it)->isCancelRequested())
+								{
+									m_completion.finish(*it, HTTPError::Transfer);
+									it = pending.erase(it);
+								}
+								else if ((*it)->deadlineMicrosec && ((*it)->deadlineMicrosec <= now))
+								{
+									m_completion.finish(*it, HTTPError::TimedOut);
+									it = pending.erase(it);
+								}
+								else
+								{
+									if ((*it)->deadlineMicrosec && (!m_pendingDeadlineMicrosec || ((*it)->deadlineMicrosec < m_pendingDeadlineMicrosec)))
+									{
+										m_pendingDeadlineMicrosec = (*it)->deadlineMicrosec;
+									}
+
+									++it;
+								}
+							}
+
+							// 待機中の通信が無くなったホストを、順番から外す
+							if (pending.empty())
+							{
+								std::deque<String>& hostOrder = m_hostOrder[priority];
+								hostOrder.erase(std::find(hostOrder.begin(), hostOrder.end(), host));
+							}
+						}
+
+						if ((queue.active == 0) && (queue.bypassed == 0) && !queue.hasPending())
+						{
+							hostIt = m_hosts.erase(hostIt);
+						}
+						else
+						{
+							++hostIt;
+						}
+					}
+
+					Array<::CURL*> canceled;
+
+					for (const auto& [curl, active] : m_active)
+					{
+						if (active->transfer->isCancelRequested())
+						{
+							canceled.push_back(curl);
+						}
+					}
+
+					for (::CURL* curl : canceled)
+					{
+						complete(curl, ::CURLE_ABORTED_BY_CALLBACK);
+					}
+				}
+
+				void processMessages()
+				{
+					int remaining = 0;
+
+					while (::CURLMsg* message = ::curl_multi_info_read(m_multi, &remaining))
+					{
+						if (message->msg == ::CURLMSG_DONE)
+						{
+							complete(message->easy_handle, message->data.result);
+						}
+					}
+				}
+
+				void run()
+				{
+					for (;;)
+					{
+						Array<std::shared_ptr<HTTPEngineTransfer>> incoming;
+						{
+							std::lock_guard lock(m_incomingMutex);
+
+							if (m_quit)
+							{
+								break;
+							}
+
+							incoming.swap(m_incoming);
+						}
+
+						for (const auto& transfer : incoming)
+						{
+							enqueue(transfer);
+						}
+
+						updateAdaptiveConcurrency();
+						removeCanceled();
+						promoteDelayed();
+						dispatch();
+						updateBandwidth();
+						updatePause();
+
+						int running = 0;
+						::curl_multi_perform(m_multi, &running);
+
+						processMessages();
+						updateHedges();
+						updateMirrors();
+						dispatch();
+						updateBandwidth();
+						updatePause();
+
+						::curl_waitfd wakeup = {};
+						wakeup.fd = m_wakeup.socket();
+						wakeup.events = CURL_WAIT_POLLIN;
+
+						// キャンセルや設定の変更は WakeEngine() で起こされる。起こせない場合は短い間隔で確認する
+						int timeoutMs = (m_wakeup.isValid() ? 1000 : WakeupPollMillisec);
+
+						// 帯域の上限で一時停止した通信は、トークンが溜まり次第再開する
+						if (const int32 refillMs = bandwidthRefillMillisec(); refillMs > 0)
+						{
+							timeoutMs = Clamp(refillMs, 1, timeoutMs);
+						}
+
+						// 再試行の時刻
+						if (!m_delayed.empty())
+						{
+							const int64 untilRetryMs = ((m_delayed.begin()->first - GetEngineMicrosec() + 999) / 1000);
+							timeoutMs = static_cast<int>(Clamp<int64>(untilRetryMs, 0, timeoutMs));
+						}
+
+						// 待機中の通信の期限
+						if (m_pendingDeadlineMicrosec)
+						{
+							const int64 untilDeadlineMs = ((m_pendingDeadlineMicrosec - GetEngineMicrosec() + 999) / 1000);
+							timeoutMs = static_cast<int>(Clamp<int64>(untilDeadlineMs, 0, timeoutMs));
+						}
+
+						// ヘッジする時刻
+						if (const int64 hedgeAt = nextHedgeMicrosec())
+						{
+							const int64 untilHedgeMs = ((hedgeAt - GetEngineMicrosec() + 999) / 1000);
+							timeoutMs = static_cast<int>(Clamp<int64>(untilHedgeMs, 0, timeoutMs));
+						}
+
+						::curl_multi_wait(m_multi, &wakeup, (m_wakeup.isValid() ? 1 : 0), timeoutMs, nullptr);
+
+						m_wakeup.drain();
+					}
+
+					// 残っている通信をすべてキャンセルする
+					for (const auto& [retryAt, transfer] : m_delayed)
+					{
+						transfer->requestCancel();
+						m_completion.finish(transfer, HTTPError::Transfer);
+					}
+
+					m_delayed.clear();
+
+					for (auto& [host, queue] : m_hosts)
+					{
+						for (auto& pending : queue.pending)
+						{
+							for (const auto& transfer : pending)
+							{
+								transfer->requestCancel();
+								m_completion.finish(transfer, HTTPError::Transfer);
+							}
+
+							pending.clear();
+						}
+					}
+
+					while (!m_active.empty())
+					{
+						m_active.begin()->second->transfer->requestCancel();
+						complete(m_active.begin()->first, ::CURLE_ABORTED_BY_CALLBACK);
+					}
+				}
+
+			public:
+
+				HTTPEngine()
+					: m_multi(::curl_multi_init())
+				{
+					m_thread = std::thread(&HTTPEngine::run, this);
+				}
+
+				~HTTPEngine()
+				{
+					{
+						std::lock_guard lock(m_incomingMutex);
+						m_quit = true;
+					}
+
+					m_wakeup.notify();
+					m_thread.join();
+
+					// 後処理を終えてから、HTTPEngine に届いたまま開始されなかった通信をキャンセルする
+					m_completion.stop();
+
+					for (const auto& transfer : m_incoming)
+					{
+						transfer->requestCancel();
+						FinishPending(transfer, HTTPError::Transfer);
+					}
+
+					for (::CURL* curl : m_idleHandles)
+					{
+						::curl_easy_cleanup(curl);
+					}
+
+					::curl_multi_cleanup(m_multi);
+				}
+
+				void submit(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+				{
+					{
+						std::lock_guard lock(m_incomingMutex);
+						m_incoming.push_back(transfer);
+					}
+
+					m_wakeup.notify();
+				}
+
+				void wake()
+				{
+					m_wakeup.notify();
+				}
+
+				/// <summary>
+				/// 再試行する通信を受け取ります。終了中の場合は false を返します。
+				/// </summary>
+				bool resubmit(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+				{
+					{
+						std::lock_guard lock(m_incomingMutex);
+
+						if (m_quit)
+						{
+							return false;
+						}
+
+						m_incoming.push_back(transfer);
+					}
+
+					m_wakeup.notify();
+
+					return true;
+				}
+			};
+
+			std::mutex EngineMutex;
+
+			std::unique_ptr<HTTPEngine> Engine;
+
+			// ShutdownEngine() の実行中は true
+			bool EngineShuttingDown = false;
+
+			bool ResubmitTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+			{
+				std::lock_guard lock(EngineMutex);
+
+				return (Engine && Engine->resubmit(transfer));
+			}
+		}
+
+		HTTPEngineTransfer::HTTPEngineTransfer(const URLView _url, const HTTPHeader& _header, const HTTPRequestOptions& _options, SinkFactory _createSink)
+			: url(_url)
+			, host(_options.unixSocketPath.isEmpty() ? String(GetURLHost(_url)) : (String(U"unix:") + _options.unixSocketPath))
+			, header(_header)
+			, options(_options)
+			, createSink(std::move(_createSink))
+			, sink(createSink())
+			, maxRecvBytesPerSec(_options.maxRecvBytesPerSec)
+			, maxSendBytesPerSec(_options.maxSendBytesPerSec)
+			, deadlineMicrosec((_options.timeout.count() > 0) ? (GetEngineMicrosec() + (_options.timeout.count() * 1000)) : 0)
+			, metrics(_url)
+			, trace(_url) {}
+
+		void HTTPAtomicProgress::load(HTTPProgress& progress) const
+		{
+			const int64 downloadTotal = downloadTotalSize.load(std::memory_order_relaxed);
+			const int64 uploadTotal = uploadTotalSize.load(std::memory_order_relaxed);
+
+			progress.status = status.load(std::memory_order_acquire);
+			progress.downloadNowSize = downloadNowSize.load(std::memory_order_relaxed);
+			progress.uploadNowSize = uploadNowSize.load(std::memory_order_relaxed);
+			progress.downloadTotalSize = ((0 <= downloadTotal) ? Optional<int64>(downloadTotal) : none);
+			progress.uploadTotalSize = ((0 <= uploadTotal) ? Optional<int64>(uploadTotal) : none);
+		}
+
+		void HTTPEngineTransfer::requestCancel() noexcept
+		{
+			m_cancelRequested.store(true, std::memory_order_relaxed);
+		}
+
+		bool HTTPEngineTransfer::isCancelRequested() const noexcept
+		{
+			return (m_cancelRequested.load(std::memory_order_relaxed)
+				|| (options.cancellation && options.cancellation->isCanceled()));
+		}
+
+		bool HTTPEngineTransfer::isFinished() const noexcept
+		{
+			return m_finished.load(std::memory_order_acquire);
+		}
+
+		void HTTPEngineTransfer::wait()
+		{
+			std::unique_lock lock(m_mutex);
+
+			for (;;)
+			{
+				m_finishedCondition.wait(lock, [this]() { return (isFinished() || m_completion); });
+
+				if (!m_completion)
+				{
+					return;
+				}
+
+				std::function<void()> completion = std::move(m_completion);
+				m_completion = nullptr;
+
+				lock.unlock();
+				completion();
+				lock.lock();
+			}
+		}
+
+		void HTTPEngineTransfer::postCompletion(std::function<void()> completion)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_completion = std::move(completion);
+			}
+
+			m_finishedCondition.notify_all();
+		}
+
+		const HTTPResponse& HTTPEngineTransfer::getResponse() const noexcept
+		{
+			return m_response;
+		}
+
+		bool HTTPEngineTransfer::setContinuation(const HTTPExecutor executor, void (*callback)(void*), void* context)
+		{
+			std::lock_guard lock(m_mutex);
+
+			if (isFinished())
+			{
+				return false;
+			}
+
+			m_continuation = Continuation{ executor, callback, context };
+			return true;
+		}
+
+		void HTTPEngineTransfer::finish(const HTTPResponse& response, const HTTPAsyncStatus status)
+		{
+			Optional<Continuation> continuation;
+			{
+				std::lock_guard lock(m_mutex);
+				m_response = response;
+				progress.status.store(status, std::memory_order_release);
+				m_finished.store(true, std::memory_order_release);
+				continuation.swap(m_continuation);
+			}
+
+			m_finishedCondition.notify_all();
+
+			if (continuation)
+			{
+				Schedule(continuation->executor, continuation->callback, continuation->context);
+			}
+
+			startThenStages();
+		}
+
+		void HTTPEngineTransfer::then(std::function<void(const HTTPResponse&)> callback, const HTTPExecutor executor)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_thenStages.push_back(ThenStage{ std::move(callback), executor });
+			}
+
+			startThenStages();
+		}
+
+		void HTTPEngineTransfer::startThenStages()
+		{
+			{
+				std::lock_guard lock(m_mutex);
+
+				// 終わっていないか、既に実行中
+				if (!isFinished() || m_thenSelf || (m_nextThenStage == m_thenStages.size()))
+				{
+					return;
+				}
+
+				m_thenSelf = shared_from_this();
+			}
+
+			scheduleNextThenStage();
+		}
+
+		void HTTPEngineTransfer::scheduleNextThenStage()
+		{
+			std::shared_ptr<HTTPEngineTransfer> self;
+			Optional<HTTPExecutor> executor;
+			{
+				std::lock_guard lock(m_mutex);
+
+				if (m_nextThenStage < m_thenStages.size())
+				{
+					executor = m_thenStages[m_nextThenStage].executor;
+				}
+				else
+				{
+					m_thenStages.clear();
+					m_nextThenStage = 0;
+					self = std::move(m_thenSelf);
+				}
+			}
+
+			if (executor)
+			{
+				Schedule(*executor, &HTTPEngineTransfer::RunThenStage, this);
+			}
+
+			// self が最後の参照の場合は、ここでこの通信が破棄される
+		}
+
+		void HTTPEngineTransfer::RunThenStage(void* context)
+		{
+			HTTPEngineTransfer& transfer = *static_cast<HTTPEngineTransfer*>(context);
+			std::function<void(const HTTPResponse&)> callback;
+			{
+				std::lock_guard lock(transfer.m_mutex);
+				callback = std::move(transfer.m_thenStages[transfer.m_nextThenStage++].callback);
+			}
+
+			transfer.trace.delivered();
+
+			callback(transfer.m_response);
+
+			transfer.scheduleNextThenStage();
+		}
+
+		int64 GetEngineMicrosec() noexcept
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void SubmitTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+		{
+			transfer->progress.status.store(HTTPAsyncStatus::Working, std::memory_order_release);
+
+			std::unique_lock lock(EngineMutex);
+
+			// 終了処理中に、継続（HTTPExecutor::IOThread）から開始された通信
+			if (EngineShuttingDown)
+			{
+				lock.unlock();
+				transfer->requestCancel();
+				FinishPending(transfer, HTTPError::Transfer);
+				return;
+			}
+
+			if (!Engine)
+			{
+				Engine = std::make_unique<HTTPEngine>();
+			}
+
+			Engine->submit(transfer);
+		}
+
+		void WakeEngine()
+		{
+			std::lock_guard lock(EngineMutex);
+
+			if (Engine)
+			{
+				Engine->wake();
+			}
+		}
+
+		void ShutdownEngine()
+		{
+			std::unique_ptr<HTTPEngine> engine;
+			{
+				std::lock_guard lock(EngineMutex);
+				engine = std::move(Engine);
+				EngineShuttingDown = true;
+			}
+
+			// キャンセルした通信の継続が SubmitTransfer() や WakeEngine() を呼んでもデッドロックしないように、ロックの外で終了する
+			engine.reset();
+
+			std::lock_guard lock(EngineMutex);
+			EngineShuttingDown = false;
+		}
+
+		HTTPResponse PerformTransfer(const std::shared_ptr<HTTPEngineTransfer>& transfer)
+		{
+			// 呼び出し側のスレッドが止まるので待たせない。後処理は、このスレッドで行う
+			transfer->synchronous = true;
+			transfer->bypassLimits = true;
+
+			SubmitTransfer(transfer);
+
+			transfer->wait();
+			transfer->trace.delivered();
+
+			return transfer->getResponse();
+		}
+	}
+
+	void SimpleHTTP::SetConnectionLimits(const size_t maxTransfers, const size_t maxTransfersPerHost)
+	{
+		detail::MaxTransfers = maxTransfers;
+		detail::MaxTransfersPerHost = maxTransfersPerHost;
+
+		detail::WakeEngine();
+	}
+
+	void SimpleHTTP::SetBandwidthLimit(const int64 maxRecvBytesPerSec, const int64 maxSendBytesPerSec)
+	{
+		detail::MaxRecvBytesPerSec = maxRecvBytesPerSec;
+		detail::MaxSendBytesPerSec = maxSendBytesPerSec;
+
+		detail::WakeEngine();
+	}
+
+	void SimpleHTTP::SetHostBandwidthLimit(const StringView host, const int64 maxRecvBytesPerSec, const int64 maxSendBytesPerSec)
+	{
+		{
+			std::lock_guard lock(detail::HostBandwidthLimitsMutex);
+
+			if ((maxRecvBytesPerSec == 0) && (maxSendBytesPerSec == 0))
+			{
+				detail::HostBandwidthLimits.erase(String(host));
+			}
+			else
+			{
+				detail::HostBandwidthLimits[String(host)] = { maxRecvBytesPerSec, maxSendBytesPerSec };
+			}
+
+			++detail::HostBandwidthLimitsVersion;
+		}
+
+		detail::WakeEngine();
+	}
+
+	void SimpleHTTP::SetAdaptiveConcurrency(const HTTPAdaptiveConcurrency& settings)
+	{
+		{
+			std::lock_guard lock(detail::AdaptiveConcurrencyMutex);
+			detail::AdaptiveConcurrency = settings;
+			++detail::AdaptiveConcurrencyVersion;
+		}
+
+		detail::WakeEngine();
+	}
+
+	void SimpleHTTP::SetPauseBackgroundWhileInteractive(const bool enabled)
+	{
+		detail::PauseBackgroundWhileInteractive = enabled;
+
+		detail::WakeEngine();
+	}
+}
@@ -0,0 +1,532 @@
+﻿#include "HTTPClient.hpp"
+#include "HTTPEngine.hpp"
+#include "HTTPFileSink.hpp"
+#include <algorithm>
+
+namespace s3d
+{
+	namespace detail
+	{
+		namespace
+		{
+			// 再接続までの待ち時間の既定値
+			constexpr int64 DefaultReconnectionMillisec = 3000;
+
+			/// <summary>
+			/// 受信したイベントのキュー。通信スレッドから追加し、1 つのスレッドから取り出します。
+			/// 追加は CAS でリストの先頭につなぐだけで、取り出す側はリストをまとめて受け取ってから順番を戻します。
+			/// </summary>
+			class EventQueue
+			{
+			private:
+
+				struct Node
+				{
+					HTTPEvent event;
+
+					Node* next = nullptr;
+				};
+
+				// 追加されたイベント（新しい順）
+				std::atomic<Node*> m_incoming = nullptr;
+
+				// 取り出す側が受け取ったイベント（古い順）。取り出す側のスレッドだけが触る
+				Node* m_pending = nullptr;
+
+				static void Free(Node* node)
+				{
+					while (node)
+					{
+						Node* next = node->next;
+						delete node;
+						node = next;
+					}
+				}
+
+			public:
+
+				EventQueue() = default;
+
+				EventQueue(const EventQueue&) = delete;
+
+				EventQueue& operator =(const EventQueue&) = delete;
+
+				~EventQueue()
+				{
+					Free(m_incoming.load(std::memory_order_acquire));
+					Free(m_pending);
+				}
+
+				void push(HTTPEvent&& event)
+				{
+					Node* node = new Node{ std::move(event) };
+					node->next = m_incoming.load(std::memory_order_relaxed);
+
+					while (!m_incoming.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+				}
+
+				bool tryPop(HTTPEvent& event)
+				{
+					if (!m_pending)
+					{
+						Node* node = m_incoming.exchange(nullptr, std::memory_order_acquire);
+
+						while (node)
+						{
+							Node* next = node->next;
+							node->next = m_pending;
+							m_pending = node;
+							node = next;
+						}
+					}
+
+					if (!m_pending)
+					{
+						return false;
+					}
+
+					Node* node = m_pending;
+					m_pending = node->next;
+					event = std::move(node->event);
+					delete node;
+
+					return true;
+				}
+			};
+
+			/// <summary>
+			/// 再接続で作り直す書き込み先の間で共有する状態
+			/// </summary>
+			struct EventStreamChannel
+			{
+				EventQueue queue;
+
+				std::mutex mutex;
+
+				// 再接続で Last-Event-ID ヘッダーとして送る値
+				String lastEventID;
+
+				int64 reconnectionMillisec = DefaultReconnectionMillisec;
+			};
+
+			/// <summary>
+			/// 受信したデータを行に分け、イベントとしてキューに追加します。
+			/// 保持するのは解析中の行とイベントのデータだけです。
+			/// </summary>
+			class EventStreamFileSink final : public IHTTPFileSink
+			{
+			private:
+
+				std::shared_ptr<EventStreamChannel> m_channel;
+
+				HTTPEventStreamFormat m_format;
+
+				std::string m_line;
+
+				std::string m_type;
+
+				std::string m_data;
+
+				// id: フィールドの値。イベントを追加するときに m_channel->lastEventID に反映する
+				String m_id;
+
+				int64 m_pos = 0;
+
+				// 2xx 以外のレスポンスのため、解析しない
+				bool m_skip = false;
+
+				// 直前の文字が CR の場合、続く LF は同じ改行として扱う
+				bool m_afterCR = false;
+
+				bool m_firstLine = true;
+
+				void processLine()
+				{
+					// 先頭の BOM は無視する
+					if (m_firstLine)
+					{
+						m_firstLine = false;
+
+						if (m_line.rfind("\xEF\xBB\xBF", 0) == 0)
+						{
+							m_line.erase(0, 3);
+						}
+					}
+
+					if (m_format == HTTPEventStreamFormat::Lines)
+					{
+						if (!m_line.empty())
+						{
+							m_channel->queue.push(HTTPEvent{ U"message", Unicode::FromUTF8(m_line), String() });
+						}
+
+						return;
+					}
+
+					if (m_line.empty())
+					{
+						dispatch();
+						return;
+					}
+
+					// コメント
+					if (m_line.front() == ':')
+					{
+						return;
+					}
+
+					const size_t colon = m_line.find(':');
+					const std::string_view line(m_line);
+					const std::string_view field = line.substr(0, colon);
+					std::string_view value = ((colon == std::string_view::npos) ? std::string_view() : line.substr(colon + 1));
+
+					if (!value.empty() && (value.front() == ' '))
+					{
+						value.remove_prefix(1);
+					}
+
+					if (field == "event")
+					{
+						m_type.assign(value);
+					}
+					else if (field == "data")
+					{
+						m_data.append(value);
+						m_data.push_back('\n');
+					}
+					else if (field == "id")
+					{
+						if (value.find('\0') == std::string_view::npos)
+						{
+							m_id = Unicode::FromUTF8(value);
+						}
+					}
+					else if (field == "retry")
+					{
+						if (!value.empty() && std::all_of(value.begin(), value.end(), [](const char c) { return (('0' <= c) && (c <= '9')); }))
+						{
+							std::lock_guard lock(m_channel->mutex);
+							m_channel->reconnectionMillisec = std::strtoll(std::string(value).c_str(), nullptr, 10);
+						}
+					}
+				}
+
+				void dispatch()
+				{
+					{
+						std::lock_guard lock(m_channel->mutex);
+						m_channel->lastEventID = m_id;
+					}
+
+					if (m_data.empty())
+					{
+						m_type.clear();
+						return;
+					}
+
+					m_data.pop_back();
+
+					m_channel->queue.push(HTTPEvent{ (m_type.empty() ? String(U"message") : Unicode::FromUTF8(m_type)), Unicode::FromUTF8(m_data), m_id });
+
+					m_type.clear();
+					m_data.clear();
+				}
+
+			public:
+
+				EventStreamFileSink(const std::shared_ptr<EventStreamChannel>& channel, const HTTPEventStreamFormat format)
+					: m_channel(channel)
+					, m_format(format)
+				{
+					std::lock_guard lock(m_channel->mutex);
+					m_id = m_channel->lastEventID;
+				}
+
+				bool isOpen() const override
+				{
+					return true;
+				}
+
+				int64 size() const override
+				{
+					return m_pos;
+				}
+
+				int64 getPos() const override
+				{
+					return m_pos;
+				}
+
+				bool setPos(const int64 pos) override
+				{
+					return (pos == m_pos);
+				}
+
+				int64 write(const void* src, const int64 size) override
+				{
+					if (size <= 0)
+					{
+						return 0;
+					}
+
+					if (m_skip)
+					{
+						m_pos += size;
+						return size;
+					}
+
+					const char* p = static_cast<const char*>(src);
+					const char* const end = (p + size);
+
+					while (p < end)
+					{
+						if (m_afterCR && (*p == '\n'))
+						{
+							m_afterCR = false;
+							++p;
+							++m_pos;
+							continue;
+						}
+
+						const char* lineEnd = std::find_if(p, end, [](const char c) { return ((c == '\r') || (c == '\n')); });
+
+						m_line.append(p, lineEnd);
+						m_pos += (lineEnd - p);
+
+						if (lineEnd == end)
+						{
+							m_afterCR = false;
+							break;
+						}
+
+						++m_pos;
+						processLine();
+						m_line.clear();
+						m_afterCR = (*lineEnd == '\r');
+						p = (lineEnd + 1);
+					}
+
+					return size;
+				}
+
+				bool preallocate(int64) override
+				{
+					return true;
+				}
+
+				void beginBody(const int32 statusCode) override
+				{
+					if ((statusCode / 100) != 2)
+					{
+						m_skip = true;
+					}
+				}
+
+				bool commit() override
+				{
+					// 途中のイベントは破棄する。行の形式では最後の行に改行が無くても追加する
+					if (!m_skip && (m_format == HTTPEventStreamFormat::Lines) && !m_line.empty())
+					{
+						processLine();
+					}
+
+					m_line.clear();
+					return true;
+				}
+
+				void discard() override
+				{
+					m_line.clear();
+					m_type.clear();
+					m_data.clear();
+				}
+
+				bool isStreaming() const override
+				{
+					return true;
+				}
+			};
+		}
+	}
+
+	struct HTTPEventStream::State : std::enable_shared_from_this<HTTPEventStream::State>
+	{
+		URL url;
+
+		HTTPHeader header;
+
+		HTTPEventStreamFormat format = HTTPEventStreamFormat::ServerSentEvents;
+
+		HTTPRequestOptions options;
+
+		std::shared_ptr<detail::EventStreamChannel> channel = std::make_shared<detail::EventStreamChannel>();
+
+		std::atomic<HTTPAsyncStatus> status = HTTPAsyncStatus::None;
+
+		std::atomic<uint32> reconnects = 0;
+
+		std::mutex mutex;
+
+		// 実行中か、再接続を待っている通信
+		std::shared_ptr<detail::HTTPEngineTransfer> transfer;
+
+		bool closed = false;
+
+		~State()
+		{
+			close(HTTPAsyncStatus::Canceled);
+		}
+
+		void close(const HTTPAsyncStatus _status)
+		{
+			std::shared_ptr<detail::HTTPEngineTransfer> current;
+			{
+				std::lock_guard lock(mutex);
+
+				if (closed)
+				{
+					return;
+				}
+
+				closed = true;
+				current = std::move(transfer);
+			}
+
+			if (status.load() == HTTPAsyncStatus::Working)
+			{
+				status = _status;
+			}
+
+			if (current)
+			{
+				current->requestCancel();
+				detail::WakeEngine();
+			}
+		}
+
+		/// <summary>
+		/// delayMillisec 後に接続します。最後に受信したイベントの ID があれば Last-Event-ID ヘッダーで送ります
+		/// </summary>
+		void connect(const int64 delayMillisec)
+		{
+			HTTPHeader requestHeader = header;
+			requestHeader.emplace(U"Accept", (format == HTTPEventStreamFormat::ServerSentEvents) ? U"text/event-stream" : U"*/*");
+			requestHeader.emplace(U"Cache-Control", U"no-cache");
+			{
+				std::lock_guard lock(channel->mutex);
+
+				if (!channel->lastEventID.isEmpty())
+				{
+					requestHeader[U"Last-Event-ID"] = channel->lastEventID;
+				}
+			}
+
+			const auto next = std::make_shared<detail::HTTPEngineTransfer>(url, requestHeader, options,
+				[channel = channel, format = format]() { return std::make_unique<detail::EventStreamFileSink>(channel, format); });
+
+			// 終わらない接続が、同時に実行する通信の数の上限をずっと使い続けないようにする
+			next->bypassLimits = true;
+
+			if (delayMillisec > 0)
+			{
+				next->retryAtMicrosec = (detail::GetEngineMicrosec() + (delayMillisec * 1000));
+			}
+
+			// then() の処理の実行中に HTTPEventStream が破棄された場合は再接続しない
+			next->then([weakState = weak_from_this(), transfer = next.get()](const HTTPResponse& response)
+			{
+				if (const auto state = weakState.lock())
+				{
+					state->finished(response, transfer->isCancelRequested());
+				}
+			}, HTTPExecutor::IOThread);
+
+			{
+				std::lock_guard lock(mutex);
+
+				if (closed)
+				{
+					return;
+				}
+
+				transfer = next;
+			}
+
+			detail::SubmitTransfer(next);
+		}
+
+		/// <summary>
+		/// 接続が終わったときに呼ばれ、再接続するかを決めます
+		/// </summary>
+		void finished(const HTTPResponse& response, const bool canceled)
+		{
+			// close() か、終了処理でキャンセルされた
+			if (canceled)
+			{
+				close(HTTPAsyncStatus::Canceled);
+				return;
+			}
+
+			if (response.getError() == HTTPError::None)
+			{
+				if (response.getStatusCode() == HTTPResponseStatusCode::NoContent)
+				{
+					close(HTTPAsyncStatus::Succeeded);
+					return;
+				}
+
+				if (!SimpleHTTP::IsStatusCodeTypeOf(response.getStatusCode(), HTTPResponseStatusType::Successful))
+				{
+					close(HTTPAsyncStatus::Failed);
+					return;
+				}
+			}
+
+			int64 delayMillisec = 0;
+			{
+				std::lock_guard lock(channel->mutex);
+				delayMillisec = channel->reconnectionMillisec;
+			}
+
+			++reconnects;
+			connect(delayMillisec);
+		}
+	};
+
+	HTTPEventStream::HTTPEventStream()
+		: m_state(std::make_shared<State>()) {}
+
+	bool HTTPEventStream::tryPop(HTTPEvent& event)
+	{
+		return m_state->channel->queue.tryPop(event);
+	}
+
+	HTTPAsyncStatus HTTPEventStream::currentStatus() const
+	{
+		return m_state->status.load();
+	}
+
+	uint32 HTTPEventStream::reconnectCount() const
+	{
+		return m_state->reconnects.load();
+	}
+
+	void HTTPEventStream::close()
+	{
+		m_state->close(HTTPAsyncStatus::Canceled);
+	}
+
+	HTTPEventStream SimpleHTTP::OpenEventStream(const URLView url, const HTTPHeader& header, const HTTPEventStreamFormat format, const HTTPRequestOptions& options)
+	{
+		HTTPEventStream result;
+		const auto state = result.m_state;
+		state->url = URL(url);
+		state->header = header;
+		state->format = format;
+		state->options = options;
+		state->status = HTTPAsyncStatus::Working;
+		state->connect(0);
+
+		return result;
+	}
+}
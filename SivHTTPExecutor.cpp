@@ -0,0 +1,211 @@
+﻿#include "HTTPEngine.hpp"
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace s3d
+{
+	namespace detail
+	{
+		namespace
+		{
+			struct ExecutorJob
+			{
+				void (*callback)(void*) = nullptr;
+
+				void* context = nullptr;
+			};
+
+			/// <summary>
+			/// HTTPExecutor::ThreadPool の処理を実行するワーカースレッド
+			/// </summary>
+			class WorkerPool
+			{
+			private:
+
+				std::mutex m_mutex;
+
+				std::condition_variable m_condition;
+
+				std::deque<ExecutorJob> m_jobs;
+
+				Array<std::thread> m_threads;
+
+				bool m_stopping = false;
+
+				void run()
+				{
+					for (;;)
+					{
+						ExecutorJob job;
+						{
+							std::unique_lock lock(m_mutex);
+
+							m_condition.wait(lock, [this]() { return (m_stopping || !m_jobs.empty()); });
+
+							// 終了するときも、キューに残っている処理は実行する
+							if (m_jobs.empty())
+							{
+								return;
+							}
+
+							job = m_jobs.front();
+							m_jobs.pop_front();
+						}
+
+						job.callback(job.context);
+					}
+				}
+
+			public:
+
+				WorkerPool()
+				{
+					const size_t threadCount = Clamp<size_t>((std::thread::hardware_concurrency() / 2), 2, 8);
+
+					for (size_t i = 0; i < threadCount; ++i)
+					{
+						m_threads.emplace_back(&WorkerPool::run, this);
+					}
+				}
+
+				~WorkerPool()
+				{
+					{
+						std::lock_guard lock(m_mutex);
+						m_stopping = true;
+					}
+
+					m_condition.notify_all();
+
+					for (auto& thread : m_threads)
+					{
+						thread.join();
+					}
+				}
+
+				void post(const ExecutorJob& job)
+				{
+					{
+						std::lock_guard lock(m_mutex);
+						m_jobs.push_back(job);
+					}
+
+					m_condition.notify_one();
+				}
+			};
+
+			/// <summary>
+			/// HTTPExecutor::MainThread の処理のキュー
+			/// 2 つの配列を交互に使うため、容量が足りている間はメモリを確保しません。
+			/// </summary>
+			class MainThreadQueue
+			{
+			private:
+
+				std::mutex m_mutex;
+
+				Array<ExecutorJob> m_jobs;
+
+				Array<ExecutorJob> m_running;
+
+			public:
+
+				void post(const ExecutorJob& job)
+				{
+					std::lock_guard lock(m_mutex);
+					m_jobs.push_back(job);
+				}
+
+				void run()
+				{
+					{
+						std::lock_guard lock(m_mutex);
+						m_running.swap(m_jobs);
+					}
+
+					// 実行中に追加された処理は、次の呼び出しで実行する
+					for (const auto& job : m_running)
+					{
+						job.callback(job.context);
+					}
+
+					m_running.clear();
+				}
+			};
+
+			class HTTPExecutorAddon : public IAddon
+			{
+			public:
+
+				bool update() override
+				{
+					SimpleHTTP::RunMainThreadContinuations();
+
+					return true;
+				}
+			};
+
+			std::mutex WorkerPoolMutex;
+
+			std::unique_ptr<WorkerPool> Workers;
+
+			MainThreadQueue MainThreadJobs;
+
+			bool ExecutorAddonRegistered = false;
+		}
+
+		void Schedule(const HTTPExecutor executor, void (*callback)(void*), void* context)
+		{
+			switch (executor)
+			{
+			case HTTPExecutor::ThreadPool:
+				{
+					std::lock_guard lock(WorkerPoolMutex);
+
+					if (!Workers)
+					{
+						Workers = std::make_unique<WorkerPool>();
+					}
+
+					Workers->post(ExecutorJob{ callback, context });
+				}
+				break;
+			case HTTPExecutor::MainThread:
+				MainThreadJobs.post(ExecutorJob{ callback, context });
+				break;
+			case HTTPExecutor::IOThread:
+			default:
+				callback(context);
+				break;
+			}
+		}
+
+		void RegisterExecutorAddon()
+		{
+			if (ExecutorAddonRegistered)
+			{
+				return;
+			}
+
+			ExecutorAddonRegistered = Addon::Register(U"SimpleHTTP", std::make_unique<HTTPExecutorAddon>());
+		}
+
+		void ShutdownExecutors()
+		{
+			std::unique_ptr<WorkerPool> workers;
+			{
+				std::lock_guard lock(WorkerPoolMutex);
+				workers = std::move(Workers);
+			}
+
+			// 残っている処理が Schedule() を呼んでもデッドロックしないように、ロックの外で終了する
+			workers.reset();
+		}
+	}
+
+	void SimpleHTTP::RunMainThreadContinuations()
+	{
+		detail::MainThreadJobs.run();
+	}
+}
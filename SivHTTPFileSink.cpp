@@ -0,0 +1,1435 @@
+﻿# include <algorithm>
+# include <cstring>
+# include "HTTPFileSink.hpp"
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows.hpp>
+#	include <malloc.h>
+# else
+#	include <cerrno>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#	include <cstdlib>
+# endif
+
+namespace s3d
+{
+	namespace detail
+	{
+		// ページ境界に揃えたバッファを使う
+		constexpr size_t WriteBufferAlignment = 4096;
+
+		static uint8* AllocateAlignedBuffer(const size_t size)
+		{
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			return static_cast<uint8*>(::_aligned_malloc(size, WriteBufferAlignment));
+
+		# else
+
+			void* p = nullptr;
+
+			if (::posix_memalign(&p, WriteBufferAlignment, size) != 0)
+			{
+				return nullptr;
+			}
+
+			return static_cast<uint8*>(p);
+
+		# endif
+		}
+
+		static void FreeAlignedBuffer(uint8* p)
+		{
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			::_aligned_free(p);
+
+		# else
+
+			::free(p);
+
+		# endif
+		}
+	}
+
+	//NativeFile
+
+	detail::NativeFile::~NativeFile()
+	{
+		close();
+	}
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	bool detail::NativeFile::open(const FilePathView path)
+	{
+		close();
+
+		const HANDLE handle = ::CreateFileW(FilePath(path).toWstr().c_str(), (GENERIC_READ | GENERIC_WRITE), FILE_SHARE_READ, nullptr,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		m_handle = handle;
+		return true;
+	}
+
+	bool detail::NativeFile::isOpen() const
+	{
+		return (m_handle != nullptr);
+	}
+
+	void* detail::NativeFile::nativeHandle() const
+	{
+		return m_handle;
+	}
+
+	bool detail::NativeFile::writeAt(int64 offset, const void* src, size_t size)
+	{
+		const char* p = static_cast<const char*>(src);
+
+		while (size)
+		{
+			const DWORD toWrite = static_cast<DWORD>(Min<size_t>(size, 0x40000000));
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD written = 0;
+
+			if (!::WriteFile(static_cast<HANDLE>(m_handle), p, toWrite, &written, &overlapped) || (written == 0))
+			{
+				return false;
+			}
+
+			p += written;
+			offset += written;
+			size -= written;
+		}
+
+		return true;
+	}
+
+	bool detail::NativeFile::preallocate(const int64 size)
+	{
+		FILE_ALLOCATION_INFO info = {};
+		info.AllocationSize.QuadPart = size;
+
+		return !!::SetFileInformationByHandle(static_cast<HANDLE>(m_handle), FileAllocationInfo, &info, sizeof(info));
+	}
+
+	bool detail::NativeFile::truncate(const int64 size)
+	{
+		FILE_END_OF_FILE_INFO info = {};
+		info.EndOfFile.QuadPart = size;
+
+		return !!::SetFileInformationByHandle(static_cast<HANDLE>(m_handle), FileEndOfFileInfo, &info, sizeof(info));
+	}
+
+	void detail::NativeFile::close()
+	{
+		if (m_handle)
+		{
+			::CloseHandle(static_cast<HANDLE>(m_handle));
+			m_handle = nullptr;
+		}
+	}
+
+# else
+
+	bool detail::NativeFile::open(const FilePathView path)
+	{
+		close();
+
+		const std::string pathUTF8 = Unicode::ToUTF8(path);
+
+		m_fd = ::open(pathUTF8.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		return (m_fd != -1);
+	}
+
+	bool detail::NativeFile::isOpen() const
+	{
+		return (m_fd != -1);
+	}
+
+	int detail::NativeFile::nativeHandle() const
+	{
+		return m_fd;
+	}
+
+	bool detail::NativeFile::writeAt(int64 offset, const void* src, size_t size)
+	{
+		const char* p = static_cast<const char*>(src);
+
+		while (size)
+		{
+			const ssize_t written = ::pwrite(m_fd, p, size, static_cast<off_t>(offset));
+
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				return false;
+			}
+
+			p += written;
+			offset += written;
+			size -= static_cast<size_t>(written);
+		}
+
+		return true;
+	}
+
+	bool detail::NativeFile::preallocate(const int64 size)
+	{
+	# if SIV3D_PLATFORM(LINUX)
+
+		// FALLOC_FL_KEEP_SIZE: 途中で失敗しても、書き込んだ分だけのファイルサイズになる
+		return (::fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0);
+
+	# else
+
+		fstore_t store = {};
+		store.fst_flags = F_ALLOCATECONTIG;
+		store.fst_posmode = F_PEOFPOSMODE;
+		store.fst_length = static_cast<off_t>(size);
+
+		if (::fcntl(m_fd, F_PREALLOCATE, &store) == -1)
+		{
+			store.fst_flags = F_ALLOCATEALL;
+			return (::fcntl(m_fd, F_PREALLOCATE, &store) != -1);
+		}
+
+		return true;
+
+	# endif
+	}
+
+	bool detail::NativeFile::truncate(const int64 size)
+	{
+		return (::ftruncate(m_fd, static_cast<off_t>(size)) == 0);
+	}
+
+	void detail::NativeFile::close()
+	{
+		if (m_fd != -1)
+		{
+			::close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+# endif
+
+	//BinaryWriterFileSink
+
+	detail::BinaryWriterFileSink::BinaryWriterFileSink(const FilePathView path)
+		: m_writer(path)
+	{
+	}
+
+	bool detail::BinaryWriterFileSink::isOpen() const
+	{
+		return m_writer.isOpen();
+	}
+
+	int64 detail::BinaryWriterFileSink::size() const
+	{
+		return m_writer.size();
+	}
+
+	int64 detail::BinaryWriterFileSink::getPos() const
+	{
+		return m_writer.getPos();
+	}
+
+	bool detail::BinaryWriterFileSink::setPos(const int64 pos)
+	{
+		return m_writer.setPos(pos);
+	}
+
+	int64 detail::BinaryWriterFileSink::write(const void* src, const int64 size)
+	{
+		return m_writer.write(src, size);
+	}
+
+	bool detail::BinaryWriterFileSink::preallocate(int64)
+	{
+		return true;
+	}
+
+	bool detail::BinaryWriterFileSink::commit()
+	{
+		m_writer.close();
+		return true;
+	}
+
+	void detail::BinaryWriterFileSink::discard()
+	{
+		m_writer.clear();
+		m_writer.close();
+	}
+
+	bool detail::BinaryWriterFileSink::supportsRandomAccess() const
+	{
+		return true;
+	}
+
+	//MemoryFileSink
+
+	bool detail::MemoryFileSink::isOpen() const
+	{
+		return true;
+	}
+
+	int64 detail::MemoryFileSink::size() const
+	{
+		return static_cast<int64>(m_data.size());
+	}
+
+	int64 detail::MemoryFileSink::getPos() const
+	{
+		return m_pos;
+	}
+
+	bool detail::MemoryFileSink::setPos(const int64 pos)
+	{
+		if (pos < 0)
+		{
+			return false;
+		}
+
+		m_pos = pos;
+		return true;
+	}
+
+	int64 detail::MemoryFileSink::write(const void* src, const int64 size)
+	{
+		if (size <= 0)
+		{
+			return 0;
+		}
+
+		const size_t end = static_cast<size_t>(m_pos + size);
+
+		if (m_data.size() < end)
+		{
+			m_data.resize(end);
+		}
+
+		std::memcpy(m_data.data() + m_pos, src, static_cast<size_t>(size));
+		m_pos += size;
+		return size;
+	}
+
+	bool detail::MemoryFileSink::preallocate(const int64 size)
+	{
+		m_data.reserve(static_cast<size_t>(size));
+		return true;
+	}
+
+	bool detail::MemoryFileSink::commit()
+	{
+		return true;
+	}
+
+	void detail::MemoryFileSink::discard()
+	{
+		m_data.clear();
+		m_data.shrink_to_fit();
+		m_pos = 0;
+	}
+
+	bool detail::MemoryFileSink::supportsRandomAccess() const
+	{
+		return true;
+	}
+
+	const Array<uint8>& detail::MemoryFileSink::data() const noexcept
+	{
+		return m_data;
+	}
+
+	//JSONStreamFileSink
+
+	namespace detail
+	{
+		static bool IsJSONWhitespace(const char c) noexcept
+		{
+			return ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n'));
+		}
+	}
+
+	detail::JSONStreamFileSink::JSONStreamFileSink(const std::shared_ptr<Consumer>& consumer)
+		: m_consumer(consumer)
+		, m_state((consumer->format == HTTPJSONStreamFormat::Array) ? State::BeforeArray : State::BetweenElements) {}
+
+	bool detail::JSONStreamFileSink::isOpen() const
+	{
+		return true;
+	}
+
+	int64 detail::JSONStreamFileSink::size() const
+	{
+		return m_pos;
+	}
+
+	int64 detail::JSONStreamFileSink::getPos() const
+	{
+		return m_pos;
+	}
+
+	bool detail::JSONStreamFileSink::setPos(const int64 pos)
+	{
+		// 先頭から順に解析するため、移動はできない
+		return (pos == m_pos);
+	}
+
+	int64 detail::JSONStreamFileSink::write(const void* src, const int64 size)
+	{
+		if (size <= 0)
+		{
+			return 0;
+		}
+
+		if (m_state == State::Failed)
+		{
+			return 0;
+		}
+
+		m_pos += size;
+
+		if (m_state == State::Skip)
+		{
+			return size;
+		}
+
+		const char* data = static_cast<const char*>(src);
+		const bool result = ((m_consumer->format == HTTPJSONStreamFormat::NDJSON)
+			? feedLines(data, static_cast<size_t>(size)) : feedArray(data, static_cast<size_t>(size)));
+
+		if (!result)
+		{
+			LOG_FAIL(U"Invalid JSON stream (offset: {})"_fmt(m_pos - size));
+			m_state = State::Failed;
+			m_element.clear();
+			return 0;
+		}
+
+		return size;
+	}
+
+	bool detail::JSONStreamFileSink::preallocate(int64)
+	{
+		return true;
+	}
+
+	void detail::JSONStreamFileSink::beginBody(const int32 statusCode)
+	{
+		// エラーページなどは解析しない
+		if ((statusCode / 100) != 2)
+		{
+			m_state = State::Skip;
+		}
+	}
+
+	bool detail::JSONStreamFileSink::commit()
+	{
+		if (m_state == State::Skip)
+		{
+			return true;
+		}
+
+		if (m_state == State::Failed)
+		{
+			return false;
+		}
+
+		if (m_consumer->format == HTTPJSONStreamFormat::NDJSON)
+		{
+			// 最後の行に改行が無い場合
+			return emitElement();
+		}
+
+		// 途中で途切れた配列は失敗とする
+		return (m_state == State::AfterArray);
+	}
+
+	void detail::JSONStreamFileSink::discard()
+	{
+		m_element.clear();
+		m_element.shrink_to_fit();
+	}
+
+	bool detail::JSONStreamFileSink::isStreaming() const
+	{
+		return true;
+	}
+
+	bool detail::JSONStreamFileSink::feedArray(const char* data, const size_t size)
+	{
+		const char* const end = (data + size);
+
+		// 解析中の要素のうち、今回のデータに含まれる部分の先頭
+		const char* elementBegin = data;
+
+		for (const char* p = data; p < end; ++p)
+		{
+			const char c = *p;
+
+			switch (m_state)
+			{
+			case State::BeforeArray:
+				if (c == '[')
+				{
+					m_state = State::BetweenElements;
+				}
+				else if (!IsJSONWhitespace(c))
+				{
+					return false;
+				}
+				break;
+			case State::BetweenElements:
+				if (c == ']')
+				{
+					m_state = State::AfterArray;
+				}
+				else if ((c != ',') && !IsJSONWhitespace(c))
+				{
+					m_state = State::InElement;
+					m_container = ((c == '{') || (c == '['));
+					m_depth = (m_container ? 1 : 0);
+					m_inString = (c == '"');
+					m_escaped = false;
+					elementBegin = p;
+				}
+				break;
+			case State::InElement:
+				if (m_inString)
+				{
+					if (m_escaped)
+					{
+						m_escaped = false;
+					}
+					else if (c == '\\')
+					{
+						m_escaped = true;
+					}
+					else if (c == '"')
+					{
+						m_inString = false;
+
+						if (!m_container)
+						{
+							m_element.append(elementBegin, (p + 1));
+							m_state = State::BetweenElements;
+
+							if (!emitElement())
+							{
+								return false;
+							}
+						}
+					}
+				}
+				else if (!m_container)
+				{
+					// 数値や true などは、区切りの文字で終わる
+					if ((c == ',') || (c == ']') || IsJSONWhitespace(c))
+					{
+						m_element.append(elementBegin, p);
+						m_state = ((c == ']') ? State::AfterArray : State::BetweenElements);
+
+						if (!emitElement())
+						{
+							return false;
+						}
+					}
+				}
+				else if (c == '"')
+				{
+					m_inString = true;
+				}
+				else if ((c == '{') || (c == '['))
+				{
+					++m_depth;
+				}
+				else if (((c == '}') || (c == ']')) && (--m_depth == 0))
+				{
+					m_element.append(elementBegin, (p + 1));
+					m_state = State::BetweenElements;
+
+					if (!emitElement())
+					{
+						return false;
+					}
+				}
+				break;
+			case State::AfterArray:
+				if (!IsJSONWhitespace(c))
+				{
+					return false;
+				}
+				break;
+			default:
+				return false;
+			}
+		}
+
+		// 次のデータに続く要素
+		if (m_state == State::InElement)
+		{
+			m_element.append(elementBegin, end);
+		}
+
+		return true;
+	}
+
+	bool detail::JSONStreamFileSink::feedLines(const char* data, const size_t size)
+	{
+		const char* const end = (data + size);
+
+		while (data < end)
+		{
+			const char* newline = static_cast<const char*>(std::memchr(data, '\n', (end - data)));
+
+			if (!newline)
+			{
+				m_element.append(data, end);
+				break;
+			}
+
+			m_element.append(data, newline);
+
+			if (!emitElement())
+			{
+				return false;
+			}
+
+			data = (newline + 1);
+		}
+
+		return true;
+	}
+
+	bool detail::JSONStreamFileSink::emitElement()
+	{
+		// 空行
+		if (std::all_of(m_element.begin(), m_element.end(), IsJSONWhitespace))
+		{
+			m_element.clear();
+			return true;
+		}
+
+		// 再試行する前に渡した要素は読み飛ばす
+		if (m_index++ < m_consumer->delivered)
+		{
+			m_element.clear();
+			return true;
+		}
+
+		// clear() しても容量は残るため、保持するメモリは最も大きい要素の分で済む
+		const JSONReader reader(ByteArray(m_element.data(), m_element.size()));
+		m_element.clear();
+
+		if (!reader)
+		{
+			return false;
+		}
+
+		if (m_consumer->onElement)
+		{
+			m_consumer->onElement(reader);
+		}
+
+		++m_consumer->delivered;
+		return true;
+	}
+
+	//WriteBehindFileSink
+
+	detail::WriteBehindFileSink::WriteBehindFileSink(const FilePathView path, const size_t bufferSize, const size_t queueLength)
+		: m_bufferSize(Max<size_t>(((bufferSize + WriteBufferAlignment - 1) / WriteBufferAlignment) * WriteBufferAlignment, WriteBufferAlignment))
+		, m_maxBuffers(Max<size_t>(queueLength, 1) + 1)
+	{
+		if (!m_file.open(path))
+		{
+			return;
+		}
+
+		m_thread = std::thread(&WriteBehindFileSink::run, this);
+	}
+
+	detail::WriteBehindFileSink::~WriteBehindFileSink()
+	{
+		if (m_thread.joinable())
+		{
+			discard();
+		}
+
+		for (uint8* buffer : m_allocatedBuffers)
+		{
+			FreeAlignedBuffer(buffer);
+		}
+	}
+
+	bool detail::WriteBehindFileSink::isOpen() const
+	{
+		return m_file.isOpen();
+	}
+
+	int64 detail::WriteBehindFileSink::size() const
+	{
+		return m_writtenSize;
+	}
+
+	int64 detail::WriteBehindFileSink::getPos() const
+	{
+		return m_writtenSize;
+	}
+
+	bool detail::WriteBehindFileSink::setPos(int64)
+	{
+		return false;
+	}
+
+	int64 detail::WriteBehindFileSink::write(const void* src, const int64 size)
+	{
+		const uint8* p = static_cast<const uint8*>(src);
+		int64 remaining = size;
+
+		while (0 < remaining)
+		{
+			if ((m_current.data == nullptr) && !acquireBuffer())
+			{
+				return 0;
+			}
+
+			const size_t toCopy = static_cast<size_t>(Min<int64>(remaining, static_cast<int64>(m_bufferSize - m_current.size)));
+			std::memcpy(m_current.data + m_current.size, p, toCopy);
+
+			m_current.size += toCopy;
+			m_writtenSize += toCopy;
+			p += toCopy;
+			remaining -= toCopy;
+
+			if (m_current.size == m_bufferSize)
+			{
+				submitCurrent();
+			}
+		}
+
+		return size;
+	}
+
+	bool detail::WriteBehindFileSink::preallocate(const int64 size)
+	{
+		if (!m_file.isOpen())
+		{
+			return false;
+		}
+
+		// 事前確保に失敗しても書き込みは続けられる
+		return m_file.preallocate(size);
+	}
+
+	bool detail::WriteBehindFileSink::commit()
+	{
+		if (!m_thread.joinable())
+		{
+			return false;
+		}
+
+		submitCurrent();
+
+		{
+			std::unique_lock lock(m_mutex);
+			m_freeCondition.wait(lock, [this] { return (m_pendingBuffers.empty() && !m_writing) || m_failed; });
+		}
+
+		stop();
+
+		const bool failed = m_failed;
+		m_file.close();
+		return !failed;
+	}
+
+	void detail::WriteBehindFileSink::discard()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_pendingBuffers.clear();
+		}
+
+		stop();
+
+		if (m_file.isOpen())
+		{
+			m_file.truncate(0);
+			m_file.close();
+		}
+	}
+
+	bool detail::WriteBehindFileSink::acquireBuffer()
+	{
+		std::unique_lock lock(m_mutex);
+
+		if (m_freeBuffers.isEmpty() && (m_allocatedBuffers.size() < m_maxBuffers))
+		{
+			if (uint8* buffer = AllocateAlignedBuffer(m_bufferSize))
+			{
+				m_allocatedBuffers.push_back(buffer);
+				m_freeBuffers.push_back(buffer);
+			}
+			else if (m_pendingBuffers.empty() && !m_writing)
+			{
+				// 書き込み中のバッファが無いと、待っても空きは生まれない
+				m_failed = true;
+				return false;
+			}
+		}
+
+		// 書き込みが追いつくまで待つ
+		m_freeCondition.wait(lock, [this] { return !m_freeBuffers.isEmpty() || m_failed || m_quit; });
+
+		if (m_failed || m_quit)
+		{
+			return false;
+		}
+
+		m_current.data = m_freeBuffers.back();
+		m_current.size = 0;
+		m_current.offset = m_writtenSize;
+		m_freeBuffers.pop_back();
+		return true;
+	}
+
+	void detail::WriteBehindFileSink::submitCurrent()
+	{
+		if (m_current.data == nullptr)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+
+			if (m_current.size == 0)
+			{
+				m_freeBuffers.push_back(m_current.data);
+			}
+			else
+			{
+				m_pendingBuffers.push_back(m_current);
+			}
+		}
+
+		m_current = Buffer{};
+		m_pendingCondition.notify_one();
+	}
+
+	void detail::WriteBehindFileSink::stop()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_quit = true;
+		}
+
+		m_pendingCondition.notify_one();
+		m_freeCondition.notify_all();
+
+		if (m_thread.joinable())
+		{
+			m_thread.join();
+		}
+	}
+
+	void detail::WriteBehindFileSink::run()
+	{
+		for (;;)
+		{
+			Buffer buffer;
+			{
+				std::unique_lock lock(m_mutex);
+				m_pendingCondition.wait(lock, [this] { return !m_pendingBuffers.empty() || m_quit; });
+
+				if (m_pendingBuffers.empty())
+				{
+					return;
+				}
+
+				buffer = m_pendingBuffers.front();
+				m_pendingBuffers.pop_front();
+				m_writing = true;
+			}
+
+			const bool result = m_file.writeAt(buffer.offset, buffer.data, buffer.size);
+
+			{
+				std::lock_guard lock(m_mutex);
+				m_failed |= !result;
+				m_writing = false;
+				m_freeBuffers.push_back(buffer.data);
+			}
+
+			m_freeCondition.notify_all();
+		}
+	}
+
+	//MemoryMappedFileSink
+
+	detail::MemoryMappedFileSink::MemoryMappedFileSink(const FilePathView path, const HTTPMappedFileFlush flush)
+		: m_flush(flush)
+	{
+		m_file.open(path);
+	}
+
+	detail::MemoryMappedFileSink::~MemoryMappedFileSink()
+	{
+		unmap();
+	}
+
+	bool detail::MemoryMappedFileSink::isOpen() const
+	{
+		return m_file.isOpen();
+	}
+
+	int64 detail::MemoryMappedFileSink::size() const
+	{
+		return Max(m_writtenSize.load(), m_mappedSize);
+	}
+
+	int64 detail::MemoryMappedFileSink::getPos() const
+	{
+		return m_pos;
+	}
+
+	bool detail::MemoryMappedFileSink::setPos(const int64 pos)
+	{
+		if (pos < 0)
+		{
+			return false;
+		}
+
+		m_pos = pos;
+		return true;
+	}
+
+	int64 detail::MemoryMappedFileSink::write(const void* src, const int64 size)
+	{
+		if (!writeAt(m_pos, src, size))
+		{
+			return 0;
+		}
+
+		m_pos += size;
+		return size;
+	}
+
+	bool detail::MemoryMappedFileSink::writeAt(const int64 offset, const void* src, const int64 size)
+	{
+		if (m_failed)
+		{
+			return false;
+		}
+
+		const uint8* p = static_cast<const uint8*>(src);
+		int64 remaining = size;
+		int64 pos = offset;
+
+		if (m_mapped && (pos < m_mappedSize))
+		{
+			const int64 toCopy = Min(remaining, (m_mappedSize - pos));
+			std::memcpy(m_mapped + pos, p, static_cast<size_t>(toCopy));
+
+			p += toCopy;
+			pos += toCopy;
+			remaining -= toCopy;
+		}
+
+		// サイズが不明な場合や、Content-Length を超えて受信した場合
+		if ((0 < remaining) && !m_file.writeAt(pos, p, static_cast<size_t>(remaining)))
+		{
+			m_failed = true;
+			return false;
+		}
+
+		const int64 end = (offset + size);
+		int64 writtenSize = m_writtenSize.load();
+
+		while ((writtenSize < end) && !m_writtenSize.compare_exchange_weak(writtenSize, end));
+
+		return true;
+	}
+
+	bool detail::MemoryMappedFileSink::preallocate(const int64 size)
+	{
+		if (!m_file.isOpen() || m_mapped || (m_writtenSize != 0) || (size <= 0))
+		{
+			return false;
+		}
+
+		// truncate() だけでは疎なファイルになり、ディスクが一杯になるとマップした領域への書き込みで SIGBUS が発生する。
+		// 領域を確保できない場合はマップせず、writeAt() で直接書き込む
+		if (!m_file.preallocate(size))
+		{
+			return false;
+		}
+
+		if (!m_file.truncate(size))
+		{
+			return false;
+		}
+
+		if (!map(size))
+		{
+			m_file.truncate(0);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool detail::MemoryMappedFileSink::commit()
+	{
+		if (!m_file.isOpen())
+		{
+			return false;
+		}
+
+		const bool flushed = flush();
+		unmap();
+
+		// Content-Length より短いまま完了した場合
+		if (m_writtenSize < m_mappedSize)
+		{
+			m_file.truncate(m_writtenSize.load());
+		}
+
+		m_file.close();
+		return (flushed && !m_failed);
+	}
+
+	void detail::MemoryMappedFileSink::discard()
+	{
+		unmap();
+
+		if (m_file.isOpen())
+		{
+			m_file.truncate(0);
+			m_file.close();
+		}
+	}
+
+	bool detail::MemoryMappedFileSink::supportsRandomAccess() const
+	{
+		return true;
+	}
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	bool detail::MemoryMappedFileSink::map(const int64 size)
+	{
+		const HANDLE mapping = ::CreateFileMappingW(static_cast<HANDLE>(m_file.nativeHandle()), nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+
+		void* p = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(size));
+
+		if (p == nullptr)
+		{
+			::CloseHandle(mapping);
+			return false;
+		}
+
+		m_mappingHandle = mapping;
+		m_mapped = static_cast<uint8*>(p);
+		m_mappedSize = size;
+		return true;
+	}
+
+	bool detail::MemoryMappedFileSink::flush()
+	{
+		if (!m_mapped || (m_flush == HTTPMappedFileFlush::None))
+		{
+			return true;
+		}
+
+		// FlushViewOfFile は書き出しを開始するだけで、完了は待たない
+		if (!::FlushViewOfFile(m_mapped, 0))
+		{
+			return false;
+		}
+
+		if (m_flush == HTTPMappedFileFlush::Sync)
+		{
+			return !!::FlushFileBuffers(static_cast<HANDLE>(m_file.nativeHandle()));
+		}
+
+		return true;
+	}
+
+	void detail::MemoryMappedFileSink::unmap()
+	{
+		if (m_mapped)
+		{
+			::UnmapViewOfFile(m_mapped);
+			m_mapped = nullptr;
+		}
+
+		if (m_mappingHandle)
+		{
+			::CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+			m_mappingHandle = nullptr;
+		}
+	}
+
+# else
+
+	bool detail::MemoryMappedFileSink::map(const int64 size)
+	{
+		void* p = ::mmap(nullptr, static_cast<size_t>(size), (PROT_READ | PROT_WRITE), MAP_SHARED, m_file.nativeHandle(), 0);
+
+		if (p == MAP_FAILED)
+		{
+			return false;
+		}
+
+		// 先頭から順に書き込む
+		::madvise(p, static_cast<size_t>(size), MADV_SEQUENTIAL);
+
+		m_mapped = static_cast<uint8*>(p);
+		m_mappedSize = size;
+		return true;
+	}
+
+	bool detail::MemoryMappedFileSink::flush()
+	{
+		if (!m_mapped || (m_flush == HTTPMappedFileFlush::None))
+		{
+			return true;
+		}
+
+		const int flags = ((m_flush == HTTPMappedFileFlush::Sync) ? MS_SYNC : MS_ASYNC);
+
+		return (::msync(m_mapped, static_cast<size_t>(m_mappedSize), flags) == 0);
+	}
+
+	void detail::MemoryMappedFileSink::unmap()
+	{
+		if (m_mapped)
+		{
+			// 書き込み済みのページはもう参照しない
+			::madvise(m_mapped, static_cast<size_t>(m_mappedSize), MADV_DONTNEED);
+			::munmap(m_mapped, static_cast<size_t>(m_mappedSize));
+			m_mapped = nullptr;
+		}
+	}
+
+# endif
+
+	//AtomicRenameFileSink
+
+	detail::AtomicRenameFileSink::AtomicRenameFileSink(std::unique_ptr<IHTTPFileSink>&& sink, const FilePathView temporaryPath, const FilePathView path, const bool sync)
+		: m_sink(std::move(sink))
+		, m_temporaryPath(temporaryPath)
+		, m_path(path)
+		, m_sync(sync)
+	{
+	}
+
+	detail::AtomicRenameFileSink::~AtomicRenameFileSink()
+	{
+		if (!m_finished)
+		{
+			discard();
+		}
+	}
+
+	bool detail::AtomicRenameFileSink::isOpen() const
+	{
+		return m_sink->isOpen();
+	}
+
+	int64 detail::AtomicRenameFileSink::size() const
+	{
+		return m_sink->size();
+	}
+
+	int64 detail::AtomicRenameFileSink::getPos() const
+	{
+		return m_sink->getPos();
+	}
+
+	bool detail::AtomicRenameFileSink::setPos(const int64 pos)
+	{
+		return m_sink->setPos(pos);
+	}
+
+	int64 detail::AtomicRenameFileSink::write(const void* src, const int64 size)
+	{
+		return m_sink->write(src, size);
+	}
+
+	bool detail::AtomicRenameFileSink::preallocate(const int64 size)
+	{
+		return m_sink->preallocate(size);
+	}
+
+	bool detail::AtomicRenameFileSink::commit()
+	{
+		if (!m_sink->commit())
+		{
+			discard();
+			return false;
+		}
+
+		// リネームした後に、中身が書き出されていないファイルが見えないようにする
+		if (m_sync && !SyncFile(m_temporaryPath))
+		{
+			discard();
+			return false;
+		}
+
+		if (!RenameReplacing(m_temporaryPath, m_path))
+		{
+			discard();
+			return false;
+		}
+
+		m_finished = true;
+
+		if (m_sync)
+		{
+			SyncParentDirectory(m_path);
+		}
+
+		return true;
+	}
+
+	void detail::AtomicRenameFileSink::discard()
+	{
+		m_finished = true;
+		m_sink->discard();
+		FileSystem::Remove(m_temporaryPath);
+	}
+
+	bool detail::AtomicRenameFileSink::supportsRandomAccess() const
+	{
+		return m_sink->supportsRandomAccess();
+	}
+
+	FilePath detail::MakeTemporaryFilePath(const FilePathView path)
+	{
+		static std::atomic<uint64> counter = 0;
+
+		const uint64 seed = static_cast<uint64>(std::chrono::steady_clock::now().time_since_epoch().count())
+			^ std::hash<std::thread::id>{}(std::this_thread::get_id())
+			^ (counter++ << 48);
+
+		return U"{}.{:x}.part"_fmt(path, seed);
+	}
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	bool detail::SyncFile(const FilePathView path)
+	{
+		const HANDLE handle = ::CreateFileW(FilePath(path).toWstr().c_str(), GENERIC_WRITE, (FILE_SHARE_READ | FILE_SHARE_WRITE), nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		const bool result = !!::FlushFileBuffers(handle);
+		::CloseHandle(handle);
+		return result;
+	}
+
+	bool detail::SyncParentDirectory(FilePathView)
+	{
+		// MOVEFILE_WRITE_THROUGH によってリネームは書き出し済み
+		return true;
+	}
+
+	bool detail::RenameReplacing(const FilePathView from, const FilePathView to)
+	{
+		return !!::MoveFileExW(FilePath(from).toWstr().c_str(), FilePath(to).toWstr().c_str(),
+			(MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH));
+	}
+
+# else
+
+	namespace detail
+	{
+		static std::string ParentDirectoryUTF8(const FilePathView path)
+		{
+			const std::string pathUTF8 = Unicode::ToUTF8(path);
+			const size_t pos = pathUTF8.rfind('/');
+
+			if (pos == std::string::npos)
+			{
+				return ".";
+			}
+
+			return (pos == 0) ? "/" : pathUTF8.substr(0, pos);
+		}
+	}
+
+	bool detail::SyncFile(const FilePathView path)
+	{
+		const int fd = ::open(Unicode::ToUTF8(path).c_str(), (O_RDONLY | O_CLOEXEC));
+
+		if (fd == -1)
+		{
+			return false;
+		}
+
+		const bool result = (::fsync(fd) == 0);
+		::close(fd);
+		return result;
+	}
+
+	bool detail::SyncParentDirectory(const FilePathView path)
+	{
+		const int fd = ::open(ParentDirectoryUTF8(path).c_str(), (O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+		if (fd == -1)
+		{
+			return false;
+		}
+
+		const bool result = (::fsync(fd) == 0);
+		::close(fd);
+		return result;
+	}
+
+	bool detail::RenameReplacing(const FilePathView from, const FilePathView to)
+	{
+		return (::rename(Unicode::ToUTF8(from).c_str(), Unicode::ToUTF8(to).c_str()) == 0);
+	}
+
+# endif
+
+	bool SimpleHTTP::SyncFiles(const Array<FilePath>& paths)
+	{
+		bool result = true;
+
+	# if SIV3D_PLATFORM(LINUX)
+
+		// syncfs() はファイルシステム全体を 1 回で書き出すので、ファイルシステムごとに 1 回だけ呼ぶ
+		Array<::dev_t> devices;
+
+		for (const auto& path : paths)
+		{
+			const int fd = ::open(detail::ParentDirectoryUTF8(path).c_str(), (O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+
+			if (fd == -1)
+			{
+				result = false;
+				continue;
+			}
+
+			struct ::stat st = {};
+
+			if (::fstat(fd, &st) == 0)
+			{
+				if (std::find(devices.begin(), devices.end(), st.st_dev) == devices.end())
+				{
+					devices.push_back(st.st_dev);
+					result &= (::syncfs(fd) == 0);
+				}
+			}
+			else
+			{
+				result = false;
+			}
+
+			::close(fd);
+		}
+
+	# else
+
+		for (const auto& path : paths)
+		{
+			result &= detail::SyncFile(path);
+		}
+
+	# if !SIV3D_PLATFORM(WINDOWS)
+
+		Array<std::string> directories;
+
+		for (const auto& path : paths)
+		{
+			std::string directory = detail::ParentDirectoryUTF8(path);
+
+			if (std::find(directories.begin(), directories.end(), directory) == directories.end())
+			{
+				directories.push_back(std::move(directory));
+				result &= detail::SyncParentDirectory(path);
+			}
+		}
+
+	# endif
+
+	# endif
+
+		return result;
+	}
+
+	namespace detail
+	{
+		static std::unique_ptr<IHTTPFileSink> CreateBaseFileSink(const FilePathView path, const HTTPRequestOptions& options)
+		{
+			switch (options.writeMode)
+			{
+			case HTTPFileWriteMode::WriteBehind:
+				return std::make_unique<WriteBehindFileSink>(path, options.writeBufferSize, options.writeQueueLength);
+			case HTTPFileWriteMode::MemoryMapped:
+				return std::make_unique<MemoryMappedFileSink>(path, options.mappedFileFlush);
+			case HTTPFileWriteMode::IoUring:
+			# if SIV3D_HTTPCLIENT_IO_URING
+				if (IoUringFileSink::IsAvailable())
+				{
+					auto sink = std::make_unique<IoUringFileSink>(path, options.writeBufferSize, options.writeQueueLength);
+
+					if (sink->isOpen())
+					{
+						return sink;
+					}
+				}
+			# endif
+				return std::make_unique<BinaryWriterFileSink>(path);
+			case HTTPFileWriteMode::Direct:
+			default:
+				return std::make_unique<BinaryWriterFileSink>(path);
+			}
+		}
+	}
+
+	std::unique_ptr<detail::IHTTPFileSink> detail::CreateFileSink(const FilePathView path, const HTTPRequestOptions& options)
+	{
+		if (options.commitMode == HTTPFileCommitMode::AtomicRename)
+		{
+			const FilePath temporaryPath = MakeTemporaryFilePath(path);
+
+			return std::make_unique<AtomicRenameFileSink>(CreateBaseFileSink(temporaryPath, options), temporaryPath, path, options.syncOnCommit);
+		}
+
+		return CreateBaseFileSink(path, options);
+	}
+}
@@ -0,0 +1,219 @@
+﻿#include "HTTPClient.hpp"
+#include "HTTPEngine.hpp"
+#include "HTTPFileSink.hpp"
+#include <mutex>
+
+namespace s3d
+{
+	struct AsyncHTTPImageTask::State
+	{
+		// task, progress, canceled はキャッシュを読み込めなかった場合にワーカースレッドからも使うため、mutex で保護する
+		std::mutex mutex;
+
+		AsyncHTTPTask task;
+
+		HTTPProgress progress;
+
+		bool canceled = false;
+
+		// LoadImageAsync() で作成した場合に true。ワーカースレッドを開始する前に設定し、以降は変更しない
+		bool started = false;
+
+		// status, response, image は ready を true にする前に書き込み、以降は変更しない
+		std::atomic<bool> ready = false;
+
+		HTTPAsyncStatus status = HTTPAsyncStatus::Working;
+
+		HTTPResponse response;
+
+		Image image;
+
+		FilePath cacheFilePath;
+
+		// キャッシュを読み込めなかった場合に、ダウンロードし直すための URL とオプション
+		URL url;
+
+		HTTPRequestOptions options;
+
+		~State()
+		{
+			// then() を登録しているため AsyncHTTPTask は通信を続ける。画像が不要になったので中断する
+			if (!task.isFinished())
+			{
+				task.cancelTask();
+			}
+		}
+
+		void finish(const HTTPAsyncStatus _status)
+		{
+			status = _status;
+			ready.store(true, std::memory_order_release);
+		}
+	};
+
+	namespace detail
+	{
+		namespace
+		{
+			/// <summary>
+			/// 受信した画像のデータをキャッシュのファイルに保存します。書き込みの途中のファイルが読み込まれないように、リネームで確定させます。
+			/// </summary>
+			void SaveCache(const FilePathView path, const Array<uint8>& data)
+			{
+				HTTPRequestOptions options;
+				options.commitMode = HTTPFileCommitMode::AtomicRename;
+
+				const auto sink = CreateFileSink(path, options);
+
+				if (!sink->isOpen())
+				{
+					return;
+				}
+
+				if ((sink->write(data.data(), static_cast<int64>(data.size())) != static_cast<int64>(data.size()))
+					|| !sink->commit())
+				{
+					sink->discard();
+					LOG_FAIL(U"Failed to write the image cache: {}"_fmt(path));
+				}
+			}
+		}
+	}
+
+	void AsyncHTTPImageTask::LoadCachedImage(void* context)
+	{
+		const std::unique_ptr<std::shared_ptr<State>> holder(static_cast<std::shared_ptr<State>*>(context));
+		State& state = **holder;
+
+		state.image = Image(state.cacheFilePath);
+
+		if (state.image)
+		{
+			state.finish(HTTPAsyncStatus::Succeeded);
+			return;
+		}
+
+		// 壊れたキャッシュは削除し、ダウンロードし直す
+		LOG_FAIL(U"Failed to decode the image cache: {}"_fmt(state.cacheFilePath));
+		FileSystem::Remove(state.cacheFilePath);
+
+		StartDownload(*holder);
+	}
+
+	void AsyncHTTPImageTask::StartDownload(const std::shared_ptr<State>& state)
+	{
+		// ファイルに保存せず、メモリに受信する
+		const auto transfer = std::make_shared<detail::HTTPEngineTransfer>(state->url, HTTPHeader{}, state->options,
+			[]() { return std::make_unique<detail::MemoryFileSink>(); });
+
+		std::lock_guard lock(state->mutex);
+
+		// キャッシュの読み込み中に中断された
+		if (state->canceled)
+		{
+			state->finish(HTTPAsyncStatus::Canceled);
+			return;
+		}
+
+		state->task = AsyncHTTPTask(transfer);
+
+		// then() の処理の実行中は transfer が破棄されない。AsyncHTTPImageTask が先に破棄された場合はデコードしない
+		state->task.then([weakState = std::weak_ptr<State>(state), transfer = transfer.get()](const HTTPResponse& response)
+		{
+			const auto state = weakState.lock();
+
+			if (!state)
+			{
+				return;
+			}
+
+			state->response = response;
+
+			if (!response || !SimpleHTTP::IsStatusCodeTypeOf(response.getStatusCode(), HTTPResponseStatusType::Successful))
+			{
+				state->finish((response.getError() == HTTPError::None) ? HTTPAsyncStatus::Failed : transfer->progress.status.load(std::memory_order_acquire));
+				return;
+			}
+
+			const Array<uint8>& data = static_cast<const detail::MemoryFileSink&>(*transfer->sink).data();
+
+			state->image = Image(ByteArray(data.data(), data.size()));
+
+			if (state->image && !state->cacheFilePath.isEmpty())
+			{
+				detail::SaveCache(state->cacheFilePath, data);
+			}
+
+			state->finish(state->image ? HTTPAsyncStatus::Succeeded : HTTPAsyncStatus::Failed);
+		}, HTTPExecutor::ThreadPool);
+	}
+
+	AsyncHTTPImageTask::AsyncHTTPImageTask()
+		: m_state(std::make_shared<State>()) {}
+
+	const HTTPProgress& AsyncHTTPImageTask::getProgress() const
+	{
+		std::lock_guard lock(m_state->mutex);
+		m_state->progress = m_state->task.getProgress();
+		return m_state->progress;
+	}
+
+	HTTPAsyncStatus AsyncHTTPImageTask::currentStatus() const
+	{
+		// status はワーカースレッドが書き込むため、ready を確認してから読む
+		if (m_state->ready.load(std::memory_order_acquire))
+		{
+			return m_state->status;
+		}
+
+		return (m_state->started ? HTTPAsyncStatus::Working : HTTPAsyncStatus::None);
+	}
+
+	bool AsyncHTTPImageTask::isReady() const
+	{
+		return m_state->ready.load(std::memory_order_acquire);
+	}
+
+	const HTTPResponse& AsyncHTTPImageTask::getResponse() const
+	{
+		return m_state->response;
+	}
+
+	Image AsyncHTTPImageTask::getImage()
+	{
+		if (!isReady())
+		{
+			return Image();
+		}
+
+		return std::move(m_state->image);
+	}
+
+	void AsyncHTTPImageTask::cancelTask()
+	{
+		std::lock_guard lock(m_state->mutex);
+		m_state->canceled = true;
+		m_state->task.cancelTask();
+	}
+
+	AsyncHTTPImageTask SimpleHTTP::LoadImageAsync(const URLView url, const HTTPRequestOptions& options, const FilePathView cacheFilePath)
+	{
+		AsyncHTTPImageTask result;
+		const auto state = result.m_state;
+		state->started = true;
+		state->cacheFilePath = FilePath(cacheFilePath);
+		state->url = URL(url);
+		state->options = options;
+
+		if (!state->cacheFilePath.isEmpty() && FileSystem::Exists(state->cacheFilePath))
+		{
+			// キャッシュから読み込む場合も、デコードはワーカースレッドで行う
+			detail::Schedule(HTTPExecutor::ThreadPool, &AsyncHTTPImageTask::LoadCachedImage, new std::shared_ptr<AsyncHTTPImageTask::State>(state));
+			return result;
+		}
+
+		AsyncHTTPImageTask::StartDownload(state);
+
+		return result;
+	}
+}
@@ -0,0 +1,496 @@
+﻿# include <cstring>
+# include "HTTPFileSink.hpp"
+
+# if SIV3D_HTTPCLIENT_IO_URING
+
+# include <cerrno>
+# include <cstdlib>
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <unistd.h>
+
+namespace s3d
+{
+	namespace detail
+	{
+		// 書き込みはバッファ 1 個ずつ発行せず、この数までまとめてから発行する
+		constexpr uint32 IoUringSubmitBatch = 4;
+
+		constexpr size_t IoUringBufferAlignment = 4096;
+
+		static int IoUringSetup(const uint32 entries, ::io_uring_params* params)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+		}
+
+		static int IoUringEnter(const int fd, const uint32 toSubmit, const uint32 minComplete, const uint32 flags)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+		}
+
+		static int IoUringRegister(const int fd, const uint32 opcode, const void* arg, const uint32 count)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+		}
+	}
+
+	struct detail::IoUringFileSink::Ring
+	{
+		int fd = -1;
+
+		void* sqRing = nullptr;
+
+		size_t sqRingSize = 0;
+
+		void* cqRing = nullptr;
+
+		size_t cqRingSize = 0;
+
+		::io_uring_sqe* sqes = nullptr;
+
+		size_t sqesSize = 0;
+
+		uint32* sqTail = nullptr;
+
+		uint32* sqMask = nullptr;
+
+		uint32* sqArray = nullptr;
+
+		uint32* cqHead = nullptr;
+
+		uint32* cqTail = nullptr;
+
+		uint32* cqMask = nullptr;
+
+		::io_uring_cqe* cqes = nullptr;
+
+		bool init(const uint32 entries)
+		{
+			::io_uring_params params = {};
+
+			fd = IoUringSetup(entries, &params);
+
+			if (fd < 0)
+			{
+				fd = -1;
+				return false;
+			}
+
+			sqRingSize = (params.sq_off.array + params.sq_entries * sizeof(uint32));
+			cqRingSize = (params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe));
+
+			const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP);
+
+			if (singleMap)
+			{
+				sqRingSize = cqRingSize = Max(sqRingSize, cqRingSize);
+			}
+
+			sqRing = ::mmap(nullptr, sqRingSize, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), fd, IORING_OFF_SQ_RING);
+
+			if (sqRing == MAP_FAILED)
+			{
+				sqRing = nullptr;
+				return false;
+			}
+
+			if (singleMap)
+			{
+				cqRing = sqRing;
+			}
+			else
+			{
+				cqRing = ::mmap(nullptr, cqRingSize, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), fd, IORING_OFF_CQ_RING);
+
+				if (cqRing == MAP_FAILED)
+				{
+					cqRing = nullptr;
+					return false;
+				}
+			}
+
+			sqesSize = (params.sq_entries * sizeof(::io_uring_sqe));
+			void* p = ::mmap(nullptr, sqesSize, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), fd, IORING_OFF_SQES);
+
+			if (p == MAP_FAILED)
+			{
+				return false;
+			}
+
+			sqes = static_cast<::io_uring_sqe*>(p);
+
+			uint8* const sq = static_cast<uint8*>(sqRing);
+			sqTail = reinterpret_cast<uint32*>(sq + params.sq_off.tail);
+			sqMask = reinterpret_cast<uint32*>(sq + params.sq_off.ring_mask);
+			sqArray = reinterpret_cast<uint32*>(sq + params.sq_off.array);
+
+			uint8* const cq = static_cast<uint8*>(cqRing);
+			cqHead = reinterpret_cast<uint32*>(cq + params.cq_off.head);
+			cqTail = reinterpret_cast<uint32*>(cq + params.cq_off.tail);
+			cqMask = reinterpret_cast<uint32*>(cq + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			return true;
+		}
+
+		::io_uring_sqe* getSQE()
+		{
+			const uint32 tail = *sqTail;
+			const uint32 index = (tail & *sqMask);
+
+			::io_uring_sqe* sqe = &sqes[index];
+			std::memset(sqe, 0, sizeof(::io_uring_sqe));
+			sqArray[index] = index;
+
+			return sqe;
+		}
+
+		// getSQE() で得た SQE の内容を書き終えてから末尾を進め、カーネルに見えるようにする
+		void commitSQE()
+		{
+			__atomic_store_n(sqTail, (*sqTail + 1), __ATOMIC_RELEASE);
+		}
+
+		~Ring()
+		{
+			if (sqes)
+			{
+				::munmap(sqes, sqesSize);
+			}
+
+			if (cqRing && (cqRing != sqRing))
+			{
+				::munmap(cqRing, cqRingSize);
+			}
+
+			if (sqRing)
+			{
+				::munmap(sqRing, sqRingSize);
+			}
+
+			if (fd != -1)
+			{
+				::close(fd);
+			}
+		}
+	};
+
+	bool detail::IoUringFileSink::IsAvailable()
+	{
+		static const bool available = []()
+		{
+			::io_uring_params params = {};
+
+			const int fd = IoUringSetup(1, &params);
+
+			if (fd < 0)
+			{
+				// ENOSYS: カーネルが io_uring に対応していない
+				// EPERM: sysctl や seccomp で無効化されている
+				LOG_INFO(U"io_uring is not available (errno: {})"_fmt(errno));
+				return false;
+			}
+
+			::close(fd);
+			return true;
+		}();
+
+		return available;
+	}
+
+	detail::IoUringFileSink::IoUringFileSink(const FilePathView path, const size_t bufferSize, const size_t queueLength)
+		: m_ring(std::make_unique<Ring>())
+		, m_bufferSize(Max<size_t>(((bufferSize + IoUringBufferAlignment - 1) / IoUringBufferAlignment) * IoUringBufferAlignment, IoUringBufferAlignment))
+	{
+		const uint32 bufferCount = static_cast<uint32>(Clamp<size_t>(queueLength, 1, 64) + 1);
+
+		if (!m_ring->init(bufferCount))
+		{
+			release();
+			return;
+		}
+
+		Array<::iovec> iovecs;
+
+		for (uint32 i = 0; i < bufferCount; ++i)
+		{
+			void* p = nullptr;
+
+			if (::posix_memalign(&p, IoUringBufferAlignment, m_bufferSize) != 0)
+			{
+				release();
+				return;
+			}
+
+			m_buffers.push_back(Buffer{ static_cast<uint8*>(p), 0, 0 });
+			m_freeBuffers.push_back(static_cast<uint16>(i));
+			iovecs.push_back(::iovec{ p, m_bufferSize });
+		}
+
+		// 登録できない場合（RLIMIT_MEMLOCK など）は通常の書き込みを使う
+		m_registered = (IoUringRegister(m_ring->fd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<uint32>(iovecs.size())) == 0);
+
+		m_file.open(path);
+	}
+
+	detail::IoUringFileSink::~IoUringFileSink()
+	{
+		if (m_file.isOpen())
+		{
+			discard();
+		}
+
+		release();
+	}
+
+	bool detail::IoUringFileSink::isOpen() const
+	{
+		return m_file.isOpen();
+	}
+
+	int64 detail::IoUringFileSink::size() const
+	{
+		return m_writtenSize;
+	}
+
+	int64 detail::IoUringFileSink::getPos() const
+	{
+		return m_writtenSize;
+	}
+
+	bool detail::IoUringFileSink::setPos(int64)
+	{
+		return false;
+	}
+
+	int64 detail::IoUringFileSink::write(const void* src, const int64 size)
+	{
+		const uint8* p = static_cast<const uint8*>(src);
+		int64 remaining = size;
+
+		while (0 < remaining)
+		{
+			if (!m_current)
+			{
+				// 空きバッファができるまで、発行済みの書き込みの完了を待つ
+				while (m_freeBuffers.isEmpty() && !m_failed)
+				{
+					if (!submit(1))
+					{
+						break;
+					}
+				}
+
+				if (m_failed)
+				{
+					return 0;
+				}
+
+				m_current = m_freeBuffers.back();
+				m_freeBuffers.pop_back();
+
+				Buffer& buffer = m_buffers[*m_current];
+				buffer.size = 0;
+				buffer.offset = m_writtenSize;
+			}
+
+			Buffer& buffer = m_buffers[*m_current];
+			const size_t toCopy = static_cast<size_t>(Min<int64>(remaining, static_cast<int64>(m_bufferSize - buffer.size)));
+			std::memcpy(buffer.data + buffer.size, p, toCopy);
+
+			buffer.size += toCopy;
+			m_writtenSize += toCopy;
+			p += toCopy;
+			remaining -= toCopy;
+
+			if (buffer.size == m_bufferSize)
+			{
+				queueCurrent();
+
+				if (IoUringSubmitBatch <= m_unsubmitted)
+				{
+					submit(0);
+				}
+			}
+		}
+
+		return (m_failed ? 0 : size);
+	}
+
+	bool detail::IoUringFileSink::preallocate(const int64 size)
+	{
+		if (!m_file.isOpen())
+		{
+			return false;
+		}
+
+		return m_file.preallocate(size);
+	}
+
+	bool detail::IoUringFileSink::commit()
+	{
+		if (!m_file.isOpen())
+		{
+			return false;
+		}
+
+		queueCurrent();
+
+		const bool result = waitAll();
+		m_file.close();
+		return result;
+	}
+
+	void detail::IoUringFileSink::discard()
+	{
+		if (m_current)
+		{
+			m_freeBuffers.push_back(*m_current);
+			m_current.reset();
+		}
+
+		// 発行済みの書き込みがバッファを参照しなくなるまで待つ
+		waitAll();
+
+		if (m_file.isOpen())
+		{
+			m_file.truncate(0);
+			m_file.close();
+		}
+	}
+
+	void detail::IoUringFileSink::queueCurrent()
+	{
+		if (!m_current)
+		{
+			return;
+		}
+
+		const uint16 index = *m_current;
+		const Buffer& buffer = m_buffers[index];
+		m_current.reset();
+
+		if (buffer.size == 0)
+		{
+			m_freeBuffers.push_back(index);
+			return;
+		}
+
+		::io_uring_sqe* sqe = m_ring->getSQE();
+		sqe->opcode = (m_registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+		sqe->fd = m_file.nativeHandle();
+		sqe->addr = reinterpret_cast<uint64>(buffer.data);
+		sqe->len = static_cast<uint32>(buffer.size);
+		sqe->off = static_cast<uint64>(buffer.offset);
+		sqe->buf_index = (m_registered ? index : 0);
+		sqe->user_data = index;
+		m_ring->commitSQE();
+
+		++m_unsubmitted;
+		++m_inFlight;
+	}
+
+	bool detail::IoUringFileSink::submit(const uint32 waitCount)
+	{
+		const uint32 flags = ((0 < waitCount) ? IORING_ENTER_GETEVENTS : 0);
+
+		for (;;)
+		{
+			const int result = IoUringEnter(m_ring->fd, m_unsubmitted, waitCount, flags);
+
+			if (0 <= result)
+			{
+				m_unsubmitted -= Min<uint32>(static_cast<uint32>(result), m_unsubmitted);
+				break;
+			}
+
+			if (errno != EINTR)
+			{
+				m_failed = true;
+				return false;
+			}
+		}
+
+		reap();
+		return true;
+	}
+
+	void detail::IoUringFileSink::reap()
+	{
+		uint32 head = *m_ring->cqHead;
+		const uint32 tail = __atomic_load_n(m_ring->cqTail, __ATOMIC_ACQUIRE);
+
+		while (head != tail)
+		{
+			const ::io_uring_cqe& cqe = m_ring->cqes[head & *m_ring->cqMask];
+			const uint16 index = static_cast<uint16>(cqe.user_data);
+			const Buffer& buffer = m_buffers[index];
+
+			if (static_cast<int64>(cqe.res) < static_cast<int64>(buffer.size))
+			{
+				// 失敗した書き込みや書き込みきれなかった残りは、同期的に書き込む
+				const size_t written = static_cast<size_t>(Max(cqe.res, 0));
+
+				if (!m_file.writeAt((buffer.offset + written), (buffer.data + written), (buffer.size - written)))
+				{
+					m_failed = true;
+				}
+			}
+
+			m_freeBuffers.push_back(index);
+			--m_inFlight;
+			++head;
+		}
+
+		__atomic_store_n(m_ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	bool detail::IoUringFileSink::waitAll()
+	{
+		// 書き込みが失敗していても、カーネルがバッファを参照しなくなるまで待つ
+		while (0 < m_inFlight)
+		{
+			if (!submit(1))
+			{
+				// io_uring_enter 自体が失敗した場合は、これ以上完了を待てない。バッファは release() で解放しない
+				return false;
+			}
+		}
+
+		return !m_failed;
+	}
+
+	void detail::IoUringFileSink::release()
+	{
+		// 完了を確認できなかった書き込みがある場合、カーネルがまだ読んでいる可能性があるため、バッファを解放せずに残す
+		if (m_inFlight != 0)
+		{
+			LOG_FAIL(U"IoUringFileSink: {} writes did not complete; leaking their buffers"_fmt(m_inFlight));
+			m_registered = false;
+			m_ring.reset();
+			m_buffers.clear();
+			m_freeBuffers.clear();
+			return;
+		}
+
+		if (m_registered)
+		{
+			IoUringRegister(m_ring->fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+			m_registered = false;
+		}
+
+		m_ring.reset();
+
+		for (Buffer& buffer : m_buffers)
+		{
+			::free(buffer.data);
+		}
+
+		m_buffers.clear();
+		m_freeBuffers.clear();
+	}
+}
+
+# endif
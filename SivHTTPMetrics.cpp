@@ -0,0 +1,501 @@
+﻿#include "HTTPMetrics.hpp"
+#include "HTTPRequest.hpp"
+
+namespace s3d
+{
+	namespace detail
+	{
+		namespace
+		{
+			// 記録するホストの最大数。超えた分は 1 つにまとめる
+			constexpr size_t HostTableSize = 256;
+
+			struct HostEntry
+			{
+				String host;
+
+				HTTPMetricsCounters counters;
+			};
+
+			/// <summary>
+			/// ホストごとの集計先の表
+			/// 追加だけを行うオープンアドレス法のハッシュ表で、探索と追加はどちらも CAS だけで行います。
+			/// </summary>
+			class HTTPMetricsRegistry
+			{
+			private:
+
+				std::array<std::atomic<HostEntry*>, HostTableSize> m_hosts = {};
+
+				HostEntry m_otherHosts{ U"(other)", {} };
+
+				static size_t Hash(const StringView host)
+				{
+					// FNV-1a
+					uint64 hash = 14695981039346656037ULL;
+
+					for (const char32 ch : host)
+					{
+						hash = ((hash ^ static_cast<uint64>(ch)) * 1099511628211ULL);
+					}
+
+					return static_cast<size_t>(hash);
+				}
+
+			public:
+
+				HTTPMetricsCounters global;
+
+				~HTTPMetricsRegistry()
+				{
+					for (auto& slot : m_hosts)
+					{
+						delete slot.load();
+					}
+				}
+
+				HTTPMetricsCounters& getHost(const StringView host)
+				{
+					const size_t hash = Hash(host);
+
+					for (size_t i = 0; i < HostTableSize; ++i)
+					{
+						std::atomic<HostEntry*>& slot = m_hosts[(hash + i) % HostTableSize];
+						HostEntry* entry = slot.load(std::memory_order_acquire);
+
+						if (!entry)
+						{
+							HostEntry* const newEntry = new HostEntry{ String(host), {} };
+
+							if (slot.compare_exchange_strong(entry, newEntry, std::memory_order_acq_rel))
+							{
+								return newEntry->counters;
+							}
+
+							// 他のスレッドが先に追加した
+							delete newEntry;
+						}
+
+						if (entry->host == host)
+						{
+							return entry->counters;
+						}
+					}
+
+					return m_otherHosts.counters;
+				}
+
+				HashTable<String, HTTPMetricsSnapshot> loadHosts() const
+				{
+					HashTable<String, HTTPMetricsSnapshot> snapshots;
+
+					for (const auto& slot : m_hosts)
+					{
+						if (const HostEntry* entry = slot.load(std::memory_order_acquire))
+						{
+							snapshots.emplace(entry->host, entry->counters.load());
+						}
+					}
+
+					const HTTPMetricsSnapshot other = m_otherHosts.counters.load();
+
+					if (other.requestsStarted)
+					{
+						snapshots.emplace(m_otherHosts.host, other);
+					}
+
+					return snapshots;
+				}
+
+				void reset()
+				{
+					global.reset();
+
+					for (auto& slot : m_hosts)
+					{
+						if (HostEntry* entry = slot.load(std::memory_order_acquire))
+						{
+							entry->counters.reset();
+						}
+					}
+
+					m_otherHosts.counters.reset();
+				}
+			};
+
+			HTTPMetricsRegistry& GetRegistry()
+			{
+				static HTTPMetricsRegistry registry;
+				return registry;
+			}
+
+			void AddRequestStarted(HTTPMetricsCounters& counters)
+			{
+				counters.requestsStarted.fetch_add(1, std::memory_order_relaxed);
+				counters.queuedRequests.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void AddRequestDispatched(HTTPMetricsCounters& counters)
+			{
+				counters.queuedRequests.fetch_sub(1, std::memory_order_relaxed);
+				counters.inFlightRequests.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			void AddRequestFinished(HTTPMetricsCounters& counters, const bool dispatched, const HTTPAsyncStatus status, const HTTPTransferInfo& info)
+			{
+				switch (status)
+				{
+				case HTTPAsyncStatus::Succeeded:
+					counters.requestsSucceeded.fetch_add(1, std::memory_order_relaxed);
+					break;
+				case HTTPAsyncStatus::Canceled:
+					counters.requestsCanceled.fetch_add(1, std::memory_order_relaxed);
+					break;
+				case HTTPAsyncStatus::TimedOut:
+					counters.requestsTimedOut.fetch_add(1, std::memory_order_relaxed);
+					break;
+				default:
+					counters.requestsFailed.fetch_add(1, std::memory_order_relaxed);
+					break;
+				}
+
+				(dispatched ? counters.inFlightRequests : counters.queuedRequests).fetch_sub(1, std::memory_order_relaxed);
+				counters.bytesSent.fetch_add(static_cast<uint64>(Max<int64>(info.bytesSent, 0)), std::memory_order_relaxed);
+
+				if (info.newConnections > 0)
+				{
+					counters.connectionsCreated.fetch_add(static_cast<uint64>(info.newConnections), std::memory_order_relaxed);
+				}
+				else if (info.ttfbMicrosec >= 0)
+				{
+					counters.connectionsReused.fetch_add(1, std::memory_order_relaxed);
+				}
+
+				if (info.dnsMicrosec >= 0)
+				{
+					counters.dnsLatency.record(info.dnsMicrosec);
+				}
+
+				if (info.connectMicrosec >= 0)
+				{
+					counters.connectLatency.record(info.connectMicrosec);
+				}
+
+				if (info.tlsMicrosec >= 0)
+				{
+					counters.tlsLatency.record(info.tlsMicrosec);
+				}
+
+				if (info.ttfbMicrosec >= 0)
+				{
+					counters.ttfbLatency.record(info.ttfbMicrosec);
+				}
+			}
+
+			/// <summary>
+			/// ヒストグラムを追加します。host が空の場合はプロセス全体の値として追加します。
+			/// </summary>
+			void AppendHistogramText(String& text, const StringView name, const StringView host, const HTTPLatencyHistogram& histogram)
+			{
+				const String bucketLabels = (host.isEmpty() ? String() : U"host=\"{}\","_fmt(host));
+				const String labels = (host.isEmpty() ? String() : U"{{host=\"{}\"}}"_fmt(host));
+
+				uint64 cumulative = 0;
+
+				for (size_t i = 0; i < HTTPLatencyHistogram::BucketCount; ++i)
+				{
+					cumulative += histogram.buckets[i];
+
+					const String le = ((i + 1) == HTTPLatencyHistogram::BucketCount) ? String(U"+Inf")
+						: U"{}"_fmt(HTTPLatencyHistogram::BucketUpperBoundMicrosec(i) / 1'000'000.0);
+
+					text += U"{}_bucket{{{}le=\"{}\"}} {}\n"_fmt(name, bucketLabels, le, cumulative);
+				}
+
+				text += U"{}_sum{} {}\n"_fmt(name, labels, (histogram.sumMicrosec / 1'000'000.0));
+				text += U"{}_count{} {}\n"_fmt(name, labels, histogram.count);
+			}
+		}
+
+		void AtomicLatencyHistogram::record(const int64 microsec)
+		{
+			size_t index = 0;
+
+			while (((index + 1) < HTTPLatencyHistogram::BucketCount)
+				&& (HTTPLatencyHistogram::BucketUpperBoundMicrosec(index) < microsec))
+			{
+				++index;
+			}
+
+			m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sumMicrosec.fetch_add(microsec, std::memory_order_relaxed);
+		}
+
+		HTTPLatencyHistogram AtomicLatencyHistogram::load() const
+		{
+			HTTPLatencyHistogram histogram;
+
+			for (size_t i = 0; i < HTTPLatencyHistogram::BucketCount; ++i)
+			{
+				histogram.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+			}
+
+			histogram.count = m_count.load(std::memory_order_relaxed);
+			histogram.sumMicrosec = m_sumMicrosec.load(std::memory_order_relaxed);
+
+			return histogram;
+		}
+
+		void AtomicLatencyHistogram::reset()
+		{
+			for (auto& bucket : m_buckets)
+			{
+				bucket.store(0, std::memory_order_relaxed);
+			}
+
+			m_count.store(0, std::memory_order_relaxed);
+			m_sumMicrosec.store(0, std::memory_order_relaxed);
+		}
+
+		HTTPMetricsSnapshot HTTPMetricsCounters::load() const
+		{
+			HTTPMetricsSnapshot snapshot;
+			snapshot.requestsStarted = requestsStarted.load(std::memory_order_relaxed);
+			snapshot.requestsSucceeded = requestsSucceeded.load(std::memory_order_relaxed);
+			snapshot.requestsFailed = requestsFailed.load(std::memory_order_relaxed);
+			snapshot.requestsCanceled = requestsCanceled.load(std::memory_order_relaxed);
+			snapshot.requestsTimedOut = requestsTimedOut.load(std::memory_order_relaxed);
+			snapshot.retries = retries.load(std::memory_order_relaxed);
+			snapshot.hedges = hedges.load(std::memory_order_relaxed);
+			snapshot.hedgesWon = hedgesWon.load(std::memory_order_relaxed);
+			snapshot.mirrorSwitches = mirrorSwitches.load(std::memory_order_relaxed);
+			snapshot.bytesReceived = bytesReceived.load(std::memory_order_relaxed);
+			snapshot.bytesSent = bytesSent.load(std::memory_order_relaxed);
+			snapshot.connectionsCreated = connectionsCreated.load(std::memory_order_relaxed);
+			snapshot.connectionsReused = connectionsReused.load(std::memory_order_relaxed);
+			snapshot.queuedRequests = queuedRequests.load(std::memory_order_relaxed);
+			snapshot.inFlightRequests = inFlightRequests.load(std::memory_order_relaxed);
+			snapshot.concurrencyLimit = concurrencyLimit.load(std::memory_order_relaxed);
+			snapshot.dnsLatency = dnsLatency.load();
+			snapshot.connectLatency = connectLatency.load();
+			snapshot.tlsLatency = tlsLatency.load();
+			snapshot.ttfbLatency = ttfbLatency.load();
+			return snapshot;
+		}
+
+		void HTTPMetricsCounters::reset()
+		{
+			for (auto* counter : { &requestsStarted, &requestsSucceeded, &requestsFailed, &requestsCanceled, &requestsTimedOut,
+				&retries, &hedges, &hedgesWon, &mirrorSwitches, &bytesReceived, &bytesSent, &connectionsCreated, &connectionsReused })
+			{
+				counter->store(0, std::memory_order_relaxed);
+			}
+
+			dnsLatency.reset();
+			connectLatency.reset();
+			tlsLatency.reset();
+			ttfbLatency.reset();
+		}
+
+		HTTPRequestMetrics::HTTPRequestMetrics(const URLView url)
+			: m_host(&GetRegistry().getHost(GetURLHost(url)))
+		{
+			AddRequestStarted(GetRegistry().global);
+			AddRequestStarted(*m_host);
+		}
+
+		HTTPRequestMetrics::~HTTPRequestMetrics()
+		{
+			if (!m_finished)
+			{
+				finish(HTTPAsyncStatus::Failed, HTTPTransferInfo{});
+			}
+		}
+
+		void HTTPRequestMetrics::dispatched()
+		{
+			if (m_dispatched || m_finished)
+			{
+				return;
+			}
+
+			m_dispatched = true;
+
+			AddRequestDispatched(GetRegistry().global);
+			AddRequestDispatched(*m_host);
+		}
+
+		void HTTPRequestMetrics::addBytesReceived(const size_t size)
+		{
+			GetRegistry().global.bytesReceived.fetch_add(size, std::memory_order_relaxed);
+			m_host->bytesReceived.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void HTTPRequestMetrics::retried()
+		{
+			GetRegistry().global.retries.fetch_add(1, std::memory_order_relaxed);
+			m_host->retries.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void HTTPRequestMetrics::hedged()
+		{
+			GetRegistry().global.hedges.fetch_add(1, std::memory_order_relaxed);
+			m_host->hedges.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void HTTPRequestMetrics::hedgeWon()
+		{
+			GetRegistry().global.hedgesWon.fetch_add(1, std::memory_order_relaxed);
+			m_host->hedgesWon.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void HTTPRequestMetrics::mirrorSwitched()
+		{
+			GetRegistry().global.mirrorSwitches.fetch_add(1, std::memory_order_relaxed);
+			m_host->mirrorSwitches.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		HTTPLatencyHistogram HTTPRequestMetrics::loadHostTTFB() const
+		{
+			return m_host->ttfbLatency.load();
+		}
+
+		void HTTPRequestMetrics::finish(const HTTPAsyncStatus status, const HTTPTransferInfo& info)
+		{
+			if (m_finished)
+			{
+				return;
+			}
+
+			m_finished = true;
+
+			AddRequestFinished(GetRegistry().global, m_dispatched, status, info);
+			AddRequestFinished(*m_host, m_dispatched, status, info);
+		}
+
+		void SetHostConcurrencyLimit(const StringView host, const int64 limit)
+		{
+			const int64 previous = GetRegistry().getHost(host).concurrencyLimit.exchange(limit, std::memory_order_relaxed);
+
+			// 全体の値は、ホストごとの上限の合計
+			GetRegistry().global.concurrencyLimit.fetch_add((limit - previous), std::memory_order_relaxed);
+		}
+	}
+
+	Optional<double> HTTPLatencyHistogram::meanMs() const
+	{
+		if (count == 0)
+		{
+			return none;
+		}
+
+		return (static_cast<double>(sumMicrosec) / count / 1000.0);
+	}
+
+	Optional<double> HTTPLatencyHistogram::percentileMs(const double p) const
+	{
+		if (count == 0)
+		{
+			return none;
+		}
+
+		const uint64 rank = Max<uint64>(1, static_cast<uint64>(Clamp(p, 0.0, 1.0) * count + 0.5));
+		uint64 cumulative = 0;
+
+		for (size_t i = 0; i < BucketCount; ++i)
+		{
+			cumulative += buckets[i];
+
+			if (rank <= cumulative)
+			{
+				// 最後のバケットには上限が無いので、平均値で代用する
+				if ((i + 1) == BucketCount)
+				{
+					break;
+				}
+
+				return (BucketUpperBoundMicrosec(i) / 1000.0);
+			}
+		}
+
+		return Max(*meanMs(), (BucketUpperBoundMicrosec(BucketCount - 2) / 1000.0));
+	}
+
+	namespace HTTPMetrics
+	{
+		HTTPMetricsSnapshot GetSnapshot()
+		{
+			return detail::GetRegistry().global.load();
+		}
+
+		HashTable<String, HTTPMetricsSnapshot> GetHostSnapshots()
+		{
+			return detail::GetRegistry().loadHosts();
+		}
+
+		String ExportText()
+		{
+			const HTTPMetricsSnapshot global = GetSnapshot();
+			const HashTable<String, HTTPMetricsSnapshot> hosts = GetHostSnapshots();
+
+			String text;
+
+			const auto appendCounter = [&](const StringView name, const StringView type, const auto member)
+			{
+				text += U"# TYPE {} {}\n"_fmt(name, type);
+				text += U"{} {}\n"_fmt(name, global.*member);
+
+				for (const auto& [host, snapshot] : hosts)
+				{
+					text += U"{}{{host=\"{}\"}} {}\n"_fmt(name, host, snapshot.*member);
+				}
+			};
+
+			appendCounter(U"siv3d_http_requests_started_total", U"counter", &HTTPMetricsSnapshot::requestsStarted);
+			appendCounter(U"siv3d_http_requests_succeeded_total", U"counter", &HTTPMetricsSnapshot::requestsSucceeded);
+			appendCounter(U"siv3d_http_requests_failed_total", U"counter", &HTTPMetricsSnapshot::requestsFailed);
+			appendCounter(U"siv3d_http_requests_canceled_total", U"counter", &HTTPMetricsSnapshot::requestsCanceled);
+			appendCounter(U"siv3d_http_requests_timed_out_total", U"counter", &HTTPMetricsSnapshot::requestsTimedOut);
+			appendCounter(U"siv3d_http_retries_total", U"counter", &HTTPMetricsSnapshot::retries);
+			appendCounter(U"siv3d_http_hedges_total", U"counter", &HTTPMetricsSnapshot::hedges);
+			appendCounter(U"siv3d_http_hedges_won_total", U"counter", &HTTPMetricsSnapshot::hedgesWon);
+			appendCounter(U"siv3d_http_mirror_switches_total", U"counter", &HTTPMetricsSnapshot::mirrorSwitches);
+			appendCounter(U"siv3d_http_received_bytes_total", U"counter", &HTTPMetricsSnapshot::bytesReceived);
+			appendCounter(U"siv3d_http_sent_bytes_total", U"counter", &HTTPMetricsSnapshot::bytesSent);
+			appendCounter(U"siv3d_http_connections_created_total", U"counter", &HTTPMetricsSnapshot::connectionsCreated);
+			appendCounter(U"siv3d_http_connections_reused_total", U"counter", &HTTPMetricsSnapshot::connectionsReused);
+
+			appendCounter(U"siv3d_http_requests_queued", U"gauge", &HTTPMetricsSnapshot::queuedRequests);
+			appendCounter(U"siv3d_http_requests_in_flight", U"gauge", &HTTPMetricsSnapshot::inFlightRequests);
+			appendCounter(U"siv3d_http_concurrency_limit", U"gauge", &HTTPMetricsSnapshot::concurrencyLimit);
+
+			const std::pair<StringView, HTTPLatencyHistogram HTTPMetricsSnapshot::*> histograms[] =
+			{
+				{ U"siv3d_http_dns_seconds", &HTTPMetricsSnapshot::dnsLatency },
+				{ U"siv3d_http_connect_seconds", &HTTPMetricsSnapshot::connectLatency },
+				{ U"siv3d_http_tls_seconds", &HTTPMetricsSnapshot::tlsLatency },
+				{ U"siv3d_http_ttfb_seconds", &HTTPMetricsSnapshot::ttfbLatency },
+			};
+
+			for (const auto& [name, member] : histograms)
+			{
+				text += U"# TYPE {} histogram\n"_fmt(name);
+
+				detail::AppendHistogramText(text, name, U"", global.*member);
+
+				for (const auto& [host, snapshot] : hosts)
+				{
+					detail::AppendHistogramText(text, name, host, snapshot.*member);
+				}
+			}
+
+			return text;
+		}
+
+		void Reset()
+		{
+			detail::GetRegistry().reset();
+		}
+	}
+}
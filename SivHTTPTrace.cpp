@@ -0,0 +1,373 @@
+﻿#include "HTTPTrace.hpp"
+#include "HTTPMetrics.hpp"
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+namespace s3d
+{
+	namespace detail
+	{
+		namespace
+		{
+			constexpr size_t TraceURLSize = 120;
+
+			struct TraceEvent
+			{
+				const char32* name = nullptr;
+
+				uint64 requestID = 0;
+
+				int64 begin = 0;
+
+				int64 duration = 0;
+
+				uint32 threadID = 0;
+
+				// 通信全体のイベントのみ
+				Optional<HTTPAsyncStatus> status;
+
+				char url[TraceURLSize] = {};
+			};
+
+			/// <summary>
+			/// 書き込みがロックを使わないリングバッファ
+			/// スロットごとのシーケンス番号で、書き込み中や上書き中のイベントを読み飛ばします。
+			/// 容量より多くのスレッドが同時に書き込み、同じスロットを取り合った場合は、後から来た方のイベントを捨てます。
+			/// </summary>
+			class TraceBuffer
+			{
+			private:
+
+				struct Slot
+				{
+					// 奇数: 書き込み中, 偶数: (書き込んだ番号 + 1) * 2
+					std::atomic<uint64> sequence = 0;
+
+					TraceEvent event;
+				};
+
+				std::unique_ptr<Slot[]> m_slots;
+
+				size_t m_capacity = 0;
+
+				std::atomic<uint64> m_next = 0;
+
+			public:
+
+				explicit TraceBuffer(const size_t capacity)
+					: m_slots(std::make_unique<Slot[]>(Max<size_t>(capacity, 1)))
+					, m_capacity(Max<size_t>(capacity, 1)) {}
+
+				[[nodiscard]] size_t capacity() const noexcept
+				{
+					return m_capacity;
+				}
+
+				void push(const TraceEvent& event)
+				{
+					const uint64 index = m_next.fetch_add(1, std::memory_order_relaxed);
+					Slot& slot = m_slots[index % m_capacity];
+					const uint64 writing = ((index + 1) * 2 - 1);
+
+					// 他のスレッドが書き込み中か、より新しいイベントが書き込まれている場合は書き込まない
+					// 取得に成功した場合は、前に書き込んだスレッドの書き込みの後に書き込む（acquire）
+					uint64 sequence = slot.sequence.load(std::memory_order_relaxed);
+
+					do
+					{
+						if ((sequence % 2) || (writing < sequence))
+						{
+							return;
+						}
+					} while (!slot.sequence.compare_exchange_weak(sequence, writing, std::memory_order_acquire, std::memory_order_relaxed));
+
+					std::atomic_thread_fence(std::memory_order_release);
+					slot.event = event;
+					slot.sequence.store(((index + 1) * 2), std::memory_order_release);
+				}
+
+				Array<TraceEvent> load() const
+				{
+					const uint64 next = m_next.load(std::memory_order_acquire);
+					const uint64 first = ((next > m_capacity) ? (next - m_capacity) : 0);
+
+					Array<TraceEvent> events;
+					events.reserve(static_cast<size_t>(next - first));
+
+					for (uint64 index = first; index < next; ++index)
+					{
+						const Slot& slot = m_slots[index % m_capacity];
+						const uint64 expected = ((index + 1) * 2);
+
+						if (slot.sequence.load(std::memory_order_acquire) != expected)
+						{
+							continue;
+						}
+
+						TraceEvent event = slot.event;
+						std::atomic_thread_fence(std::memory_order_acquire);
+
+						if (slot.sequence.load(std::memory_order_relaxed) == expected)
+						{
+							events.push_back(event);
+						}
+					}
+
+					return events;
+				}
+			};
+
+			std::atomic<TraceBuffer*> CurrentBuffer = nullptr;
+
+			std::atomic<uint64> NextRequestID = 1;
+
+			std::atomic<uint32> NextThreadID = 1;
+
+			// Enable(), Clear() で置き換えたバッファ。書き込み中のスレッドがあり得るため、終了まで解放しない
+			std::mutex RetiredBuffersMutex;
+
+			Array<std::unique_ptr<TraceBuffer>> RetiredBuffers;
+
+			uint32 GetThreadID()
+			{
+				thread_local const uint32 threadID = NextThreadID++;
+				return threadID;
+			}
+
+			void ReplaceBuffer(TraceBuffer* buffer)
+			{
+				std::lock_guard lock(RetiredBuffersMutex);
+
+				if (TraceBuffer* old = CurrentBuffer.exchange(buffer, std::memory_order_acq_rel))
+				{
+					RetiredBuffers.emplace_back(old);
+				}
+			}
+
+			void Emit(const char32* name, const uint64 requestID, const int64 begin, const int64 end,
+				const Optional<HTTPAsyncStatus>& status = none, const std::string& url = std::string())
+			{
+				TraceBuffer* buffer = CurrentBuffer.load(std::memory_order_acquire);
+
+				if (!buffer)
+				{
+					return;
+				}
+
+				TraceEvent event;
+				event.name = name;
+				event.requestID = requestID;
+				event.begin = begin;
+				event.duration = Max<int64>((end - begin), 0);
+				event.threadID = GetThreadID();
+				event.status = status;
+				std::memcpy(event.url, url.data(), Min(url.size(), (TraceURLSize - 1)));
+
+				buffer->push(event);
+			}
+
+			StringView ToStatusName(const HTTPAsyncStatus status)
+			{
+				switch (status)
+				{
+				case HTTPAsyncStatus::Succeeded:
+					return U"Succeeded";
+				case HTTPAsyncStatus::Canceled:
+					return U"Canceled";
+				case HTTPAsyncStatus::TimedOut:
+					return U"TimedOut";
+				default:
+					return U"Failed";
+				}
+			}
+
+			String EscapeJSON(const StringView s)
+			{
+				String escaped;
+
+				for (const char32 ch : s)
+				{
+					if ((ch == U'"') || (ch == U'\\'))
+					{
+						escaped.push_back(U'\\');
+					}
+
+					if (ch >= 0x20)
+					{
+						escaped.push_back(ch);
+					}
+				}
+
+				return escaped;
+			}
+		}
+
+		int64 GetTraceMicrosec()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		HTTPRequestTrace::HTTPRequestTrace(const URLView url)
+		{
+			if (!HTTPTraceEnabled.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			m_id = NextRequestID++;
+			m_url = Unicode::ToUTF8(url);
+			m_createdAt = GetTraceMicrosec();
+		}
+
+		void HTTPRequestTrace::started()
+		{
+			if (!isEnabled())
+			{
+				return;
+			}
+
+			Emit(U"queued", m_id, m_createdAt, GetTraceMicrosec());
+		}
+
+		void HTTPRequestTrace::transferred(const int64 performBegin, const HTTPTransferInfo& info)
+		{
+			if (!isEnabled())
+			{
+				return;
+			}
+
+			int64 t = performBegin;
+
+			const auto emitPhase = [&](const char32* name, const int64 duration)
+			{
+				if (duration >= 0)
+				{
+					Emit(name, m_id, t, (t + duration));
+					t += duration;
+				}
+			};
+
+			emitPhase(U"DNS", info.dnsMicrosec);
+			emitPhase(U"connect", info.connectMicrosec);
+			emitPhase(U"TLS", info.tlsMicrosec);
+
+			if (info.ttfbMicrosec >= 0)
+			{
+				emitPhase(U"first byte", ((performBegin + info.ttfbMicrosec) - t));
+
+				if (info.totalMicrosec >= 0)
+				{
+					emitPhase(U"body", ((performBegin + info.totalMicrosec) - t));
+				}
+			}
+		}
+
+		void HTTPRequestTrace::flushed(const int64 flushBegin)
+		{
+			if (!isEnabled())
+			{
+				return;
+			}
+
+			Emit(U"disk flush", m_id, flushBegin, GetTraceMicrosec());
+		}
+
+		void HTTPRequestTrace::finished(const HTTPAsyncStatus status)
+		{
+			if (!isEnabled())
+			{
+				return;
+			}
+
+			m_finishedAt = GetTraceMicrosec();
+
+			Emit(U"request", m_id, m_createdAt, m_finishedAt, status, m_url);
+		}
+
+		void HTTPRequestTrace::delivered()
+		{
+			if (!isEnabled() || (m_finishedAt == 0) || m_delivered.exchange(true, std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			Emit(U"completion", m_id, m_finishedAt, GetTraceMicrosec());
+		}
+	}
+
+	namespace HTTPTrace
+	{
+		void Enable(const size_t capacity)
+		{
+			detail::ReplaceBuffer(new detail::TraceBuffer(capacity));
+			detail::HTTPTraceEnabled = true;
+		}
+
+		void Disable()
+		{
+			detail::HTTPTraceEnabled = false;
+		}
+
+		bool IsEnabled()
+		{
+			return detail::HTTPTraceEnabled;
+		}
+
+		void Clear()
+		{
+			if (const detail::TraceBuffer* buffer = detail::CurrentBuffer.load(std::memory_order_acquire))
+			{
+				detail::ReplaceBuffer(new detail::TraceBuffer(buffer->capacity()));
+			}
+		}
+
+		String ExportChromeTrace()
+		{
+			String json = U"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+			if (const detail::TraceBuffer* buffer = detail::CurrentBuffer.load(std::memory_order_acquire))
+			{
+				bool first = true;
+
+				for (const auto& event : buffer->load())
+				{
+					if (!first)
+					{
+						json.push_back(U',');
+					}
+
+					first = false;
+
+					json += U"\n{{\"name\":\"{}\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{},\"args\":{{\"request\":{}"_fmt(
+						event.name, event.begin, event.duration, event.threadID, event.requestID);
+
+					if (event.status)
+					{
+						json += U",\"status\":\"{}\",\"url\":\"{}\""_fmt(detail::ToStatusName(*event.status), detail::EscapeJSON(Unicode::FromUTF8(event.url)));
+					}
+
+					json += U"}}";
+				}
+			}
+
+			json += U"\n]}\n";
+
+			return json;
+		}
+
+		bool SaveChromeTrace(const FilePathView path)
+		{
+			TextWriter writer(path);
+
+			if (!writer)
+			{
+				return false;
+			}
+
+			writer.write(ExportChromeTrace());
+
+			return true;
+		}
+	}
+}